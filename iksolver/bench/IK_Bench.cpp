@@ -0,0 +1,187 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/bench/IK_Bench.cpp
+ *  \ingroup iksolver
+ */
+
+#include "IK_Bench.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+struct Bench {
+	const char *name;
+	void (*func)();
+	const char *description;
+};
+
+static const Bench benches[] = {
+	{"fixed_size", BenchFixedSize, "fixed task size vs dynamically sized jacobians"},
+	{"cholesky", BenchCholesky, "cholesky DLS vs SVD based inversion on long chains"},
+	{"lock_update", BenchLockUpdate, "updating vs recomputing the factorization when locking DoFs"},
+	{"quadruped", BenchQuadruped, "quadruped with fixed and free hips, split into jacobian blocks"},
+	{"precision", BenchPrecision, "single vs double precision jacobian inversion"},
+	{"fabrik", BenchFabrik, "FABRIK vs the jacobian solver on chains with a position goal"},
+	{"lm", BenchLevenbergMarquardt, "iteration histograms of levenberg-marquardt vs SDLS and DLS"},
+	{"transpose", BenchTranspose, "jacobian transpose vs SDLS and DLS per solve"},
+	{"dirty_transform", BenchDirtyTransform, "flat skeleton transform updates vs recursing over the tree"},
+	{"thread_scaling", BenchThreadScaling, "parallel solves of a crowd on 1 to all cores"},
+	{"batch", BenchBatch, "a crowd solved in lockstep with IK_SolveBatch vs an IK_Solve loop"},
+};
+
+static const int num_benches = sizeof(benches) / sizeof(benches[0]);
+
+double BenchTime()
+{
+	std::chrono::steady_clock::duration time = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration<double, std::micro>(time).count();
+}
+
+float BenchRandom(unsigned int& seed)
+{
+	seed = seed * 1664525u + 1013904223u;
+	return (seed >> 8) / 16777216.0f;
+}
+
+IK_Segment *BenchAddChain(BenchRig& rig, IK_Segment *parent, int num, int flag,
+                          float limit, const float offset[3], bool tip)
+{
+	float identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+	float end[3] = {0, 0, 0};
+	size_t j;
+	int i;
+
+	// segments point along y in the rest pose, so the chain ends num
+	// segments above where it starts
+	for (j = 0; j < rig.segments.size(); j++) {
+		if (rig.segments[j] == parent) {
+			end[0] = rig.segment_rest[j * 3 + 0];
+			end[1] = rig.segment_rest[j * 3 + 1];
+			end[2] = rig.segment_rest[j * 3 + 2];
+		}
+	}
+
+	end[0] += offset[0];
+	end[1] += offset[1];
+	end[2] += offset[2];
+
+	for (i = 0; i < num; i++) {
+		IK_Segment *seg = IK_CreateSegment(flag);
+		float start[3] = {0, 0, 0};
+
+		if (i == 0) {
+			start[0] = offset[0];
+			start[1] = offset[1];
+			start[2] = offset[2];
+		}
+
+		IK_SetTransform(seg, start, identity, identity, 1.0f);
+
+		if (limit > 0.0f) {
+			if (flag & IK_XDOF)
+				IK_SetLimit(seg, IK_X, -limit, limit);
+			if (flag & IK_YDOF)
+				IK_SetLimit(seg, IK_Y, -limit, limit);
+			if (flag & IK_ZDOF)
+				IK_SetLimit(seg, IK_Z, -limit, limit);
+		}
+
+		if (parent)
+			IK_SetParent(seg, parent);
+		else
+			rig.root = seg;
+
+		end[1] += 1.0f;
+
+		rig.segments.push_back(seg);
+		rig.segment_rest.insert(rig.segment_rest.end(), end, end + 3);
+		parent = seg;
+	}
+
+	if (tip) {
+		rig.tips.push_back(parent);
+		rig.tip_rest.insert(rig.tip_rest.end(), end, end + 3);
+	}
+
+	return parent;
+}
+
+void BenchFreeRig(BenchRig& rig)
+{
+	std::vector<IK_Segment *>::iterator seg;
+
+	for (seg = rig.segments.begin(); seg != rig.segments.end(); seg++)
+		IK_FreeSegment(*seg);
+
+	rig.segments.clear();
+	rig.segment_rest.clear();
+	rig.tips.clear();
+	rig.tip_rest.clear();
+	rig.root = NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int i, j;
+
+	if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+		printf("usage: %s [benchmark...]\n\nruns all benchmarks without arguments\n\n", argv[0]);
+		for (i = 0; i < num_benches; i++)
+			printf("  %-16s %s\n", benches[i].name, benches[i].description);
+		return 0;
+	}
+
+	for (i = 1; i < argc; i++) {
+		for (j = 0; j < num_benches; j++)
+			if (strcmp(argv[i], benches[j].name) == 0)
+				break;
+
+		if (j == num_benches) {
+			fprintf(stderr, "unknown benchmark %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < num_benches; i++) {
+		bool run = (argc == 1);
+
+		for (j = 1; j < argc; j++)
+			if (strcmp(argv[j], benches[i].name) == 0)
+				run = true;
+
+		if (run) {
+			printf("%s: %s\n\n", benches[i].name, benches[i].description);
+			benches[i].func();
+			printf("\n");
+		}
+	}
+
+	return 0;
+}
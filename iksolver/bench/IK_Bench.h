@@ -0,0 +1,85 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/bench/IK_Bench.h
+ *  \ingroup iksolver
+ */
+
+#pragma once
+
+#include "IK_solver.h"
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Benchmarks of the solver, see IK_Bench.cpp for the list. Times are
+ * averaged over many runs and printed in microseconds. The numbers are
+ * only comparable between runs on the same machine and build type.
+ */
+
+// the benchmarks
+void BenchFixedSize();
+void BenchCholesky();
+void BenchLockUpdate();
+void BenchQuadruped();
+void BenchPrecision();
+void BenchFabrik();
+void BenchLevenbergMarquardt();
+void BenchTranspose();
+void BenchDirtyTransform();
+void BenchThreadScaling();
+void BenchBatch();
+
+// current time in microseconds
+double BenchTime();
+
+// random number in 0..1, advances the seed
+float BenchRandom(unsigned int& seed);
+
+// segments of a rig created by a benchmark, and the tips to put goals on.
+// for each segment and tip the position of its end in the rest pose is
+// kept, as x, y, z
+struct BenchRig {
+	std::vector<IK_Segment *> segments;
+	std::vector<float> segment_rest;
+	std::vector<IK_Segment *> tips;
+	std::vector<float> tip_rest;
+	IK_Segment *root;
+
+	BenchRig() : root(NULL) {}
+};
+
+// add a chain of num segments of unit length along y below parent, or as
+// root of the rig for a NULL parent. the first segment starts at offset
+// from the end of the parent. with limit each rotation DoF is limited to
+// -limit..limit. the last segment is added to the tips unless tip is false
+IK_Segment *BenchAddChain(BenchRig& rig, IK_Segment *parent, int num, int flag,
+                          float limit, const float offset[3], bool tip = true);
+
+void BenchFreeRig(BenchRig& rig);
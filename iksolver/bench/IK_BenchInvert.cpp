@@ -0,0 +1,242 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/bench/IK_BenchInvert.cpp
+ *  \ingroup iksolver
+ */
+
+#include "IK_Bench.h"
+
+#include <cmath>
+#include <cstdio>
+
+static const char *mode_names[] = {"sdls", "dls", "dls_cholesky", "lm", "transpose"};
+
+struct SolveStats {
+	double time;
+	long iterations;
+	int converged;
+	int runs;
+
+	SolveStats() : time(0.0), iterations(0), converged(0), runs(0) {}
+};
+
+// solve a chain of num segments from the root up for random goals within
+// reach of it, the invert mode is only used by the jacobian solver
+static void SolveChain(int num, int flag, IK_SolverType type, IK_InvertMode mode, float tolerance,
+                       int runs, SolveStats& stats)
+{
+	const float offset[3] = {0, 0, 0};
+	float reach = 0.7f * num;
+	unsigned int seed = 1;
+	BenchRig rig;
+	int run;
+
+	BenchAddChain(rig, NULL, num, flag, 0.0f, offset);
+
+	IK_Solver *solver = IK_CreateSolver(rig.root);
+	float goal[3] = {0, 0, 0};
+	IK_Task *task = IK_SolverAddGoal(solver, rig.tips[0], goal, 1.0f);
+
+	IK_SetSolverType(solver, type);
+	IK_SolverSetInvertMode(solver, mode);
+
+	for (run = 0; run < runs; run++) {
+		goal[0] = (BenchRandom(seed) * 2.0f - 1.0f) * reach;
+		goal[1] = BenchRandom(seed) * reach;
+		goal[2] = (BenchRandom(seed) * 2.0f - 1.0f) * reach;
+		IK_SolverSetGoal(solver, task, goal);
+
+		double start = BenchTime();
+		stats.converged += IK_Solve(solver, tolerance, 500);
+		stats.time += BenchTime() - start;
+		stats.iterations += IK_SolverGetIterations(solver);
+		stats.runs++;
+	}
+
+	IK_FreeSolver(solver);
+	BenchFreeRig(rig);
+}
+
+void BenchCholesky()
+{
+	const IK_InvertMode modes[] = {IK_INVERT_SDLS, IK_INVERT_DLS, IK_INVERT_DLS_CHOLESKY};
+	const int lengths[] = {4, 8, 16, 32};
+	int m, l;
+
+	printf("chains of ball joints with a position goal at random, 500 solves\n\n");
+	printf("%-13s %4s %4s %8s %8s %7s %6s\n", "mode", "segs", "dof", "us/iter", "us/solve", "iters", "conv%");
+
+	for (l = 0; l < 4; l++) {
+		for (m = 0; m < 3; m++) {
+			SolveStats stats;
+			SolveChain(lengths[l], IK_XDOF | IK_YDOF | IK_ZDOF, IK_SOLVER_JACOBIAN, modes[m], 1e-3f, 500, stats);
+
+			printf("%-13s %4d %4d %8.2f %8.1f %7.1f %6.1f\n", mode_names[modes[m]], lengths[l], lengths[l] * 3,
+			       stats.time / stats.iterations, stats.time / stats.runs,
+			       (double)stats.iterations / stats.runs, 100.0 * stats.converged / stats.runs);
+		}
+	}
+}
+
+void BenchFabrik()
+{
+	const IK_SolverType types[] = {IK_SOLVER_JACOBIAN, IK_SOLVER_JACOBIAN, IK_SOLVER_FABRIK};
+	const IK_InvertMode modes[] = {IK_INVERT_SDLS, IK_INVERT_DLS_CHOLESKY, IK_INVERT_SDLS};
+	const char *names[] = {"sdls", "dls_cholesky", "fabrik"};
+	const int lengths[] = {3, 5, 8, 12, 20};
+	int s, l;
+
+	printf("chains of ball joints with a position goal at random, 500 solves\n\n");
+	printf("%-13s %4s %8s %8s %7s %6s\n", "solver", "segs", "us/iter", "us/solve", "iters", "conv%");
+
+	for (l = 0; l < 5; l++) {
+		for (s = 0; s < 3; s++) {
+			SolveStats stats;
+			SolveChain(lengths[l], IK_XDOF | IK_YDOF | IK_ZDOF, types[s], modes[s], 1e-3f, 500, stats);
+
+			printf("%-13s %4d %8.2f %8.1f %7.1f %6.1f\n", names[s], lengths[l],
+			       stats.time / stats.iterations, stats.time / stats.runs,
+			       (double)stats.iterations / stats.runs, 100.0 * stats.converged / stats.runs);
+		}
+	}
+}
+
+void BenchTranspose()
+{
+	const IK_InvertMode modes[] = {IK_INVERT_SDLS, IK_INVERT_DLS, IK_INVERT_TRANSPOSE};
+	const float tolerances[] = {1e-2f, 1e-3f};
+	const int lengths[] = {4, 8, 16, 32};
+	int t, l, m;
+
+	for (t = 0; t < 2; t++) {
+		printf("%schains of ball joints with a position goal at random, tolerance %g, 500 solves\n\n",
+		       (t) ? "\n" : "", tolerances[t]);
+		printf("%-13s %4s %8s %8s %7s %6s\n", "mode", "segs", "us/iter", "us/solve", "iters", "conv%");
+
+		for (l = 0; l < 4; l++) {
+			for (m = 0; m < 3; m++) {
+				SolveStats stats;
+				SolveChain(lengths[l], IK_XDOF | IK_YDOF | IK_ZDOF, IK_SOLVER_JACOBIAN, modes[m], tolerances[t],
+				           500, stats);
+
+				printf("%-13s %4d %8.2f %8.1f %7.1f %6.1f\n", mode_names[modes[m]], lengths[l],
+				       stats.time / stats.iterations, stats.time / stats.runs,
+				       (double)stats.iterations / stats.runs, 100.0 * stats.converged / stats.runs);
+			}
+		}
+	}
+}
+
+// iteration histogram of solves for goals that jump to random points, or
+// that move smoothly as when solving each frame, continuing from the pose
+// of the last solve in both cases
+static void SolveHistogram(int num, bool orientation, bool smooth, IK_InvertMode mode)
+{
+	const int edges[] = {5, 10, 20, 50, 100};
+	const int runs = 2000;
+	const float offset[3] = {0, 0, 0};
+	float reach = 0.6f * num;
+	int histogram[6] = {0, 0, 0, 0, 0, 0};
+	unsigned int seed = 1;
+	SolveStats stats;
+	BenchRig rig;
+	int run, i;
+
+	BenchAddChain(rig, NULL, num, IK_XDOF | IK_ZDOF, 0.0f, offset);
+
+	IK_Solver *solver = IK_CreateSolver(rig.root);
+	float goal[3] = {0, 0, 0}, rot[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+	IK_Task *task = IK_SolverAddGoal(solver, rig.tips[0], goal, 1.0f);
+	IK_Task *task_rot = (orientation) ? IK_SolverAddGoalOrientation(solver, rig.tips[0], rot, 1.0f) : NULL;
+
+	IK_SolverSetInvertMode(solver, mode);
+
+	for (run = 0; run < runs; run++) {
+		float angle;
+
+		if (smooth) {
+			float t = run * 0.05f;
+			goal[0] = 0.5f * num * cosf(t);
+			goal[1] = 0.6f * num + 0.2f * num * sinf(2.0f * t);
+			goal[2] = 0.5f * num * sinf(t);
+			angle = 0.5f * sinf(t);
+		}
+		else {
+			goal[0] = (BenchRandom(seed) * 2.0f - 1.0f) * reach;
+			goal[1] = BenchRandom(seed) * reach;
+			goal[2] = (BenchRandom(seed) * 2.0f - 1.0f) * reach;
+			angle = BenchRandom(seed) * 2.0f - 1.0f;
+		}
+
+		IK_SolverSetGoal(solver, task, goal);
+
+		if (task_rot) {
+			rot[0][0] = rot[1][1] = cosf(angle);
+			rot[0][1] = -sinf(angle);
+			rot[1][0] = sinf(angle);
+			IK_SolverSetGoalOrientation(solver, task_rot, rot);
+		}
+
+		double start = BenchTime();
+		stats.converged += IK_Solve(solver, 1e-3f, 500);
+		stats.time += BenchTime() - start;
+		stats.runs++;
+
+		int iterations = IK_SolverGetIterations(solver);
+		stats.iterations += iterations;
+
+		for (i = 0; i < 5 && iterations >= edges[i]; i++) {}
+		histogram[i]++;
+	}
+
+	IK_FreeSolver(solver);
+	BenchFreeRig(rig);
+
+	printf("%3d%-5s %-9s %8.1f %7.1f %5d %6d %6d %6d %6d %6d %6d\n", num, (orientation) ? " rot" : "",
+	       mode_names[mode], stats.time / stats.runs, (double)stats.iterations / stats.runs, stats.converged,
+	       histogram[0], histogram[1], histogram[2], histogram[3], histogram[4], histogram[5]);
+}
+
+void BenchLevenbergMarquardt()
+{
+	const IK_InvertMode modes[] = {IK_INVERT_SDLS, IK_INVERT_DLS, IK_INVERT_LM};
+	const int lengths[] = {4, 8, 20, 8};
+	int smooth, l, m;
+
+	for (smooth = 0; smooth < 2; smooth++) {
+		printf("%schains of swing joints with a position goal %s, 2000 solves\n\n",
+		       (smooth) ? "\n" : "", (smooth) ? "moving smoothly" : "jumping to random points");
+		printf("%-8s %-9s %8s %7s %5s %6s %6s %6s %6s %6s %6s\n", "segs", "mode", "us/solve", "iters", "conv",
+		       "<5", "<10", "<20", "<50", "<100", "100+");
+
+		for (l = 0; l < 4; l++)
+			for (m = 0; m < 3; m++)
+				SolveHistogram(lengths[l], l == 3, smooth != 0, modes[m]);
+	}
+}
@@ -0,0 +1,204 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/bench/IK_BenchJacobian.cpp
+ *  \ingroup iksolver
+ */
+
+#include "IK_Bench.h"
+#include "IK_QJacobian.h"
+
+#include <cstdio>
+
+static const char *mode_names[] = {"sdls", "dls", "dls_cholesky", "lm", "transpose"};
+
+static Vector3d RandomVector(unsigned int& seed)
+{
+	return Vector3d(BenchRandom(seed) * 2.0 - 1.0, BenchRandom(seed) * 2.0 - 1.0, BenchRandom(seed) * 2.0 - 1.0);
+}
+
+// fill the jacobian with random derivatives and betas, as the tasks do
+// each iteration
+static void SetRandom(IK_QJacobian *jacobian, int dof, int task_size, unsigned int& seed)
+{
+	int id, dof_id;
+
+	for (id = 0; id < task_size; id += 3) {
+		jacobian->SetBetas(id, 3, RandomVector(seed) * 0.1);
+
+		for (dof_id = 0; dof_id < dof; dof_id++)
+			jacobian->SetDerivatives(id, dof_id, RandomVector(seed), 1.0);
+	}
+}
+
+// average time of an Invert of a random jacobian
+static double TimeInvert(IK_QJacobian *jacobian, int dof, int task_size,
+                         IK_QJacobian::InvertMode mode)
+{
+	const int runs = 20000;
+	unsigned int seed = 1;
+	double time = 0.0;
+	int run;
+
+	jacobian->ArmMatrices(dof, task_size);
+	jacobian->SetInvertMode(mode);
+	jacobian->SetDamping(0.1);
+
+	for (run = 0; run < runs; run++) {
+		SetRandom(jacobian, dof, task_size, seed);
+
+		double start = BenchTime();
+		jacobian->Invert();
+		time += BenchTime() - start;
+	}
+
+	return time / runs;
+}
+
+void BenchFixedSize()
+{
+	const IK_QJacobian::InvertMode modes[] = {
+		IK_QJacobian::INVERT_SDLS, IK_QJacobian::INVERT_DLS, IK_QJacobian::INVERT_DLS_CHOLESKY};
+	int m, task_size, dof;
+
+	printf("us per Invert of a task x dof jacobian with random derivatives\n\n");
+	printf("%-13s %4s %4s %8s %8s %7s\n", "mode", "task", "dof", "fixed", "dynamic", "speedup");
+
+	for (m = 0; m < 3; m++) {
+		for (task_size = 3; task_size <= 6; task_size += 3) {
+			for (dof = task_size; dof <= 15; dof += 3) {
+				IK_QJacobian *fixed = IK_QJacobian::Create(dof, task_size, IK_QJacobian::PRECISION_DOUBLE, NULL);
+				IK_QJacobian *dynamic = IK_QJacobian::CreateDynamic(IK_QJacobian::PRECISION_DOUBLE, NULL);
+
+				double fixed_time = TimeInvert(fixed, dof, task_size, modes[m]);
+				double dynamic_time = TimeInvert(dynamic, dof, task_size, modes[m]);
+
+				printf("%-13s %4d %4d %8.3f %8.3f %6.2fx\n", mode_names[modes[m]], task_size, dof,
+				       fixed_time, dynamic_time, dynamic_time / fixed_time);
+
+				IK_QArenaDelete<IK_QJacobian>(NULL, fixed);
+				IK_QArenaDelete<IK_QJacobian>(NULL, dynamic);
+			}
+		}
+	}
+}
+
+// average time of locking num_locks DoFs one after the other after an
+// Invert, each followed by an Invert as in the clamping loop of the
+// solver. with recompute the factorization is invalidated after each lock
+static double TimeLocks(IK_QJacobian *jacobian, int dof, int task_size, int num_locks,
+                        IK_QJacobian::InvertMode mode, bool recompute)
+{
+	const int runs = 5000;
+	unsigned int seed = 1;
+	double time = 0.0;
+	int run, lock;
+
+	jacobian->ArmMatrices(dof, task_size);
+	jacobian->SetInvertMode(mode);
+
+	for (run = 0; run < runs; run++) {
+		SetRandom(jacobian, dof, task_size, seed);
+		jacobian->Invert();
+
+		double start = BenchTime();
+
+		for (lock = 0; lock < num_locks; lock++) {
+			int dof_id = (lock * 5) % dof;
+
+			jacobian->Lock(dof_id, jacobian->AngleUpdate(dof_id) * 0.5);
+
+			if (recompute)
+				jacobian->SetDerivatives(0, dof_id, Vector3d(0.0, 0.0, 0.0), 1.0);
+
+			jacobian->Invert();
+		}
+
+		time += BenchTime() - start;
+	}
+
+	return time / runs;
+}
+
+void BenchLockUpdate()
+{
+	const IK_QJacobian::InvertMode modes[] = {IK_QJacobian::INVERT_SDLS, IK_QJacobian::INVERT_DLS_CHOLESKY};
+	const int dofs[] = {8, 16, 32, 48};
+	int m, task_size, d;
+
+	printf("us to lock a third of the DoFs one at a time, each followed by an Invert,\n");
+	printf("updating the factorization vs recomputing it. 16 DoF is a spine of 8\n");
+	printf("swing segments\n\n");
+	printf("%-13s %4s %4s %5s %8s %9s %7s\n", "mode", "task", "dof", "locks", "update", "recompute", "speedup");
+
+	for (m = 0; m < 2; m++) {
+		for (task_size = 3; task_size <= 6; task_size += 3) {
+			for (d = 0; d < 4; d++) {
+				int dof = dofs[d], num_locks = dof / 3;
+				IK_QJacobian *jacobian = IK_QJacobian::Create(dof, task_size, IK_QJacobian::PRECISION_DOUBLE, NULL);
+
+				double update_time = TimeLocks(jacobian, dof, task_size, num_locks, modes[m], false);
+				double recompute_time = TimeLocks(jacobian, dof, task_size, num_locks, modes[m], true);
+
+				printf("%-13s %4d %4d %5d %8.2f %9.2f %6.2fx\n", mode_names[modes[m]], task_size, dof, num_locks,
+				       update_time, recompute_time, recompute_time / update_time);
+
+				IK_QArenaDelete<IK_QJacobian>(NULL, jacobian);
+			}
+		}
+	}
+}
+
+void BenchPrecision()
+{
+	const int dofs[] = {4, 8, 16, 40, 80};
+	int m, task_size, d;
+
+	printf("us per Invert of a task x dof jacobian with random derivatives, in\n");
+	printf("double vs single precision\n\n");
+	printf("%-13s %4s %4s %8s %8s %7s\n", "mode", "task", "dof", "double", "float", "speedup");
+
+	for (m = 0; m < 5; m++) {
+		for (task_size = 3; task_size <= 6; task_size += 3) {
+			for (d = 0; d < 5; d++) {
+				int dof = dofs[d];
+				IK_QJacobian *jd = IK_QJacobian::Create(dof, task_size, IK_QJacobian::PRECISION_DOUBLE, NULL);
+				IK_QJacobian *jf = IK_QJacobian::Create(dof, task_size, IK_QJacobian::PRECISION_FLOAT, NULL);
+
+				double double_time = TimeInvert(jd, dof, task_size, (IK_QJacobian::InvertMode)m);
+				double float_time = TimeInvert(jf, dof, task_size, (IK_QJacobian::InvertMode)m);
+
+				printf("%-13s %4d %4d %8.3f %8.3f %6.2fx\n", mode_names[m], task_size, dof,
+				       double_time, float_time, double_time / float_time);
+
+				IK_QArenaDelete<IK_QJacobian>(NULL, jd);
+				IK_QArenaDelete<IK_QJacobian>(NULL, jf);
+			}
+		}
+	}
+}
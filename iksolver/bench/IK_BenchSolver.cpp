@@ -0,0 +1,315 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/bench/IK_BenchSolver.cpp
+ *  \ingroup iksolver
+ */
+
+#include "IK_Bench.h"
+
+#include <cstdio>
+
+static const char *mode_names[] = {"sdls", "dls", "dls_cholesky", "lm", "transpose"};
+
+// hips with a spine, a neck with the head, a tail and four legs of three
+// segments. the hips are fixed, or rotate freely so that all goals depend
+// on their DoFs
+static void CreateQuadruped(BenchRig& rig, bool free_hips)
+{
+	const float zero[3] = {0, 0, 0}, tail[3] = {0, -1, 0};
+	int i;
+
+	IK_Segment *hips = BenchAddChain(rig, NULL, 1, free_hips ? IK_XDOF | IK_YDOF | IK_ZDOF : 0, 0.0f, zero, false);
+	IK_Segment *spine = BenchAddChain(rig, hips, 3, IK_XDOF | IK_ZDOF, 0.4f, zero, false);
+
+	BenchAddChain(rig, spine, 3, IK_XDOF | IK_YDOF | IK_ZDOF, 0.0f, zero);
+	BenchAddChain(rig, hips, 4, IK_XDOF | IK_ZDOF, 0.0f, tail, false);
+
+	for (i = 0; i < 4; i++) {
+		const float offset[3] = {(i % 2) ? 0.5f : -0.5f, 0, 0};
+		BenchAddChain(rig, (i < 2) ? spine : hips, 3, IK_XDOF | IK_ZDOF, 1.2f, offset);
+	}
+}
+
+// solve for random goals around the rest pose of the tips
+static void SolveRandomGoals(BenchRig& rig, IK_InvertMode mode, int runs, float reach,
+                             double& time, long& iterations, int& converged)
+{
+	std::vector<IK_Task *> tasks;
+	unsigned int seed = 1;
+	size_t i;
+	int run;
+
+	IK_Solver *solver = IK_CreateSolver(rig.root);
+	IK_SolverSetInvertMode(solver, mode);
+
+	for (i = 0; i < rig.tips.size(); i++)
+		tasks.push_back(IK_SolverAddGoal(solver, rig.tips[i], &rig.tip_rest[i * 3], 1.0f));
+
+	time = 0.0;
+	iterations = 0;
+	converged = 0;
+
+	for (run = 0; run < runs; run++) {
+		for (i = 0; i < tasks.size(); i++) {
+			float goal[3];
+			int j;
+
+			// the chains are stretched in the rest pose, so only goals
+			// below it can be reached
+			for (j = 0; j < 3; j++)
+				goal[j] = rig.tip_rest[i * 3 + j] + (BenchRandom(seed) * 2.0f - 1.0f) * reach;
+
+			goal[1] -= reach;
+
+			IK_SolverSetGoal(solver, tasks[i], goal);
+		}
+
+		double start = BenchTime();
+		converged += IK_Solve(solver, 1e-3f, 500);
+		time += BenchTime() - start;
+		iterations += IK_SolverGetIterations(solver);
+	}
+
+	IK_FreeSolver(solver);
+}
+
+void BenchQuadruped()
+{
+	const IK_InvertMode modes[] = {IK_INVERT_SDLS, IK_INVERT_DLS_CHOLESKY};
+	const int runs = 1000;
+	int free_hips, m;
+
+	printf("quadruped with goals on the feet and head, %d solves for random goals\n\n", runs);
+	printf("%-11s %-13s %8s %8s %7s %6s\n", "hips", "mode", "us/solve", "us/iter", "iters", "conv%");
+
+	for (free_hips = 0; free_hips < 2; free_hips++) {
+		for (m = 0; m < 2; m++) {
+			BenchRig rig;
+			double time;
+			long iterations;
+			int converged;
+
+			CreateQuadruped(rig, free_hips != 0);
+			SolveRandomGoals(rig, modes[m], runs, 0.6f, time, iterations, converged);
+
+			printf("%-11s %-13s %8.1f %8.2f %7.1f %6.1f\n", free_hips ? "free" : "fixed", mode_names[modes[m]],
+			       time / runs, time / iterations, (double)iterations / runs, 100.0 * converged / runs);
+
+			BenchFreeRig(rig);
+		}
+	}
+}
+
+// time of solving a crowd of quadrupeds with random goals each frame on a
+// pool of num_threads threads, in microseconds per frame
+static double TimeCrowd(std::vector<BenchRig>& rigs, std::vector<IK_Solver *>& solvers,
+                        std::vector<std::vector<IK_Task *> >& tasks, int num_threads,
+                        int frames, int& converged)
+{
+	IK_ThreadPool *pool = IK_CreateThreadPool(num_threads, 1);
+	unsigned int seed = 1;
+	double time = 0.0;
+	size_t c, i;
+	int frame, j;
+
+	converged = 0;
+
+	for (frame = 0; frame < frames; frame++) {
+		for (c = 0; c < rigs.size(); c++) {
+			for (i = 0; i < tasks[c].size(); i++) {
+				float goal[3];
+
+				for (j = 0; j < 3; j++)
+					goal[j] = rigs[c].tip_rest[i * 3 + j] + (BenchRandom(seed) * 2.0f - 1.0f) * 0.6f;
+
+				goal[1] -= 0.6f;
+
+				IK_SolverSetGoal(solvers[c], tasks[c][i], goal);
+			}
+		}
+
+		double start = BenchTime();
+		converged += IK_SolveParallel(pool, &solvers[0], (int)solvers.size(), 1e-3f, 500);
+		time += BenchTime() - start;
+	}
+
+	IK_FreeThreadPool(pool);
+
+	return time / frames;
+}
+
+void BenchThreadScaling()
+{
+	const int num_characters = 64, frames = 20;
+	std::vector<BenchRig> rigs(num_characters);
+	std::vector<IK_Solver *> solvers;
+	std::vector<std::vector<IK_Task *> > tasks(num_characters);
+	std::vector<int> thread_counts;
+	double single_time = 0.0;
+	int c, num_cores, n;
+	size_t i;
+
+	for (c = 0; c < num_characters; c++) {
+		CreateQuadruped(rigs[c], true);
+		solvers.push_back(IK_CreateSolver(rigs[c].root));
+		IK_SolverSetInvertMode(solvers[c], IK_INVERT_DLS_CHOLESKY);
+
+		for (i = 0; i < rigs[c].tips.size(); i++)
+			tasks[c].push_back(IK_SolverAddGoal(solvers[c], rigs[c].tips[i], &rigs[c].tip_rest[i * 3], 1.0f));
+	}
+
+	// the pool of 0 threads has one per core
+	IK_ThreadPool *pool = IK_CreateThreadPool(0, 0);
+	num_cores = IK_ThreadPoolGetNumThreads(pool);
+	IK_FreeThreadPool(pool);
+
+	for (n = 1; n < num_cores; n *= 2)
+		thread_counts.push_back(n);
+	thread_counts.push_back(num_cores);
+
+	printf("%d quadrupeds with free hips solved with cholesky DLS for random goals\n", num_characters);
+	printf("with IK_SolveParallel, on pinned thread pools of 1 to %d threads, %d frames\n\n", num_cores, frames);
+	printf("%7s %9s %11s %7s %6s\n", "threads", "us/frame", "solves/ms", "speedup", "conv%");
+
+	for (i = 0; i < thread_counts.size(); i++) {
+		int converged;
+		double time = TimeCrowd(rigs, solvers, tasks, thread_counts[i], frames, converged);
+
+		if (i == 0)
+			single_time = time;
+
+		printf("%7d %9.1f %11.2f %6.2fx %6.1f\n", thread_counts[i], time, 1000.0 * num_characters / time,
+		       single_time / time, 100.0 * converged / (num_characters * frames));
+	}
+
+	for (c = 0; c < num_characters; c++) {
+		IK_FreeSolver(solvers[c]);
+		BenchFreeRig(rigs[c]);
+	}
+}
+
+// a leg of three segments with limits
+static void CreateLeg(BenchRig& rig)
+{
+	const float zero[3] = {0, 0, 0};
+
+	BenchAddChain(rig, NULL, 3, IK_XDOF | IK_ZDOF, 1.2f, zero);
+}
+
+// time of solving a crowd for random goals each frame, with a loop over
+// IK_Solve or with IK_SolveBatch, in microseconds per frame
+static double TimeBatch(std::vector<BenchRig>& rigs, std::vector<IK_Solver *>& solvers,
+                        std::vector<std::vector<IK_Task *> >& tasks, bool batch, int frames,
+                        int& converged)
+{
+	unsigned int seed = 1;
+	double time = 0.0;
+	size_t c, i;
+	int frame, j;
+
+	converged = 0;
+
+	for (frame = 0; frame < frames; frame++) {
+		for (c = 0; c < rigs.size(); c++) {
+			for (i = 0; i < tasks[c].size(); i++) {
+				float goal[3];
+
+				for (j = 0; j < 3; j++)
+					goal[j] = rigs[c].tip_rest[i * 3 + j] + (BenchRandom(seed) * 2.0f - 1.0f) * 0.6f;
+
+				goal[1] -= 0.6f;
+
+				IK_SolverSetGoal(solvers[c], tasks[c][i], goal);
+			}
+		}
+
+		double start = BenchTime();
+		if (batch) {
+			converged += IK_SolveBatch(&solvers[0], (int)solvers.size(), 1e-3f, 500);
+		}
+		else {
+			for (c = 0; c < solvers.size(); c++)
+				converged += IK_Solve(solvers[c], 1e-3f, 500);
+		}
+		time += BenchTime() - start;
+	}
+
+	return time / frames;
+}
+
+void BenchBatch()
+{
+	const IK_InvertMode modes[] = {IK_INVERT_SDLS, IK_INVERT_DLS_CHOLESKY};
+	const char *rig_names[] = {"leg", "quadruped"};
+	const int num_characters = 64, frames = 50;
+	int r, m, c, batch;
+	size_t i;
+
+	printf("%d characters solved for random goals each frame, with a loop over\n", num_characters);
+	printf("IK_Solve vs IK_SolveBatch, %d frames, characters per ms\n\n", frames);
+	printf("%-10s %-13s %8s %8s %7s %6s\n", "rig", "mode", "loop", "batch", "speedup", "conv%");
+
+	for (r = 0; r < 2; r++) {
+		for (m = 0; m < 2; m++) {
+			double time[2];
+			int converged[2];
+
+			// the same crowd for both, each solved from its rest pose
+			for (batch = 0; batch < 2; batch++) {
+				std::vector<BenchRig> rigs(num_characters);
+				std::vector<IK_Solver *> solvers;
+				std::vector<std::vector<IK_Task *> > tasks(num_characters);
+
+				for (c = 0; c < num_characters; c++) {
+					if (r == 0)
+						CreateLeg(rigs[c]);
+					else
+						CreateQuadruped(rigs[c], false);
+
+					solvers.push_back(IK_CreateSolver(rigs[c].root));
+					IK_SolverSetInvertMode(solvers[c], modes[m]);
+
+					for (i = 0; i < rigs[c].tips.size(); i++)
+						tasks[c].push_back(IK_SolverAddGoal(solvers[c], rigs[c].tips[i], &rigs[c].tip_rest[i * 3], 1.0f));
+				}
+
+				time[batch] = TimeBatch(rigs, solvers, tasks, batch != 0, frames, converged[batch]);
+
+				for (c = 0; c < num_characters; c++) {
+					IK_FreeSolver(solvers[c]);
+					BenchFreeRig(rigs[c]);
+				}
+			}
+
+			printf("%-10s %-13s %8.1f %8.1f %6.2fx %6.1f\n", rig_names[r], mode_names[modes[m]],
+			       1000.0 * num_characters / time[0], 1000.0 * num_characters / time[1],
+			       time[0] / time[1], 100.0 * converged[1] / (num_characters * frames));
+		}
+	}
+}
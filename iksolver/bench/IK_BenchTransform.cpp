@@ -0,0 +1,159 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/bench/IK_BenchTransform.cpp
+ *  \ingroup iksolver
+ */
+
+#include "IK_Bench.h"
+#include "IK_QPose.h"
+#include "IK_QSegment.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <list>
+
+// hips with a spine, neck and head, legs of four segments and arms of four
+// segments with five fingers of three segments each, 52 segments in total
+static void CreateBody(BenchRig& rig)
+{
+	const float zero[3] = {0, 0, 0};
+	int i, j;
+
+	IK_Segment *hips = BenchAddChain(rig, NULL, 1, IK_XDOF | IK_YDOF | IK_ZDOF, 0.0f, zero, false);
+	IK_Segment *spine = BenchAddChain(rig, hips, 3, IK_XDOF | IK_ZDOF, 0.4f, zero, false);
+
+	BenchAddChain(rig, spine, 2, IK_XDOF | IK_YDOF | IK_ZDOF, 0.0f, zero);
+
+	for (i = 0; i < 2; i++) {
+		const float side[3] = {(i % 2) ? 0.3f : -0.3f, 0, 0};
+		const float leg[3] = {(i % 2) ? 0.3f : -0.3f, -1.0f, 0};
+
+		BenchAddChain(rig, hips, 4, IK_XDOF | IK_ZDOF, 1.2f, leg);
+		IK_Segment *hand = BenchAddChain(rig, spine, 4, IK_XDOF | IK_ZDOF, 1.2f, side, false);
+
+		for (j = 0; j < 5; j++) {
+			const float finger[3] = {(j - 2) * 0.05f, 0, 0};
+			BenchAddChain(rig, hand, 3, IK_XDOF, 1.2f, finger);
+		}
+	}
+}
+
+enum UpdateMode {
+	UPDATE_DIRTY,
+	UPDATE_ALL,
+	UPDATE_TREE
+};
+
+// average time of updating the transforms of the rig, with num_dirty
+// random segments changed before each update. the skeleton updates either
+// only the changed segments and their children or all segments in one
+// pass over its arrays, the tree is the recursive update over the segment
+// pointers the arrays replace. num_updated is set to the average number
+// of segments the dirty update recomputes
+static double TimeUpdate(BenchRig& rig, const IK_QSkeleton& skeleton, IK_QPose& pose,
+                         int num_dirty, UpdateMode mode, double& num_updated)
+{
+	const int runs = 100000;
+	const int num = skeleton.NumSegments();
+	std::vector<char> dirty(num);
+	Affine3d global = Affine3d::Identity();
+	IK_QSegment *root = (IK_QSegment *)rig.root;
+	unsigned int seed = 1;
+	double time = 0.0;
+	long updated = 0;
+	int run, i, j;
+
+	// all segments start up to date
+	skeleton.ReadPose(pose);
+	skeleton.UpdateTransforms(pose, global, true);
+
+	for (run = 0; run < runs; run++) {
+		std::fill(dirty.begin(), dirty.end(), 0);
+
+		for (i = 0; i < num_dirty; i++) {
+			int index = ((IK_QSegment *)rig.segments[(int)(BenchRandom(seed) * num) % num])->Index();
+
+			pose.dirty[index] = 1;
+			dirty[index] = 1;
+		}
+
+		// a segment is recomputed when it or any of its parents changed
+		for (i = 0; i < num; i++) {
+			for (j = i; j != -1 && !dirty[j]; j = skeleton.Parent(j)) ;
+
+			if (j != -1)
+				updated++;
+		}
+
+		double start = BenchTime();
+		if (mode == UPDATE_TREE)
+			root->UpdateTransform(global);
+		else
+			skeleton.UpdateTransforms(pose, global, mode == UPDATE_ALL);
+		time += BenchTime() - start;
+	}
+
+	num_updated = (mode == UPDATE_DIRTY) ? (double)updated / runs : num;
+
+	return time / runs;
+}
+
+void BenchDirtyTransform()
+{
+	const int dirty[] = {1, 2, 4, 8, 16, 52};
+	std::list<IK_QTask *> tasks;
+	IK_QSkeleton skeleton;
+	IK_QPose pose;
+	BenchRig rig;
+	int d;
+
+	CreateBody(rig);
+
+	skeleton.Setup((IK_QSegment *)rig.root, tasks);
+	pose.Resize(skeleton);
+
+	printf("us per transform update of a %d segment body with a number of random\n", skeleton.NumSegments());
+	printf("segments changed, in one pass over the skeleton arrays updating only\n");
+	printf("those and their children or all, vs recursing over the segment tree\n\n");
+	printf("%7s %8s %8s %8s %8s %7s %7s\n", "changed", "updated", "dirty", "all", "tree",
+	       "dirty", "all");
+
+	for (d = 0; d < 6; d++) {
+		double num_updated, num_all;
+
+		double dirty_time = TimeUpdate(rig, skeleton, pose, dirty[d], UPDATE_DIRTY, num_updated);
+		double all_time = TimeUpdate(rig, skeleton, pose, dirty[d], UPDATE_ALL, num_all);
+		double tree_time = TimeUpdate(rig, skeleton, pose, dirty[d], UPDATE_TREE, num_all);
+
+		printf("%7d %8.1f %8.3f %8.3f %8.3f %6.2fx %6.2fx\n", dirty[d], num_updated,
+		       dirty_time, all_time, tree_time, tree_time / dirty_time, tree_time / all_time);
+	}
+
+	BenchFreeRig(rig);
+}
@@ -138,6 +138,33 @@ extern void IK_SetStiffness(IK_Segment *seg, IK_SegmentAxis axis, float stiffnes
 extern void IK_GetBasisChange(IK_Segment *seg, float basis_change[][3]);
 extern void IK_GetTranslationChange(IK_Segment *seg, float *translation_change);
 
+/**
+ * Bulk versions of IK_SetTransform and IK_GetBasisChange/
+ * IK_GetTranslationChange, to sync a whole rig with one call per frame.
+ * Transforms are packed back to back in one of these layouts:
+ *
+ * - IK_LAYOUT_MATRIX3X4: 12 floats, a row major 3x4 matrix with the
+ *   rotation in the first three columns and the translation in the last,
+ *   as e.g. Urho3D's Matrix3x4.
+ * - IK_LAYOUT_QUATERNION: 7 floats, a w, x, y, z rotation quaternion
+ *   followed by the x, y, z translation, as e.g. Urho3D's Quaternion and
+ *   Vector3.
+ *
+ * IK_SetTransforms takes per segment the rest transform, its rotation is
+ * rest_basis and its translation start, the current transform of which
+ * only the rotation (basis) is used, and the length. IK_GetPoseChanges
+ * writes the basis change and translation change of each segment.
+ */
+
+typedef enum IK_TransformLayout {
+	IK_LAYOUT_MATRIX3X4 = 0,
+	IK_LAYOUT_QUATERNION = 1
+} IK_TransformLayout;
+
+extern void IK_SetTransforms(IK_Segment **segs, int count, IK_TransformLayout layout,
+                             const float *rest, const float *basis, const float *lengths);
+extern void IK_GetPoseChanges(IK_Segment **segs, int count, IK_TransformLayout layout, float *changes);
+
 /**
  * An IK_Solver must be created to be able to execute the solver.
  * 
@@ -148,21 +175,260 @@ extern void IK_GetTranslationChange(IK_Segment *seg, float *translation_change);
  * 
  * IK_Solve will execute the solver, that will run until either the
  * system converges, or a maximum number of iterations is reached.
- * It returns 1 if the system converged, 0 otherwise.
+ * It returns 1 if the system converged, 0 otherwise. The system has
+ * converged when every goal is within tolerance, in world units for
+ * position goals and radians for orientation goals. The solver also
+ * stops early when the distance to the goals no longer decreases,
+ * IK_SolverSetConvergence controls the minimum number of iterations
+ * and how many iterations without progress are allowed.
+ *
+ * A solver can be kept alive and solved again, e.g. once per frame.
+ * The segment tree and task layout are compiled on the first IK_Solve,
+ * later calls only run the iterations. Goals and weights of existing
+ * tasks can be changed in between through the IK_Task handles returned
+ * when adding goals. Adding goals recompiles the solver automatically,
+ * changing the tree structure (IK_SetParent, creating or freeing
+ * segments) or the stiffness of segments requires a call to
+ * IK_SolverInvalidate before the next IK_Solve.
  */ 
 
 typedef void IK_Solver;
+typedef void IK_Task;
 
 IK_Solver *IK_CreateSolver(IK_Segment *root);
 void IK_FreeSolver(IK_Solver *solver);
+void IK_SolverInvalidate(IK_Solver *solver);
 
-void IK_SolverAddGoal(IK_Solver *solver, IK_Segment *tip, float goal[3], float weight);
-void IK_SolverAddGoalOrientation(IK_Solver *solver, IK_Segment *tip, float goal[][3], float weight);
+IK_Task *IK_SolverAddGoal(IK_Solver *solver, IK_Segment *tip, float goal[3], float weight);
+IK_Task *IK_SolverAddGoalOrientation(IK_Solver *solver, IK_Segment *tip, float goal[][3], float weight);
+void IK_SolverSetGoal(IK_Solver *solver, IK_Task *task, float goal[3]);
+void IK_SolverSetGoalOrientation(IK_Solver *solver, IK_Task *task, float goal[][3]);
+void IK_SolverSetGoalWeight(IK_Solver *solver, IK_Task *task, float weight);
 void IK_SolverSetPoleVectorConstraint(IK_Solver *solver, IK_Segment *tip, float goal[3], float polegoal[3], float poleangle, int getangle);
 float IK_SolverGetPoleAngle(IK_Solver *solver);
 
+void IK_SolverSetConvergence(IK_Solver *solver, int min_iterations, int stall_iterations, float stall_ratio);
+int IK_SolverGetIterations(IK_Solver *solver);
+
+/**
+ * With warm start enabled the solver remembers the last converged solution
+ * and starts the next IK_Solve from it, instead of from the basis set with
+ * IK_SetTransform. When no goal moved more than goal_epsilon since that
+ * solution, IK_Solve restores it without iterating at all. The number of
+ * solves skipped this way (hits) and actually run (misses) since enabling
+ * can be queried for tuning.
+ */
+void IK_SolverSetWarmStart(IK_Solver *solver, int enable, float goal_epsilon);
+void IK_SolverGetWarmStartStats(IK_Solver *solver, int *hits, int *misses);
+
+/**
+ * Method used to invert the jacobian each iteration. SDLS (the default)
+ * damps each singular value separately and gives the smoothest results.
+ * DLS uses a single damping term for the whole system. DLS_CHOLESKY
+ * solves the same damped system through a cholesky factorization of the
+ * normal equations instead of an SVD, which is considerably cheaper for
+ * long chains, at the cost of an estimated rather than exact damping
+ * term. LM (Levenberg-Marquardt) uses DLS with a damping term adapted to
+ * whether each step reduced the distance to the goals, and undoes steps
+ * that didn't, which usually needs fewer iterations. It relies on the
+ * jacobian predicting that distance, so on big jumps of the goals, where
+ * the derivatives of swing segments (IK_XDOF | IK_ZDOF) are least exact,
+ * it gives up more often than DLS. TRANSPOSE steps
+ * along the transpose of the jacobian, without inverting anything. Each
+ * iteration is very cheap but many more are needed, and secondary goals
+ * are ignored, so it suits approximate solves e.g. for distant
+ * characters with a low max_iterations.
+ */
+typedef enum IK_InvertMode {
+	IK_INVERT_SDLS = 0,
+	IK_INVERT_DLS = 1,
+	IK_INVERT_DLS_CHOLESKY = 2,
+	IK_INVERT_LM = 3,
+	IK_INVERT_TRANSPOSE = 4
+} IK_InvertMode;
+
+void IK_SolverSetInvertMode(IK_Solver *solver, IK_InvertMode mode);
+
+/**
+ * Precision of the jacobian and its decomposition. Segments, goals and
+ * the rest of the solve always use double precision. Single precision
+ * makes each inversion with an SVD, for SDLS, DLS and LM, about 1.1 to
+ * 1.4 times faster, and a solve somewhat less than that (see the
+ * precision benchmark). DLS_CHOLESKY and TRANSPOSE get no faster. It
+ * can't get as close to the goals, so use it with tolerances well above
+ * 1e-5 times the size of the rig. Takes effect on the next solve.
+ */
+typedef enum IK_Precision {
+	IK_PRECISION_DOUBLE = 0,
+	IK_PRECISION_FLOAT = 1
+} IK_Precision;
+
+void IK_SolverSetPrecision(IK_Solver *solver, IK_Precision precision);
+
+/**
+ * Algorithm used by IK_Solve. The jacobian solver (the default) handles
+ * any combination of goals. FABRIK (forward and backward reaching IK)
+ * only moves joint positions along the chains and then aims the segments
+ * at them, which is much cheaper per iteration and typically converges in
+ * a few iterations for limbs. CCD (cyclic coordinate descent) rotates one
+ * segment at a time from the tip to the root towards the goals, with a
+ * cost per iteration linear in the number of segments, for long chains
+ * such as tails. Both only support position goals, and ignore the pole
+ * vector constraint. Solvers with orientation goals keep using the
+ * jacobian solver.
+ */
+typedef enum IK_SolverType {
+	IK_SOLVER_JACOBIAN = 0,
+	IK_SOLVER_FABRIK = 1,
+	IK_SOLVER_CCD = 2
+} IK_SolverType;
+
+void IK_SetSolverType(IK_Solver *solver, IK_SolverType type);
+
 int IK_Solve(IK_Solver *solver, float tolerance, int max_iterations);
 
+/**
+ * Solve with a time budget in microseconds instead of an iteration count,
+ * for hard bounds on the cost of a frame. The budget includes setting up
+ * the solve, such as restoring the warm start pose, but not setting up
+ * the solver again after the rig or goals were changed. The clock is
+ * checked between iterations, so the budget can be exceeded by up to one
+ * iteration. When the budget runs out the jacobian solver goes back to the
+ * pose closest to the goals it found, and IK_SolverGetDeadlineHit returns
+ * 1 until the next solve. Convergence and stalling end the solve early as
+ * usual, a stalled solve also ends on the closest pose.
+ */
+int IK_SolveWithDeadline(IK_Solver *solver, float tolerance, int budget_us);
+int IK_SolverGetDeadlineHit(IK_Solver *solver);
+
+/**
+ * Solve a number of solvers, e.g. the same rig for a crowd of characters,
+ * with the same tolerance and max_iterations. Returns the number of
+ * solvers that converged, IK_SolverGetIterations and the other queries
+ * work per solver as after IK_Solve, and the results are the same as
+ * those of IK_Solve. Jacobian solvers whose segment trees have the same
+ * shape are solved in lockstep a few at a time, one iteration of each in
+ * turn, with the transforms of all of them updated together. The others
+ * are solved one after the other. NULL entries are skipped, the solvers
+ * must not share segments, and each solver may only be passed once.
+ */
+int IK_SolveBatch(IK_Solver **solvers, int count, float tolerance, int max_iterations);
+
+/**
+ * Solvers that share no segments can be solved in parallel on a thread
+ * pool. The pool keeps its threads between calls, and IK_SolveParallel
+ * spreads the solvers over them, with idle threads taking solvers queued
+ * for busy ones, and the calling thread taking part. num_threads of 0
+ * uses one thread per core, with pin_threads set each worker thread is
+ * bound to a core (on Linux only), and the calling thread too while it
+ * takes part, after which it gets its own affinity back.
+ *
+ * IK_SolveParallel returns the same as IK_SolveBatch, which it falls
+ * back to for a NULL pool. Solvers created in the same rig can be solved
+ * in one call as long as they don't share segments, and no other calls
+ * may be made on the solvers and their segments until it returns.
+ */
+
+typedef void IK_ThreadPool;
+
+IK_ThreadPool *IK_CreateThreadPool(int num_threads, int pin_threads);
+void IK_FreeThreadPool(IK_ThreadPool *pool);
+int IK_ThreadPoolGetNumThreads(IK_ThreadPool *pool);
+
+int IK_SolveParallel(IK_ThreadPool *pool, IK_Solver **solvers, int count, float tolerance, int max_iterations);
+
+/**
+ * A solve can also be split up over several calls, e.g. to run a couple
+ * of iterations per character each frame for crowds and let it converge
+ * over time. IK_SolveBegin starts the solve, IK_SolveStep runs up to the
+ * given number of iterations and returns 1 once the solve converged or
+ * stalled, IK_SolveEnd finishes it and returns 1 if it converged. Until
+ * IK_SolveEnd the goals and solver settings must not change, and the
+ * pose read back from the segments doesn't include the pole vector
+ * rotation yet, and has translations in the scale the solver works in.
+ * IK_Solve, IK_SolveBegin, IK_SolverInvalidate and IK_FreeSolver end a
+ * solve still in progress. IK_SolverGetIterations counts all iterations
+ * since IK_SolveBegin for the jacobian solver, FABRIK and CCD count only
+ * those of the last step.
+ */
+void IK_SolveBegin(IK_Solver *solver, float tolerance);
+int IK_SolveStep(IK_Solver *solver, int iterations);
+int IK_SolveEnd(IK_Solver *solver);
+
+/**
+ * An IK_Rig holds the segments, solver, goals and solver matrices of one
+ * character in a single cache line aligned block of memory, instead of
+ * allocating each of them separately. This keeps the data the solver
+ * iterates over together, and makes spawning and removing characters
+ * cheap. The block is sized for max_segments segments, one solver and
+ * max_goals goals, anything beyond that still works but is allocated
+ * separately. Memory freed in the block is reused, so the solver matrices
+ * set up again after adding goals, IK_SolverInvalidate or changing the
+ * solver type stay in the block.
+ *
+ * Segments created with IK_RigCreateSegment and solvers created with
+ * IK_RigCreateSolver are used like any other, except that the segments
+ * must not be freed with IK_FreeSegment. IK_FreeSolver may still be
+ * called on rig solvers, IK_FreeRig frees everything that is left at
+ * once. A NULL rig creates regular segments and solvers.
+ */
+
+typedef void IK_Rig;
+
+IK_Rig *IK_CreateRig(int max_segments, int max_goals);
+void IK_FreeRig(IK_Rig *rig);
+
+IK_Segment *IK_RigCreateSegment(IK_Rig *rig, int flag);
+IK_Solver *IK_RigCreateSolver(IK_Rig *rig, IK_Segment *root);
+
+/**
+ * Instances solve the same solver for many characters without copying
+ * its segments, goals and settings for each of them. The solver and its
+ * segments serve as a read-only definition, an instance only stores the
+ * rotation of each segment and the goals, about 44 bytes per segment, 8
+ * per segment it poses and 36 per goal. Instances start out with the pose
+ * and goals the definition has at IK_CreateInstance.
+ *
+ * The count segments passed to IK_CreateInstance are the ones whose pose
+ * is set and read back, their order is the order of the transforms in the
+ * arrays of IK_InstanceSetPose and IK_InstanceGetPoseChanges, which use
+ * the layout given and hold count transforms. IK_InstanceSetPose sets the
+ * rotation of these segments (the rest, start and length of the definition
+ * are used). Goals are set by their index, the order in which they were
+ * added to the solver with IK_SolverAddGoal and IK_SolverAddGoalOrientation,
+ * IK_InstanceSetGoal only sets position goals and
+ * IK_InstanceSetGoalOrientation only orientation goals.
+ *
+ * IK_SolveInstances solves each instance with a solver and pose that are
+ * kept per thread of the pool, set up on the definition, so instances of
+ * the same definition can be solved in parallel. The definition is only
+ * read while solving. It returns the number of instances that converged.
+ * Rotation and translation changes are read back with
+ * IK_InstanceGetPoseChanges, relative to the pose set on the instance.
+ * The solve doesn't start from the previous result like IK_Solve with
+ * warm start enabled does.
+ *
+ * Changes to the transform, limits or stiffness of segments of the
+ * definition apply to the next solve. After changing the tree, which
+ * needs IK_SolverInvalidate, or adding goals, instances made before are
+ * not solved anymore and must be recreated. IK_CreateInstance returns NULL
+ * for a definition that can't be solved. Instances must be freed before
+ * their solver, and no other calls may be made on the definition during
+ * IK_SolveInstances.
+ */
+
+typedef void IK_Instance;
+
+IK_Instance *IK_CreateInstance(IK_Solver *solver, IK_Segment **segs, int count);
+void IK_FreeInstance(IK_Instance *instance);
+
+void IK_InstanceSetPose(IK_Instance *instance, IK_TransformLayout layout, const float *basis);
+void IK_InstanceSetGoal(IK_Instance *instance, int goal, float position[3]);
+void IK_InstanceSetGoalOrientation(IK_Instance *instance, int goal, float orientation[][3]);
+void IK_InstanceGetPoseChanges(IK_Instance *instance, IK_TransformLayout layout, float *changes);
+
+int IK_SolveInstances(IK_ThreadPool *pool, IK_Instance **instances, int count, float tolerance, int max_iterations);
+
 #define IK_STRETCH_STIFF_EPS 0.01f
 #define IK_STRETCH_STIFF_MIN 0.001f
 #define IK_STRETCH_STIFF_MAX 1e10
@@ -201,7 +201,7 @@ static inline Eigen::Vector3d MatrixToAxisAngle(const Eigen::Matrix3d& R)
 	return delta;
 }
 
-static inline bool EllipseClamp(double& ax, double& az, double *amin, double *amax)
+static inline bool EllipseClamp(double& ax, double& az, const double *amin, const double *amax)
 {
 	double xlim, zlim, x, z;
 
@@ -0,0 +1,143 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/intern/IK_QArena.cpp
+ *  \ingroup iksolver
+ */
+
+
+#include "IK_QArena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+// allocate with malloc and align by hand, aligned allocation functions
+// differ between platforms
+static char *AlignPointer(char *ptr)
+{
+	uintptr_t address = (uintptr_t)ptr;
+	address = (address + IK_QArena::ALIGNMENT - 1) & ~(uintptr_t)(IK_QArena::ALIGNMENT - 1);
+	return (char *)address;
+}
+
+IK_QArena::IK_QArena(size_t size)
+	: m_memory(NULL), m_block(NULL), m_size(AlignedSize(size)), m_used(0), m_free(NULL)
+{
+	if (m_size > 0) {
+		m_memory = (char *)malloc(m_size + ALIGNMENT - 1);
+
+		if (m_memory) {
+			m_block = AlignPointer(m_memory);
+			m_sizes.resize(m_size / ALIGNMENT, 0);
+		}
+		else
+			m_size = 0;
+	}
+}
+
+IK_QArena::~IK_QArena()
+{
+	std::vector<void *>::iterator ptr;
+
+	for (ptr = m_overflow.begin(); ptr != m_overflow.end(); ptr++)
+		free(*ptr);
+
+	free(m_memory);
+}
+
+void *IK_QArena::Allocate(size_t size)
+{
+	size = AlignedSize(std::max(size, (size_t)1));
+
+	// reuse the smallest freed allocation it fits in, which keeps its size
+	void **best = NULL;
+	void **link;
+
+	for (link = &m_free; *link; link = (void **)*link) {
+		size_t free_size = m_sizes[((char *)*link - m_block) / ALIGNMENT];
+
+		if (free_size >= size && (best == NULL || free_size < m_sizes[((char *)*best - m_block) / ALIGNMENT]))
+			best = link;
+	}
+
+	if (best) {
+		void *ptr = *best;
+		*best = *(void **)ptr;
+		return ptr;
+	}
+
+	if (m_used + size <= m_size) {
+		void *ptr = m_block + m_used;
+		m_sizes[m_used / ALIGNMENT] = size;
+		m_used += size;
+		return ptr;
+	}
+
+	// block is full, over allocate to align the pointer within it
+	char *memory = (char *)malloc(size + ALIGNMENT);
+
+	if (memory == NULL)
+		throw std::bad_alloc();
+
+	m_overflow.push_back(memory);
+
+	return AlignPointer(memory + 1);
+}
+
+void IK_QArena::Free(void *ptr)
+{
+	char *cptr = (char *)ptr;
+
+	if (cptr >= m_block && cptr < m_block + m_size) {
+		size_t offset = cptr - m_block;
+
+		// the last allocation is given back to the block, others are kept
+		// for reuse
+		if (offset + m_sizes[offset / ALIGNMENT] == m_used) {
+			m_used = offset;
+		}
+		else {
+			*(void **)ptr = m_free;
+			m_free = ptr;
+		}
+
+		return;
+	}
+
+	std::vector<void *>::iterator it;
+
+	for (it = m_overflow.begin(); it != m_overflow.end(); it++) {
+		if (AlignPointer((char *)*it + 1) == cptr) {
+			free(*it);
+			m_overflow.erase(it);
+			return;
+		}
+	}
+}
+
@@ -0,0 +1,113 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/intern/IK_QArena.h
+ *  \ingroup iksolver
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * Bump allocator that puts the segments, tasks and jacobians of one rig in
+ * a single cache line aligned block, so a character is spawned with one
+ * allocation and the data the solver iterates over is close together.
+ * Memory freed in the block is kept in a free list and reused for later
+ * allocations that fit, so recompiling a solver puts its new jacobians
+ * where the old ones were. Once the block is full further allocations
+ * fall back to the heap, those are freed right away by Free, or with the
+ * arena.
+ */
+
+class IK_QArena
+{
+public:
+	enum { ALIGNMENT = 64 };
+
+	IK_QArena(size_t size);
+	~IK_QArena();
+
+	void *Allocate(size_t size);
+	void Free(void *ptr);
+
+	// size taken from the block by an allocation of the given size
+	static size_t AlignedSize(size_t size)
+	{ return (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1); }
+
+	size_t Size() const { return m_size; }
+	size_t Used() const { return m_used; }
+
+private:
+	IK_QArena(const IK_QArena&);
+	IK_QArena& operator=(const IK_QArena&);
+
+	char *m_memory;
+	char *m_block;
+	size_t m_size;
+	size_t m_used;
+	std::vector<void *> m_overflow;
+
+	// size of the allocation starting at each aligned offset in the block,
+	// and the first freed allocation, each of which stores the next one
+	std::vector<size_t> m_sizes;
+	void *m_free;
+};
+
+// new and delete that go through the arena if there is one, and the heap
+// otherwise. objects are constructed with placement new, so the aligned
+// operator new of eigen types is bypassed, the arena aligns them already
+
+template <typename T, typename... Args>
+T *IK_QArenaNew(IK_QArena *arena, Args&&... args)
+{
+	if (arena == NULL)
+		return new T(std::forward<Args>(args)...);
+
+	void *ptr = arena->Allocate(sizeof(T));
+	return ::new (ptr) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void IK_QArenaDelete(IK_QArena *arena, T *obj)
+{
+	if (obj == NULL)
+		return;
+
+	if (arena == NULL) {
+		delete obj;
+		return;
+	}
+
+	obj->~T();
+	arena->Free(obj);
+}
+
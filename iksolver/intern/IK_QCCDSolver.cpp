@@ -0,0 +1,234 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/intern/IK_QCCDSolver.cpp
+ *  \ingroup iksolver
+ */
+
+
+#include "IK_QCCDSolver.h"
+
+IK_QCCDSolver::IK_QCCDSolver()
+{
+	m_skeleton = NULL;
+	m_min_iterations = 0;
+	m_stall_iterations = 5;
+	m_stall_ratio = 1e-5;
+	m_iterations = 0;
+	m_deadline_hit = false;
+}
+
+void IK_QCCDSolver::SetConvergence(int min_iterations, int stall_iterations, double stall_ratio)
+{
+	m_min_iterations = (min_iterations > 0) ? min_iterations : 0;
+	m_stall_iterations = (stall_iterations > 1) ? stall_iterations : 1;
+	m_stall_ratio = Clamp(stall_ratio, 0.0, 1.0);
+}
+
+void IK_QCCDSolver::CopySettings(const IK_QCCDSolver& other)
+{
+	m_min_iterations = other.m_min_iterations;
+	m_stall_iterations = other.m_stall_iterations;
+	m_stall_ratio = other.m_stall_ratio;
+}
+
+void IK_QCCDSolver::AddNodes(IK_QSegment *seg)
+{
+	// segments no goal depends on stay as they are
+	Node node;
+	size_t i;
+
+	node.segment = seg;
+	node.first_task = m_node_tasks.size();
+
+	for (i = 0; i < m_tasks.size(); i++)
+		if (m_tasks[i]->DependsOn(seg))
+			m_node_tasks.push_back(i);
+
+	node.num_tasks = m_node_tasks.size() - node.first_task;
+
+	if (node.num_tasks == 0)
+		return;
+
+	m_nodes.push_back(node);
+
+	IK_QSegment *child;
+	for (child = seg->Child(); child; child = child->Sibling())
+		AddNodes(child);
+}
+
+bool IK_QCCDSolver::Setup(const IK_QSkeleton& skeleton)
+{
+	m_skeleton = &skeleton;
+	m_nodes.clear();
+	m_node_tasks.clear();
+	m_tasks.clear();
+
+	// need at least one goal, and only position goals
+	std::vector<IK_QTask *>::const_iterator task;
+
+	for (task = skeleton.Tasks().begin(); task != skeleton.Tasks().end(); task++) {
+		if (!(*task)->Primary())
+			continue;
+		if (!(*task)->PositionTask())
+			return false;
+
+		m_tasks.push_back((IK_QPositionTask *)(*task));
+	}
+
+	if (m_tasks.empty())
+		return false;
+
+	AddNodes(skeleton.Segments()[0]);
+
+	if (m_nodes.empty())
+		return false;
+
+	m_effector.resize(m_tasks.size());
+
+	return true;
+}
+
+void IK_QCCDSolver::Iterate(IK_QPose& pose)
+{
+	Affine3d identity = Affine3d::Identity();
+	IK_QSegment *root = m_skeleton->Segments()[0];
+	int i, j;
+	size_t t;
+
+	for (t = 0; t < m_tasks.size(); t++)
+		m_effector[t] = m_tasks[t]->Segment()->GlobalEnd(pose);
+
+	// from the tips to the root, the transforms of a segment and its parents
+	// are still up to date when getting to it. the end effectors after the
+	// segment move along with it, the rest of the tree is only updated at
+	// the end of the iteration
+	for (i = m_nodes.size() - 1; i >= 0; i--) {
+		const Node& node = m_nodes[i];
+		IK_QSegment *seg = node.segment;
+
+		if (seg->NumberOfDoF() == 0)
+			continue;
+
+		Vector3d start = seg->GlobalStart(pose);
+		Vector3d from(0, 0, 0), to(0, 0, 0);
+
+		for (j = node.first_task; j < node.first_task + node.num_tasks; j++) {
+			from += m_effector[m_node_tasks[j]] - start;
+			to += m_tasks[m_node_tasks[j]]->Goal(pose) - start;
+		}
+
+		Affine3d old_transform = seg->GlobalTransform(pose);
+		Vector3d dq = seg->ReachUpdate(pose, from, to), delta;
+		bool clamp[3];
+
+		// clamping to the limits changes the rotation, so the end effectors
+		// are moved by what was actually applied
+		seg->UpdateAngle(pose, dq, delta, clamp);
+		seg->UpdateAngleApply(pose);
+		pose.UpdateSegmentTransform(seg->Index(), (seg == root) ? identity : seg->Parent()->GlobalTransform(pose));
+
+		Affine3d change = seg->GlobalTransform(pose) * old_transform.inverse(Eigen::Isometry);
+
+		for (j = node.first_task; j < node.first_task + node.num_tasks; j++)
+			m_effector[m_node_tasks[j]] = change * m_effector[m_node_tasks[j]];
+	}
+
+	m_skeleton->UpdateTransforms(pose, identity, true);
+}
+
+double IK_QCCDSolver::ComputeResidual(const IK_QPose& pose)
+{
+	double residual = 0.0;
+	size_t i;
+
+	for (i = 0; i < m_tasks.size(); i++) {
+		double distance = m_tasks[i]->Distance(pose);
+		if (distance > residual)
+			residual = distance;
+	}
+
+	return residual;
+}
+
+bool IK_QCCDSolver::Solve(
+    IK_QPose& pose,
+    const double tolerance,
+    const int max_iterations,
+    const double time_budget
+    )
+{
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::time_point deadline = Clock::now() +
+		std::chrono::microseconds((long long)time_budget);
+
+	bool solved = false;
+
+	m_deadline_hit = false;
+
+	m_skeleton->UpdateTransforms(pose, Affine3d::Identity(), true);
+
+	double best_residual = std::numeric_limits<double>::max();
+	int stalled = 0;
+
+	for (m_iterations = 0; m_iterations < max_iterations; m_iterations++) {
+		double residual = ComputeResidual(pose);
+
+		if (residual <= tolerance) {
+			solved = true;
+
+			if (m_iterations >= m_min_iterations)
+				break;
+		}
+		else
+			solved = false;
+
+		if (time_budget > 0.0 && Clock::now() >= deadline) {
+			m_deadline_hit = true;
+			break;
+		}
+
+		bool progress = (residual < best_residual * (1.0 - m_stall_ratio));
+		if (progress)
+			best_residual = residual;
+
+		Iterate(pose);
+
+		// stalled when the goals are out of reach or blocked by limits
+		if (progress)
+			stalled = 0;
+		else if (++stalled >= m_stall_iterations && m_iterations + 1 >= m_min_iterations) {
+			m_iterations++;
+			break;
+		}
+	}
+
+	return solved;
+}
+
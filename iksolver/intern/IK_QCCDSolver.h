@@ -0,0 +1,114 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/intern/IK_QCCDSolver.h
+ *  \ingroup iksolver
+ */
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include "IK_Math.h"
+#include "IK_QPose.h"
+#include "IK_QSegment.h"
+#include "IK_QTask.h"
+
+/**
+ * Cyclic coordinate descent. Each iteration goes over the segments from
+ * the tips to the root, and rotates every segment on its own so that the
+ * end effectors after it get as close as possible to their goals, in
+ * closed form. The rotations are clamped to the limits of the segment the
+ * same way as for the jacobian solver. The cost of an iteration is linear
+ * in the number of segments, which suits long chains such as tails.
+ *
+ * Only position goals are supported, and secondary tasks and the pole
+ * vector constraint are ignored.
+ */
+
+class IK_QCCDSolver
+{
+public:
+	IK_QCCDSolver();
+
+	// call setup once before solving, if it fails the tasks can't be
+	// solved with CCD. as with IK_QJacobianSolver the solver can be
+	// reused as long as the skeleton is not set up again
+	bool Setup(const IK_QSkeleton& skeleton);
+
+	// minimum number of iterations, and the number of iterations that the
+	// residual may fail to decrease by stall_ratio before giving up
+	void SetConvergence(int min_iterations, int stall_iterations, double stall_ratio);
+
+	// copy the settings of another solver
+	void CopySettings(const IK_QCCDSolver& other);
+
+	// number of iterations used by the last solve
+	int Iterations() const { return m_iterations; }
+
+	// the last solve ran out of its time budget
+	bool DeadlineHit() const { return m_deadline_hit; }
+
+	// returns true if all goals are within tolerance, false if the max
+	// number of iterations was used or the solver stalled. with a time
+	// budget in microseconds (0 for none) the solve also stops when it runs
+	// out, iterations are cheap enough to keep the pose reached by then
+	bool Solve(
+		IK_QPose& pose,
+		const double tolerance,
+		const int max_iterations,
+		const double time_budget
+	);
+
+private:
+	// a segment that goals depend on, with the range of those goals in
+	// m_node_tasks. nodes are sorted with parents before their children
+	struct Node {
+		IK_QSegment *segment;
+		int first_task, num_tasks;
+	};
+
+	void AddNodes(IK_QSegment *seg);
+	void Iterate(IK_QPose& pose);
+	double ComputeResidual(const IK_QPose& pose);
+
+	const IK_QSkeleton *m_skeleton;
+
+	std::vector<Node> m_nodes;
+	std::vector<int> m_node_tasks;
+	std::vector<IK_QPositionTask*> m_tasks;
+	std::vector<Vector3d> m_effector;
+
+	int m_min_iterations;
+	int m_stall_iterations;
+	double m_stall_ratio;
+	int m_iterations;
+	bool m_deadline_hit;
+};
+
@@ -0,0 +1,366 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/intern/IK_QFABRIKSolver.cpp
+ *  \ingroup iksolver
+ */
+
+
+#include "IK_QFABRIKSolver.h"
+
+IK_QFABRIKSolver::IK_QFABRIKSolver()
+{
+	m_skeleton = NULL;
+	m_min_iterations = 0;
+	m_stall_iterations = 5;
+	m_stall_ratio = 1e-5;
+	m_iterations = 0;
+	m_deadline_hit = false;
+}
+
+void IK_QFABRIKSolver::SetConvergence(int min_iterations, int stall_iterations, double stall_ratio)
+{
+	m_min_iterations = (min_iterations > 0) ? min_iterations : 0;
+	m_stall_iterations = (stall_iterations > 1) ? stall_iterations : 1;
+	m_stall_ratio = Clamp(stall_ratio, 0.0, 1.0);
+}
+
+void IK_QFABRIKSolver::CopySettings(const IK_QFABRIKSolver& other)
+{
+	m_min_iterations = other.m_min_iterations;
+	m_stall_iterations = other.m_stall_iterations;
+	m_stall_ratio = other.m_stall_ratio;
+}
+
+void IK_QFABRIKSolver::AddNodes(IK_QSegment *seg, int parent, const std::vector<IK_QTask *>& tasks)
+{
+	// segments no goal depends on stay as they are
+	std::vector<IK_QTask *>::const_iterator task;
+	bool used = false;
+
+	for (task = tasks.begin(); task != tasks.end(); task++)
+		if ((*task)->Primary() && (*task)->DependsOn(seg))
+			used = true;
+
+	if (!used)
+		return;
+
+	Node node;
+	node.segment = seg;
+	node.task = NULL;
+	node.parent = parent;
+	node.child = -1;
+	node.sibling = (parent == -1) ? -1 : m_nodes[parent].child;
+	node.length = 0.0;
+
+	int index = m_nodes.size();
+	m_nodes.push_back(node);
+
+	if (parent != -1)
+		m_nodes[parent].child = index;
+
+	// the ends of segments with a goal
+	for (task = tasks.begin(); task != tasks.end(); task++) {
+		if ((*task)->Primary() && (*task)->Segment() == seg) {
+			node.task = (IK_QPositionTask *)(*task);
+			node.parent = index;
+			node.sibling = m_nodes[index].child;
+
+			m_nodes[index].child = m_nodes.size();
+			m_nodes.push_back(node);
+		}
+	}
+
+	IK_QSegment *child;
+	for (child = seg->Child(); child; child = child->Sibling())
+		AddNodes(child, index, tasks);
+}
+
+bool IK_QFABRIKSolver::Setup(const IK_QSkeleton& skeleton)
+{
+	const std::vector<IK_QTask *>& tasks = skeleton.Tasks();
+
+	m_skeleton = &skeleton;
+	m_nodes.clear();
+
+	// need at least one goal, and only position goals
+	std::vector<IK_QTask *>::const_iterator task;
+	int primary = 0;
+
+	for (task = tasks.begin(); task != tasks.end(); task++) {
+		if (!(*task)->Primary())
+			continue;
+		if (!(*task)->PositionTask())
+			return false;
+
+		primary++;
+	}
+
+	if (primary == 0)
+		return false;
+
+	AddNodes(skeleton.Segments()[0], -1, tasks);
+
+	if (m_nodes.empty())
+		return false;
+
+	m_pos.resize(m_nodes.size());
+	m_target.resize(m_nodes.size());
+
+	return true;
+}
+
+void IK_QFABRIKSolver::UpdatePositions(const IK_QPose& pose)
+{
+	size_t i;
+
+	for (i = 0; i < m_nodes.size(); i++) {
+		if (m_nodes[i].task)
+			m_pos[i] = m_nodes[i].segment->GlobalEnd(pose);
+		else
+			m_pos[i] = m_nodes[i].segment->GlobalStart(pose);
+	}
+}
+
+void IK_QFABRIKSolver::Reach(const IK_QPose& pose)
+{
+	int i, j, num_nodes = m_nodes.size();
+
+	// backward, from the goals to the root. each joint moves towards its
+	// children, keeping the distance to them
+	for (i = num_nodes - 1; i >= 0; i--) {
+		const Node& node = m_nodes[i];
+
+		if (node.task) {
+			m_target[i] = node.task->Goal(pose);
+			continue;
+		}
+
+		Vector3d sum(0, 0, 0);
+		int num = 0;
+
+		for (j = node.child; j != -1; j = m_nodes[j].sibling) {
+			Vector3d dir = normalize(m_pos[i] - m_target[j]);
+			sum += m_target[j] + dir * m_nodes[j].length;
+			num++;
+		}
+
+		m_target[i] = sum / num;
+	}
+
+	// forward, from the fixed root to the goals
+	m_target[0] = m_pos[0];
+
+	for (i = 1; i < num_nodes; i++) {
+		int parent = m_nodes[i].parent;
+		Vector3d dir = normalize(m_target[i] - m_target[parent]);
+
+		m_target[i] = m_target[parent] + dir * m_nodes[i].length;
+	}
+}
+
+Vector3d IK_QFABRIKSolver::NodePosition(const IK_QPose& pose, int parent, int node)
+{
+	// current position of a node, relative to the transform of the
+	// segment of its parent node
+	IK_QSegment *seg = m_nodes[parent].segment;
+
+	if (m_nodes[node].task)
+		return seg->GlobalEnd(pose);
+	else
+		return seg->GlobalTransform(pose) * pose.start[m_nodes[node].segment->Index()];
+}
+
+void IK_QFABRIKSolver::Aim(IK_QPose& pose, IK_QSegment *seg, const Affine3d& global, const Vector3d& dq)
+{
+	Vector3d delta;
+	bool clamp[3];
+
+	seg->UpdateAngle(pose, dq, delta, clamp);
+	seg->UpdateAngleApply(pose);
+	pose.UpdateSegmentTransform(seg->Index(), global);
+}
+
+void IK_QFABRIKSolver::UpdateAngles(IK_QPose& pose)
+{
+	// rotate the segments from the root down, so that their children point
+	// to the new positions, and clamp them to their limits. since the
+	// limits may not allow reaching the targets exactly, the next iteration
+	// starts from the positions that were actually reached
+	Affine3d identity = Affine3d::Identity();
+	IK_QSegment *root = m_skeleton->Segments()[0];
+	int i, j, k, num_nodes = m_nodes.size();
+
+	for (i = 0; i < num_nodes; i++) {
+		const Node& node = m_nodes[i];
+		IK_QSegment *seg = node.segment;
+
+		if (node.task)
+			continue;
+
+		const Affine3d& global = (seg == root) ? identity : seg->Parent()->GlobalTransform(pose);
+
+		pose.UpdateSegmentTransform(seg->Index(), global);
+
+		if (seg->NumberOfDoF() == 0)
+			continue;
+
+		Vector3d start = seg->GlobalStart(pose);
+		Vector3d from(0, 0, 0), to(0, 0, 0);
+
+		for (j = node.child; j != -1; j = m_nodes[j].sibling) {
+			from += NodePosition(pose, i, j) - start;
+			to += m_target[j] - start;
+		}
+
+		Aim(pose, seg, global, seg->ReachUpdate(pose, from, to));
+
+		if (seg->Translational() || seg->NumberOfDoF() == 1)
+			continue;
+
+		// the aimed direction leaves the twist around it free, use it to
+		// rotate the nodes after the children towards their targets. this
+		// e.g. turns the plane of a knee hinge towards the foot goal
+		Vector3d axis(0, 0, 0);
+		double sine = 0.0, cosine = 0.0;
+
+		for (j = node.child; j != -1; j = m_nodes[j].sibling)
+			axis += NodePosition(pose, i, j) - start;
+
+		axis = normalize(axis);
+
+		// swing segments can't twist
+		if (seg->RotationUpdate(pose, axis).squaredNorm() < 1e-10)
+			continue;
+
+		for (j = node.child; j != -1; j = m_nodes[j].sibling) {
+			if (m_nodes[j].task)
+				continue;
+
+			pose.UpdateSegmentTransform(m_nodes[j].segment->Index(), seg->GlobalTransform(pose));
+
+			for (k = m_nodes[j].child; k != -1; k = m_nodes[k].sibling) {
+				Vector3d f = NodePosition(pose, j, k) - start;
+				Vector3d t = m_target[k] - start;
+
+				sine += axis.dot(f.cross(t));
+				cosine += f.dot(t) - axis.dot(f) * axis.dot(t);
+			}
+		}
+
+		if (!FuzzyZero(sine))
+			Aim(pose, seg, global, seg->RotationUpdate(pose, axis * atan2(sine, cosine)));
+	}
+}
+
+double IK_QFABRIKSolver::ComputeResidual(const IK_QPose& pose)
+{
+	double residual = 0.0;
+	size_t i;
+
+	for (i = 0; i < m_nodes.size(); i++) {
+		if (!m_nodes[i].task)
+			continue;
+
+		double distance = m_nodes[i].task->Distance(pose);
+		if (distance > residual)
+			residual = distance;
+	}
+
+	return residual;
+}
+
+bool IK_QFABRIKSolver::Solve(
+    IK_QPose& pose,
+    const double tolerance,
+    const int max_iterations,
+    const double time_budget
+    )
+{
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::time_point deadline = Clock::now() +
+		std::chrono::microseconds((long long)time_budget);
+
+	Affine3d identity = Affine3d::Identity();
+	bool solved = false;
+	size_t i;
+
+	m_deadline_hit = false;
+
+	m_skeleton->UpdateTransforms(pose, identity, true);
+
+	// distances between the joints, these don't change while solving
+	UpdatePositions(pose);
+
+	for (i = 1; i < m_nodes.size(); i++)
+		m_nodes[i].length = (m_pos[i] - m_pos[m_nodes[i].parent]).norm();
+
+	double best_residual = std::numeric_limits<double>::max();
+	int stalled = 0;
+
+	for (m_iterations = 0; m_iterations < max_iterations; m_iterations++) {
+		double residual = ComputeResidual(pose);
+
+		if (residual <= tolerance) {
+			solved = true;
+
+			if (m_iterations >= m_min_iterations)
+				break;
+		}
+		else
+			solved = false;
+
+		if (time_budget > 0.0 && Clock::now() >= deadline) {
+			m_deadline_hit = true;
+			break;
+		}
+
+		bool progress = (residual < best_residual * (1.0 - m_stall_ratio));
+		if (progress)
+			best_residual = residual;
+
+		Reach(pose);
+		UpdateAngles(pose);
+		UpdatePositions(pose);
+
+		// stalled when the goals are out of reach or blocked by limits
+		if (progress)
+			stalled = 0;
+		else if (++stalled >= m_stall_iterations && m_iterations + 1 >= m_min_iterations) {
+			m_iterations++;
+			break;
+		}
+	}
+
+	// segments that no goal depends on still need their transform updated
+	m_skeleton->UpdateTransforms(pose, identity, true);
+
+	return solved;
+}
+
@@ -0,0 +1,121 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/intern/IK_QFABRIKSolver.h
+ *  \ingroup iksolver
+ */
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include "IK_Math.h"
+#include "IK_QPose.h"
+#include "IK_QSegment.h"
+#include "IK_QTask.h"
+
+/**
+ * Forward and backward reaching inverse kinematics. Each iteration first
+ * moves the joint positions from the end effectors towards the root, and
+ * then back from the fixed root, keeping the distances between joints.
+ * Where branches meet the joint is put at the average of the positions
+ * the branches ask for. The segments are then rotated to aim at the new
+ * joint positions, clamped to their limits, and twisted around the aimed
+ * direction to put the joints after that in place as well.
+ *
+ * Only position goals are supported, and secondary tasks and the pole
+ * vector constraint are ignored.
+ */
+
+class IK_QFABRIKSolver
+{
+public:
+	IK_QFABRIKSolver();
+
+	// call setup once before solving, if it fails the tasks can't be
+	// solved with FABRIK. as with IK_QJacobianSolver the solver can be
+	// reused as long as the skeleton is not set up again
+	bool Setup(const IK_QSkeleton& skeleton);
+
+	// minimum number of iterations, and the number of iterations that the
+	// residual may fail to decrease by stall_ratio before giving up
+	void SetConvergence(int min_iterations, int stall_iterations, double stall_ratio);
+
+	// copy the settings of another solver
+	void CopySettings(const IK_QFABRIKSolver& other);
+
+	// number of iterations used by the last solve
+	int Iterations() const { return m_iterations; }
+
+	// the last solve ran out of its time budget
+	bool DeadlineHit() const { return m_deadline_hit; }
+
+	// returns true if all goals are within tolerance, false if the max
+	// number of iterations was used or the solver stalled. with a time
+	// budget in microseconds (0 for none) the solve also stops when it runs
+	// out, iterations are cheap enough to keep the pose reached by then
+	bool Solve(
+		IK_QPose& pose,
+		const double tolerance,
+		const int max_iterations,
+		const double time_budget
+	);
+
+private:
+	// a joint position, the start of a segment or the end of a segment
+	// with a goal. nodes are sorted with parents before their children
+	struct Node {
+		IK_QSegment *segment;
+		IK_QPositionTask *task;
+		int parent, child, sibling;
+		// distance to the parent node
+		double length;
+	};
+
+	void AddNodes(IK_QSegment *seg, int parent, const std::vector<IK_QTask*>& tasks);
+	void UpdatePositions(const IK_QPose& pose);
+	void Reach(const IK_QPose& pose);
+	void UpdateAngles(IK_QPose& pose);
+	void Aim(IK_QPose& pose, IK_QSegment *seg, const Affine3d& global, const Vector3d& dq);
+	Vector3d NodePosition(const IK_QPose& pose, int parent, int node);
+	double ComputeResidual(const IK_QPose& pose);
+
+	const IK_QSkeleton *m_skeleton;
+
+	std::vector<Node> m_nodes;
+	std::vector<Vector3d> m_pos;
+	std::vector<Vector3d> m_target;
+
+	int m_min_iterations;
+	int m_stall_iterations;
+	double m_stall_ratio;
+	int m_iterations;
+	bool m_deadline_hit;
+};
+
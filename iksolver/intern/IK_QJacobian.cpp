@@ -33,115 +33,185 @@
 
 #include "IK_QJacobian.h"
 
-IK_QJacobian::IK_QJacobian()
-	: m_sdls(true), m_min_damp(1.0)
+#include <algorithm>
+
+template <typename Scalar, int TaskSize, int MaxDoF>
+IK_QJacobianT<Scalar, TaskSize, MaxDoF>::IK_QJacobianT()
+	: m_mode(INVERT_SDLS), m_damping(0.0), m_factorized(false), m_svd_locked(false), m_lambda(0.0), m_min_damp(1.0)
 {
 }
 
-IK_QJacobian::~IK_QJacobian()
+template <typename Scalar, int TaskSize, int MaxDoF>
+IK_QJacobianT<Scalar, TaskSize, MaxDoF>::~IK_QJacobianT()
 {
 }
 
-void IK_QJacobian::ArmMatrices(int dof, int task_size)
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::ArmMatrices(int dof, int task_size)
 {
 	m_dof = dof;
 	m_task_size = task_size;
 
 	m_jacobian.resize(task_size, dof);
 	m_jacobian.setZero();
+	m_jacobian_tmp.resize(task_size, dof);
 
 	m_alpha.resize(dof);
 	m_alpha.setZero();
 
-	m_nullspace.resize(dof, dof);
 
 	m_d_theta.resize(dof);
 	m_d_theta_tmp.resize(dof);
 	m_d_norm_weight.resize(dof);
+	m_d_theta.setZero();
+	m_d_norm_weight.setZero();
 
 	m_norm.resize(dof);
 	m_norm.setZero();
 
 	m_beta.resize(task_size);
+	m_beta_change.resize(task_size);
 
 	m_weight.resize(dof);
 	m_weight_sqrt.resize(dof);
 	m_weight.setOnes();
 	m_weight_sqrt.setOnes();
 
-	if (task_size >= dof) {
-		m_transpose = false;
-
-		m_jacobian_tmp.resize(task_size, dof);
-
-		m_svd_u.resize(task_size, dof);
-		m_svd_v.resize(dof, dof);
-		m_svd_w.resize(dof);
-
-		m_svd_u_beta.resize(dof);
-	}
-	else {
-		// use the SVD of the transpose jacobian, it works just as well
-		// as the original, and often allows using smaller matrices.
-		m_transpose = true;
-
-		m_jacobian_tmp.resize(dof, task_size);
+	int k = (task_size < dof) ? task_size : dof;
+
+	m_svd_u.resize(task_size, k);
+	m_svd_v.resize(dof, k);
+	m_svd_w.resize(k);
+
+	m_svd_u_beta.resize(k);
+	m_null_basis.resize(k, dof);
+	m_svd_u_tmp.resize(task_size, k);
+	m_svd_v_tmp.resize(dof, k);
+
+	m_normal.resize(k, k);
+	m_normal_x.resize(k);
+	m_normal_g.resize(k);
+	m_update.resize(k, k);
+	m_factorized = false;
+
+	// run the decompositions once on the zeroed matrices, so that dynamically
+	// sized ones allocate their workspace here rather than while solving
+	m_normal.setZero();
+	m_update.setZero();
+	m_svd.compute(m_jacobian, Eigen::ComputeThinU | Eigen::ComputeThinV);
+	m_update_svd.compute(m_update, Eigen::ComputeFullU);
+	m_ldlt.compute(m_normal);
+
+	// seed for the smallest eigenvector, kept across iterations since it
+	// changes little between them
+	m_normal_v.resize(k);
+	m_normal_v.setOnes();
+}
 
-		m_svd_u.resize(task_size, task_size);
-		m_svd_v.resize(dof, task_size);
-		m_svd_w.resize(task_size);
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::SetInvertMode(InvertMode mode)
+{
+	m_mode = mode;
+}
 
-		m_svd_u_beta.resize(task_size);
-	}
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::SetDamping(double lambda)
+{
+	m_damping = lambda;
 }
 
-void IK_QJacobian::SetBetas(int id, int, const Vector3d& v)
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::SetBetas(int id, int, const Vector3d& v)
 {
 	m_beta[id + 0] = v.x();
 	m_beta[id + 1] = v.y();
 	m_beta[id + 2] = v.z();
 }
 
-void IK_QJacobian::SetDerivatives(int id, int dof_id, const Vector3d& v, double norm_weight)
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::SetDerivatives(int id, int dof_id, const Vector3d& v, double norm_weight)
 {
 	m_jacobian(id + 0, dof_id) = v.x() * m_weight_sqrt[dof_id];
 	m_jacobian(id + 1, dof_id) = v.y() * m_weight_sqrt[dof_id];
 	m_jacobian(id + 2, dof_id) = v.z() * m_weight_sqrt[dof_id];
 
 	m_d_norm_weight[dof_id] = norm_weight;
+	m_factorized = false;
 }
 
-void IK_QJacobian::Invert()
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::Invert()
 {
-	if (m_transpose) {
-		// SVD will decompose Jt into V*W*Ut with U,V orthogonal and W diagonal,
-		// so J = U*W*Vt and Jinv = V*Winv*Ut
-		Eigen::JacobiSVD<MatrixXd> svd(m_jacobian.transpose(), Eigen::ComputeThinU | Eigen::ComputeThinV);
-		m_svd_u = svd.matrixV();
-		m_svd_w = svd.singularValues();
-		m_svd_v = svd.matrixU();
+	if (m_mode == INVERT_DLS_CHOLESKY) {
+		InvertDLSCholesky();
+		return;
 	}
-	else {
-		// SVD will decompose J into U*W*Vt with U,V orthogonal and W diagonal,
-		// so Jinv = V*Winv*Ut
-		Eigen::JacobiSVD<MatrixXd> svd(m_jacobian, Eigen::ComputeThinU | Eigen::ComputeThinV);
-		m_svd_u = svd.matrixU();
-		m_svd_w = svd.singularValues();
-		m_svd_v = svd.matrixV();
+	else if (m_mode == INVERT_TRANSPOSE) {
+		InvertTranspose();
+		return;
 	}
 
-	if (m_sdls)
+	if (!m_factorized) {
+		ComputeSVD();
+		m_factorized = true;
+	}
+	else if (m_svd_locked)
+		UpdateSVD();
+
+	if (m_mode == INVERT_SDLS)
 		InvertSDLS();
 	else
 		InvertDLS();
 }
 
-bool IK_QJacobian::ComputeNullProjection()
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::ComputeSVD()
 {
-	double epsilon = 1e-10;
-	
+	// SVD will decompose J into U*W*Vt with U,V orthogonal and W diagonal,
+	// so Jinv = V*Winv*Ut
+	m_svd.compute(m_jacobian, Eigen::ComputeThinU | Eigen::ComputeThinV);
+	m_svd_u = m_svd.matrixU();
+	m_svd_w = m_svd.singularValues();
+	m_svd_v = m_svd.matrixV();
+	m_svd_locked = false;
+}
+
+template <typename Scalar, int TaskSize, int MaxDoF>
+bool IK_QJacobianT<Scalar, TaskSize, MaxDoF>::ComputeNullProjection()
+{
+	Scalar epsilon = IK_QJacobianEpsilon<Scalar>::Zero();
+	int i, rank = 0;
+
+	// the projection onto the null space is I - At*B, which is never
+	// formed, Restrict applies it to the lower priority jacobian instead
+
+	// without a decomposition there is no projection, the transpose is
+	// meant for cheap approximate solves anyway
+	if (m_mode == INVERT_TRANSPOSE)
+		return false;
+
+	if (m_mode == INVERT_DLS_CHOLESKY) {
+		// without SVD, the projection is I - Jt*(J*Jt)^-1*J, so A = J and
+		// B = (J*Jt)^-1*J, which needs J*Jt to be of full rank
+		if (m_task_size > m_dof)
+			return false;
+
+		m_normal.noalias() = m_jacobian * m_jacobian.transpose();
+		m_ldlt.compute(m_normal);
+
+		for (i = 0; i < m_task_size; i++)
+			if (fabs(m_ldlt.vectorD()[i]) <= epsilon * epsilon)
+				return false;
+
+		m_jacobian_tmp = m_ldlt.solve(m_jacobian);
+
+		// the damped factorization was overwritten
+		m_factorized = false;
+
+		return true;
+	}
+
 	// compute null space projection based on V
-	int i, j, rank = 0;
 	for (i = 0; i < m_svd_w.size(); i++)
 		if (m_svd_w[i] > epsilon)
 			rank++;
@@ -149,35 +219,30 @@ bool IK_QJacobian::ComputeNullProjection()
 	if (rank < m_task_size)
 		return false;
 
-	MatrixXd basis(m_svd_v.rows(), rank);
-	int b = 0;
+	// I - V*Vt over the non-zero singular values, so A = B = Vt with the
+	// rows of zero singular values cleared
+	m_null_basis = m_svd_v.transpose();
 
 	for (i = 0; i < m_svd_w.size(); i++)
-		if (m_svd_w[i] > epsilon) {
-			for (j = 0; j < m_svd_v.rows(); j++)
-				basis(j, b) = m_svd_v(j, i);
-			b++;
-		}
-	
-	m_nullspace = basis * basis.transpose();
-
-	for (i = 0; i < m_nullspace.rows(); i++)
-		for (j = 0; j < m_nullspace.cols(); j++)
-			if (i == j)
-				m_nullspace(i, j) = 1.0 - m_nullspace(i, j);
-			else
-				m_nullspace(i, j) = -m_nullspace(i, j);
-	
+		if (m_svd_w[i] <= epsilon)
+			m_null_basis.row(i).setZero();
+
 	return true;
 }
 
-void IK_QJacobian::SubTask(IK_QJacobian& jacobian)
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::SubTask(IK_QJacobian& sub)
 {
 	if (!ComputeNullProjection())
 		return;
 
+	IK_QJacobianT& jacobian = static_cast<IK_QJacobianT&>(sub);
+
 	// restrict lower priority jacobian
-	jacobian.Restrict(m_d_theta, m_nullspace);
+	if (m_mode == INVERT_DLS_CHOLESKY)
+		jacobian.Restrict(m_d_theta, m_jacobian, m_jacobian_tmp);
+	else
+		jacobian.Restrict(m_d_theta, m_null_basis, m_null_basis);
 
 	// add angle update from lower priority
 	jacobian.Invert();
@@ -190,18 +255,24 @@ void IK_QJacobian::SubTask(IK_QJacobian& jacobian)
 		m_d_theta[i] = m_d_theta[i] + /*m_min_damp * */ jacobian.AngleUpdate(i);
 }
 
-void IK_QJacobian::Restrict(VectorXd& d_theta, MatrixXd& nullspace)
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::Restrict(const DoFVector& d_theta, const TaskDoFMatrix& a, const TaskDoFMatrix& b)
 {
 	// subtract part already moved by higher task from beta
-	m_beta = m_beta - m_jacobian * d_theta;
+	m_beta.noalias() -= m_jacobian * d_theta;
 
 	// note: should we be using the norm of the unrestricted jacobian for SDLS?
 	
-	// project jacobian on to null space of higher priority task
-	m_jacobian = m_jacobian * nullspace;
+	// project jacobian on to null space of higher priority task, as
+	// J*(I - At*B) = J - (J*At)*B, which is O(task*dof*k) rather than
+	// O(task*dof^2) for the dense projection
+	m_restrict_tmp.noalias() = m_jacobian * a.transpose();
+	m_jacobian.noalias() -= m_restrict_tmp * b;
+	m_factorized = false;
 }
 
-void IK_QJacobian::InvertSDLS()
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::InvertSDLS()
 {
 	// Compute the dampeds least squeares pseudo inverse of J.
 	//
@@ -219,8 +290,8 @@ void IK_QJacobian::InvertSDLS()
 	// DLS. The SDLS damps individual singular values, instead of using a single
 	// damping term.
 
-	double max_angle_change = M_PI / 4.0;
-	double epsilon = 1e-10;
+	Scalar max_angle_change = M_PI / 4.0;
+	Scalar epsilon = IK_QJacobianEpsilon<Scalar>::Zero();
 	int i, j;
 
 	m_d_theta.setZero();
@@ -229,7 +300,7 @@ void IK_QJacobian::InvertSDLS()
 	for (i = 0; i < m_dof; i++) {
 		m_norm[i] = 0.0;
 		for (j = 0; j < m_task_size; j += 3) {
-			double n = 0.0;
+			Scalar n = 0.0;
 			n += m_jacobian(j, i) * m_jacobian(j, i);
 			n += m_jacobian(j + 1, i) * m_jacobian(j + 1, i);
 			n += m_jacobian(j + 2, i) * m_jacobian(j + 2, i);
@@ -241,9 +312,9 @@ void IK_QJacobian::InvertSDLS()
 		if (m_svd_w[i] <= epsilon)
 			continue;
 
-		double wInv = 1.0 / m_svd_w[i];
-		double alpha = 0.0;
-		double N = 0.0;
+		Scalar wInv = 1.0 / m_svd_w[i];
+		Scalar alpha = 0.0;
+		Scalar N = 0.0;
 
 		// compute alpha and N
 		for (j = 0; j < m_svd_u.rows(); j += 3) {
@@ -253,7 +324,7 @@ void IK_QJacobian::InvertSDLS()
 
 			// note: for 1 end effector, N will always be 1, since U is
 			// orthogonal, .. so could be optimized
-			double tmp;
+			Scalar tmp;
 			tmp = m_svd_u(j, i) * m_svd_u(j, i);
 			tmp += m_svd_u(j + 1, i) * m_svd_u(j + 1, i);
 			tmp += m_svd_u(j + 2, i) * m_svd_u(j + 2, i);
@@ -262,11 +333,11 @@ void IK_QJacobian::InvertSDLS()
 		alpha *= wInv;
 
 		// compute M, dTheta and max_dtheta
-		double M = 0.0;
-		double max_dtheta = 0.0, abs_dtheta;
+		Scalar M = 0.0;
+		Scalar max_dtheta = 0.0, abs_dtheta;
 
 		for (j = 0; j < m_d_theta.size(); j++) {
-			double v = m_svd_v(j, i);
+			Scalar v = m_svd_v(j, i);
 			M += fabs(v) * m_norm[j];
 
 			// compute tmporary dTheta's
@@ -282,18 +353,18 @@ void IK_QJacobian::InvertSDLS()
 		M *= wInv;
 
 		// compute damping term and damp the dTheta's
-		double gamma = max_angle_change;
+		Scalar gamma = max_angle_change;
 		if (N < M)
 			gamma *= N / M;
 
-		double damp = (gamma < max_dtheta) ? gamma / max_dtheta : 1.0;
+		Scalar damp = (gamma < max_dtheta) ? gamma / max_dtheta : 1.0;
 
 		for (j = 0; j < m_d_theta.size(); j++) {
 			// slight hack: we do 0.80*, so that if there is some oscillation,
 			// the system can still converge (for joint limits). also, it's
 			// better to go a little to slow than to far
 			
-			double dofdamp = damp / m_weight[j];
+			Scalar dofdamp = damp / m_weight[j];
 			if (dofdamp > 1.0) dofdamp = 1.0;
 			
 			m_d_theta[j] += 0.80 * dofdamp * m_d_theta_tmp[j];
@@ -304,7 +375,7 @@ void IK_QJacobian::InvertSDLS()
 	}
 
 	// weight + prevent from doing angle updates with angles > max_angle_change
-	double max_angle = 0.0, abs_angle;
+	Scalar max_angle = 0.0, abs_angle;
 
 	for (j = 0; j < m_dof; j++) {
 		m_d_theta[j] *= m_weight[j];
@@ -316,14 +387,15 @@ void IK_QJacobian::InvertSDLS()
 	}
 	
 	if (max_angle > max_angle_change) {
-		double damp = (max_angle_change) / (max_angle_change + max_angle);
+		Scalar damp = (max_angle_change) / (max_angle_change + max_angle);
 
 		for (j = 0; j < m_dof; j++)
 			m_d_theta[j] *= damp;
 	}
 }
 
-void IK_QJacobian::InvertDLS()
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::InvertDLS()
 {
 	// Compute damped least squares inverse of pseudo inverse
 	// Compute damping term lambda
@@ -342,22 +414,52 @@ void IK_QJacobian::InvertDLS()
 	// find the smallest non-zero W value, anything below epsilon is
 	// treated as zero
 
-	double epsilon = 1e-10;
-	double max_angle_change = 0.1;
-	double x_length = sqrt(m_beta.dot(m_beta));
+	Scalar epsilon = IK_QJacobianEpsilon<Scalar>::Zero();
 
 	int i, j;
-	double w_min = std::numeric_limits<double>::max();
+	Scalar w_min = std::numeric_limits<Scalar>::max();
 
 	for (i = 0; i < m_svd_w.size(); i++) {
 		if (m_svd_w[i] > epsilon && m_svd_w[i] < w_min)
 			w_min = m_svd_w[i];
 	}
 	
-	// compute lambda damping term
+	// with INVERT_LM the solver adapts lambda from the progress it makes
+	Scalar lambda = (m_mode == INVERT_LM) ? m_damping : ComputeDLSDamping(w_min);
+
+	// immediately multiply with Beta, so we can do matrix*vector products
+	// rather than matrix*matrix products
+
+	// compute Ut*Beta
+	m_svd_u_beta.noalias() = m_svd_u.transpose() * m_beta;
+
+	m_d_theta.setZero();
+
+	for (i = 0; i < m_svd_w.size(); i++) {
+		if (m_svd_w[i] > epsilon) {
+			Scalar wInv = m_svd_w[i] / (m_svd_w[i] * m_svd_w[i] + lambda);
+
+			// compute V*Winv*Ut*Beta
+			m_svd_u_beta[i] *= wInv;
+
+			for (j = 0; j < m_d_theta.size(); j++)
+				m_d_theta[j] += m_svd_v(j, i) * m_svd_u_beta[i];
+		}
+	}
+
+	for (j = 0; j < m_d_theta.size(); j++)
+		m_d_theta[j] *= m_weight[j];
+}
+
+template <typename Scalar, int TaskSize, int MaxDoF>
+Scalar IK_QJacobianT<Scalar, TaskSize, MaxDoF>::ComputeDLSDamping(Scalar w_min) const
+{
+	// compute lambda damping term from the smallest singular value
+	Scalar max_angle_change = 0.1;
+	Scalar x_length = sqrt(m_beta.dot(m_beta));
 
-	double d = x_length / max_angle_change;
-	double lambda;
+	Scalar d = x_length / max_angle_change;
+	Scalar lambda;
 
 	if (w_min <= d / 2)
 		lambda = d / 2;
@@ -371,34 +473,253 @@ void IK_QJacobian::InvertDLS()
 	if (lambda > 10)
 		lambda = 10;
 
-	// immediately multiply with Beta, so we can do matrix*vector products
-	// rather than matrix*matrix products
+	return lambda;
+}
 
-	// compute Ut*Beta
-	m_svd_u_beta = m_svd_u.transpose() * m_beta;
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::InvertDLSCholesky()
+{
+	// Same damped least squares as InvertDLS, but solving the normal
+	// equations directly instead of going through the SVD. They are formed
+	// in the smaller space, so for a single end effector this is a 3x3
+	// system, regardless of the number of DoFs:
+	//
+	//   task <= dof: dTheta = Jt*(J*Jt + lambda*I)^-1*Beta
+	//   task >  dof: dTheta = (Jt*J + lambda*I)^-1*Jt*Beta
+	//
+	// The epsilon shift keeps the factorization valid on singular poses.
+	// After locking DoFs, Lock has already updated the normal matrix and
+	// its factorization.
 
-	m_d_theta.setZero();
+	Scalar epsilon = IK_QJacobianEpsilon<Scalar>::Zero();
+	int i;
+	bool task_space = (m_task_size <= m_dof);
 
-	for (i = 0; i < m_svd_w.size(); i++) {
-		if (m_svd_w[i] > epsilon) {
-			double wInv = m_svd_w[i] / (m_svd_w[i] * m_svd_w[i] + lambda);
+	if (!m_factorized) {
+		if (task_space)
+			m_normal.noalias() = m_jacobian * m_jacobian.transpose();
+		else
+			m_normal.noalias() = m_jacobian.transpose() * m_jacobian;
 
-			// compute V*Winv*Ut*Beta
-			m_svd_u_beta[i] *= wInv;
+		m_normal.diagonal().array() += epsilon;
+		m_ldlt.compute(m_normal);
 
-			for (j = 0; j < m_d_theta.size(); j++)
-				m_d_theta[j] += m_svd_v(j, i) * m_svd_u_beta[i];
+		m_lambda = 0.0;
+		m_factorized = true;
+	}
+
+	UpdateDamping();
+
+	if (task_space) {
+		m_normal_x = m_ldlt.solve(m_beta);
+		m_d_theta.noalias() = m_jacobian.transpose() * m_normal_x;
+	}
+	else {
+		m_normal_x.noalias() = m_jacobian.transpose() * m_beta;
+		m_d_theta = m_ldlt.solve(m_normal_x);
+	}
+
+	for (i = 0; i < m_d_theta.size(); i++)
+		m_d_theta[i] *= m_weight[i];
+}
+
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::UpdateDamping()
+{
+	// The smallest singular value needed for lambda is estimated with a few
+	// steps of inverse iteration on the factorized normal matrix, seeded
+	// with the previous estimate. A shift of the diagonal doesn't change
+	// the eigenvectors, so the current factorization works whatever lambda
+	// it was computed with, and it only needs to be recomputed when lambda
+	// changes.
+
+	Scalar epsilon = IK_QJacobianEpsilon<Scalar>::Zero();
+	int i, iterations = 3;
+
+	if (!(m_normal_v.squaredNorm() > epsilon))
+		m_normal_v.setOnes();
+
+	m_normal_v.normalize();
+
+	for (i = 0; i < iterations; i++) {
+		m_normal_x = m_ldlt.solve(m_normal_v);
+
+		Scalar x_norm = m_normal_x.norm();
+		if (!(x_norm > epsilon))
+			break;
+
+		m_normal_v = m_normal_x / x_norm;
+	}
+
+	// the rayleigh quotient gives the smallest eigenvalue of the normal
+	// matrix, which is the square of the smallest singular value of J
+	m_normal_x.noalias() = m_normal * m_normal_v;
+
+	Scalar mu = m_normal_v.dot(m_normal_x) - epsilon;
+	Scalar w_min = (mu > 0.0) ? sqrt(mu) : 0.0;
+	Scalar lambda = ComputeDLSDamping(w_min);
+
+	if (lambda != m_lambda) {
+		m_normal.diagonal().array() += lambda;
+		m_ldlt.compute(m_normal);
+		m_normal.diagonal().array() -= lambda;
+
+		m_lambda = lambda;
+	}
+}
+
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::InvertTranspose()
+{
+	// dTheta = alpha*Jt*Beta, which moves the DoFs along the gradient of
+	// the task error, costing only two matrix vector products. alpha is
+	// chosen so that the predicted change of the tasks J*dTheta comes as
+	// close to Beta as possible, i.e.
+	//
+	//   alpha = <Beta, J*Jt*Beta> / <J*Jt*Beta, J*Jt*Beta>
+	//
+	// The jacobian has the square roots of the DoF weights in its columns,
+	// the weights are applied to Jt*Beta once more as DLS does with its
+	// result, and J*dTheta uses the jacobian without them. So the step has
+	// the direction of a heavily damped DLS step.
+
+	Scalar max_angle_change = M_PI / 4.0;
+	Scalar epsilon = IK_QJacobianEpsilon<Scalar>::Zero();
+	int i;
+
+	m_d_theta.noalias() = m_jacobian.transpose() * m_beta;
+
+	// J*dTheta for dTheta = W*Jt*Beta, the columns of the jacobian have
+	// the square roots of the weights already
+	m_d_theta_tmp = m_d_theta.cwiseProduct(m_weight_sqrt);
+	m_beta_change.noalias() = m_jacobian * m_d_theta_tmp;
+
+	m_d_theta.array() *= m_weight.array();
+
+	Scalar change = m_beta_change.squaredNorm();
+
+	if (change <= epsilon * epsilon) {
+		m_d_theta.setZero();
+		return;
+	}
+
+	Scalar alpha = m_beta.dot(m_beta_change) / change;
+	Scalar max_angle = 0.0;
+
+	m_d_theta *= alpha;
+
+	for (i = 0; i < m_dof; i++)
+		if (fabs(m_d_theta[i]) > max_angle)
+			max_angle = fabs(m_d_theta[i]);
+
+	// far from the goals alpha can be large, limit the step like SDLS
+	if (max_angle > max_angle_change)
+		m_d_theta *= max_angle_change / max_angle;
+}
+
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::UpdateSVD()
+{
+	// Locking DoFs zeroed their rows of V, which leaves J = U*W*Vt with V
+	// no longer orthogonal. Since
+	//
+	//   J*Jt = U*M*Ut, M = W*Vt*V*W
+	//
+	// the eigen decomposition M = Q*S^2*Qt of the small k x k matrix M,
+	// computed as its SVD since M is symmetric positive semidefinite,
+	// gives the new SVD: U = U*Q, W = S and V = V*W*Q*Sinv. This costs
+	// O((task + dof)*k^2) for any number of locked DoFs, rather than a
+	// full SVD.
+
+	Scalar epsilon = IK_QJacobianEpsilon<Scalar>::Update();
+	int i, k = m_svd_w.size();
+
+	m_update.noalias() = m_svd_v.transpose() * m_svd_v;
+	m_update = m_svd_w.asDiagonal() * m_update * m_svd_w.asDiagonal();
+
+	m_update_svd.compute(m_update, Eigen::ComputeFullU);
+
+	const NormalVector& s2 = m_update_svd.singularValues();
+	const NormalMatrix& q = m_update_svd.matrixU();
+
+	// the singular values come out squared, so only about half of the
+	// precision is left, anything below the relative epsilon is zero
+	Scalar s_max = sqrt(s2[0]);
+
+	m_update.noalias() = m_svd_w.asDiagonal() * q;
+
+	for (i = 0; i < k; i++) {
+		Scalar s = (s2[i] > 0.0) ? sqrt(s2[i]) : 0.0;
+
+		if (s <= epsilon * s_max) {
+			m_svd_w[i] = 0.0;
+			m_update.col(i).setZero();
+		}
+		else {
+			m_svd_w[i] = s;
+			m_update.col(i) /= s;
 		}
 	}
 
-	for (j = 0; j < m_d_theta.size(); j++)
-		m_d_theta[j] *= m_weight[j];
+	m_svd_u_tmp.noalias() = m_svd_u * q;
+	m_svd_u = m_svd_u_tmp;
+
+	m_svd_v_tmp.noalias() = m_svd_v * m_update;
+	m_svd_v = m_svd_v_tmp;
+
+	m_svd_locked = false;
+}
+
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::LockNormal(int dof_id)
+{
+	// Zeroing column j of J is a rank one downdate of J*Jt by c*ct, with c
+	// the column. For Jt*J, row and column j are removed except for the
+	// diagonal shift, which is the rank two update -e*gt - g*et with g the
+	// column of Jt*J and g[j] halved. Both cost O(k^2).
+
+	Scalar epsilon = IK_QJacobianEpsilon<Scalar>::Zero();
+
+	if (m_task_size <= m_dof) {
+		m_normal_x = m_jacobian.col(dof_id);
+		m_normal.noalias() -= m_normal_x * m_normal_x.transpose();
+		m_ldlt.rankUpdate(m_normal_x, -1.0);
+	}
+	else {
+		m_normal_g = m_normal.col(dof_id);
+		m_normal_g[dof_id] = 0.5 * (m_normal_g[dof_id] - epsilon);
+
+		m_normal.row(dof_id).setZero();
+		m_normal.col(dof_id).setZero();
+		m_normal(dof_id, dof_id) = epsilon;
+
+		// -e*gt - g*et = 0.5*(e - g)*(e - g)t - 0.5*(e + g)*(e + g)t
+		m_normal_x = -m_normal_g;
+		m_normal_x[dof_id] += 1.0;
+		m_ldlt.rankUpdate(m_normal_x, 0.5);
+
+		m_normal_x = m_normal_g;
+		m_normal_x[dof_id] += 1.0;
+		m_ldlt.rankUpdate(m_normal_x, -0.5);
+	}
 }
 
-void IK_QJacobian::Lock(int dof_id, double delta)
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::Lock(int dof_id, double delta)
 {
 	int i;
 
+	// update the factorization for the next Invert of the clamping loop,
+	// for the SVD this is deferred so multiple locks are done at once
+	if (m_factorized) {
+		if (m_mode == INVERT_DLS_CHOLESKY)
+			LockNormal(dof_id);
+		else {
+			m_svd_v.row(dof_id).setZero();
+			m_svd_locked = true;
+		}
+	}
+
 	for (i = 0; i < m_task_size; i++) {
 		m_beta[i] -= m_jacobian(i, dof_id) * delta;
 		m_jacobian(i, dof_id) = 0.0;
@@ -408,15 +729,17 @@ void IK_QJacobian::Lock(int dof_id, double delta)
 	m_d_theta[dof_id] = 0.0;
 }
 
-double IK_QJacobian::AngleUpdate(int dof_id) const
+template <typename Scalar, int TaskSize, int MaxDoF>
+double IK_QJacobianT<Scalar, TaskSize, MaxDoF>::AngleUpdate(int dof_id) const
 {
 	return m_d_theta[dof_id];
 }
 
-double IK_QJacobian::AngleUpdateNorm() const
+template <typename Scalar, int TaskSize, int MaxDoF>
+double IK_QJacobianT<Scalar, TaskSize, MaxDoF>::AngleUpdateNorm() const
 {
 	int i;
-	double mx = 0.0, dtheta_abs;
+	Scalar mx = 0.0, dtheta_abs;
 
 	for (i = 0; i < m_d_theta.size(); i++) {
 		dtheta_abs = fabs(m_d_theta[i] * m_d_norm_weight[i]);
@@ -427,9 +750,62 @@ double IK_QJacobian::AngleUpdateNorm() const
 	return mx;
 }
 
-void IK_QJacobian::SetDoFWeight(int dof, double weight)
+template <typename Scalar, int TaskSize, int MaxDoF>
+void IK_QJacobianT<Scalar, TaskSize, MaxDoF>::SetDoFWeight(int dof, double weight)
 {
 	m_weight[dof] = weight;
 	m_weight_sqrt[dof] = sqrt(weight);
 }
 
+template <typename Scalar>
+static IK_QJacobian *CreateJacobian(int dof, int task_size, IK_QArena *arena)
+{
+	// chains of up to five segments with one or two goals, e.g. a leg,
+	// neck or tail, get a fixed task size, as long as they have at least as
+	// many DoFs as the task
+	if (task_size == 3 && dof >= 3 && dof <= 16)
+		return IK_QArenaNew<IK_QJacobianT<Scalar, 3, 16> >(arena);
+	else if (task_size == 6 && dof >= 6 && dof <= 16)
+		return IK_QArenaNew<IK_QJacobianT<Scalar, 6, 16> >(arena);
+	else
+		return IK_QArenaNew<IK_QJacobianT<Scalar, Eigen::Dynamic, Eigen::Dynamic> >(arena);
+}
+
+IK_QJacobian *IK_QJacobian::Create(int dof, int task_size, Precision precision,
+                                   IK_QArena *arena)
+{
+	if (precision == PRECISION_FLOAT)
+		return CreateJacobian<float>(dof, task_size, arena);
+	else
+		return CreateJacobian<double>(dof, task_size, arena);
+}
+
+IK_QJacobian *IK_QJacobian::CreateDynamic(Precision precision, IK_QArena *arena)
+{
+	if (precision == PRECISION_FLOAT)
+		return IK_QArenaNew<IK_QJacobianT<float, Eigen::Dynamic, Eigen::Dynamic> >(arena);
+	else
+		return IK_QArenaNew<IK_QJacobianT<double, Eigen::Dynamic, Eigen::Dynamic> >(arena);
+}
+
+size_t IK_QJacobian::MaxSize()
+{
+	size_t size = 0;
+
+	size = std::max(size, sizeof(IK_QJacobianT<double, 3, 16>));
+	size = std::max(size, sizeof(IK_QJacobianT<double, 6, 16>));
+	size = std::max(size, sizeof(IK_QJacobianT<double, Eigen::Dynamic, Eigen::Dynamic>));
+	size = std::max(size, sizeof(IK_QJacobianT<float, 3, 16>));
+	size = std::max(size, sizeof(IK_QJacobianT<float, 6, 16>));
+	size = std::max(size, sizeof(IK_QJacobianT<float, Eigen::Dynamic, Eigen::Dynamic>));
+
+	return size;
+}
+
+template class IK_QJacobianT<double, 3, 16>;
+template class IK_QJacobianT<double, 6, 16>;
+template class IK_QJacobianT<double, Eigen::Dynamic, Eigen::Dynamic>;
+
+template class IK_QJacobianT<float, 3, 16>;
+template class IK_QJacobianT<float, 6, 16>;
+template class IK_QJacobianT<float, Eigen::Dynamic, Eigen::Dynamic>;
@@ -34,16 +34,119 @@
 #pragma once
 
 #include "IK_Math.h"
+#include "IK_QArena.h"
+
+#include <Eigen/Cholesky>
+#include <Eigen/SVD>
+
+/**
+ * Interface of the jacobian used by the tasks, segments and the solver.
+ * Create picks an implementation with fixed maximum matrix sizes for
+ * small problems, so matrices live inline without heap allocations, and
+ * falls back to dynamically sized matrices for big rigs. Each is available
+ * in double and single precision.
+ */
 
 class IK_QJacobian
 {
 public:
-	IK_QJacobian();
-	~IK_QJacobian();
+	// method used to compute the angle updates
+	enum InvertMode {
+		// selectively damped least squares with SVD, best quality
+		INVERT_SDLS,
+		// damped least squares with SVD
+		INVERT_DLS,
+		// damped least squares with a cholesky factorization of the
+		// normal equations, no SVD
+		INVERT_DLS_CHOLESKY,
+		// damped least squares with SVD and the damping set by the solver,
+		// for levenberg-marquardt iterations
+		INVERT_LM,
+		// scaled jacobian transpose, no decomposition at all. cheap but
+		// slow to converge, secondary tasks are ignored
+		INVERT_TRANSPOSE
+	};
+
+	// scalar type used for the matrices and their decompositions, segments
+	// and tasks always use double
+	enum Precision {
+		PRECISION_DOUBLE,
+		PRECISION_FLOAT
+	};
+
+	virtual ~IK_QJacobian() {}
+
+	// Create a jacobian for exactly dof x task_size, in the arena if
+	// there is one. free it with IK_QArenaDelete
+	static IK_QJacobian *Create(int dof, int task_size, Precision precision,
+	                            IK_QArena *arena);
+
+	// Create a jacobian of any size, as needed for SubTask
+	static IK_QJacobian *CreateDynamic(Precision precision, IK_QArena *arena);
+
+	// largest size of a jacobian returned by Create or CreateDynamic, the
+	// matrices of the dynamically sized ones live on the heap regardless
+	static size_t MaxSize();
+
+	// Call once to initialize
+	virtual void ArmMatrices(int dof, int task_size)=0;
+	virtual void SetDoFWeight(int dof, double weight)=0;
+	virtual void SetInvertMode(InvertMode mode)=0;
+
+	// damping term used by INVERT_LM
+	virtual void SetDamping(double lambda)=0;
+
+	// Iteratively called
+	virtual void SetBetas(int id, int size, const Vector3d& v)=0;
+	virtual void SetDerivatives(int id, int dof_id, const Vector3d& v, double norm_weight)=0;
+
+	virtual void Invert()=0;
+
+	virtual double AngleUpdate(int dof_id) const=0;
+	virtual double AngleUpdateNorm() const=0;
+
+	// DoF locking for inner clamping loop
+	virtual void Lock(int dof_id, double delta)=0;
+
+	// Secondary task, jacobian must have been created with the same
+	// precision and maximum sizes as this one
+	virtual void SubTask(IK_QJacobian& jacobian)=0;
+};
+
+// thresholds below which values are treated as zero, depending on the
+// precision of the scalar type
+template <typename Scalar>
+struct IK_QJacobianEpsilon {
+	// singular values and pivots
+	static Scalar Zero() { return 1e-10; }
+	// relative, for singular values after a DoF lock update
+	static Scalar Update() { return 1e-6; }
+};
+
+template <>
+struct IK_QJacobianEpsilon<float> {
+	static float Zero() { return 1e-5f; }
+	static float Update() { return 1e-3f; }
+};
+
+// jacobian of exactly TaskSize rows and up to MaxDoF columns, or of any
+// size with both Eigen::Dynamic. a fixed task size also fixes the size of
+// the normal equations and the SVD update, which are formed in task space
+// and need at least as many DoFs as the task size
+template <typename Scalar, int TaskSize, int MaxDoF>
+class IK_QJacobianT : public IK_QJacobian
+{
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	IK_QJacobianT();
+	~IK_QJacobianT();
 
 	// Call once to initialize
 	void ArmMatrices(int dof, int task_size);
 	void SetDoFWeight(int dof, double weight);
+	void SetInvertMode(InvertMode mode);
+	void SetDamping(double lambda);
 
 	// Iteratively called
 	void SetBetas(int id, int size, const Vector3d& v);
@@ -58,49 +161,97 @@ public:
 	void Lock(int dof_id, double delta);
 
 	// Secondary task
-	bool ComputeNullProjection();
-
-	void Restrict(VectorXd& d_theta, MatrixXd& nullspace);
 	void SubTask(IK_QJacobian& jacobian);
 
 private:
-	
+	typedef Eigen::Matrix<Scalar, TaskSize, Eigen::Dynamic, 0, TaskSize, MaxDoF> TaskDoFMatrix;
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, 0, MaxDoF, MaxDoF> DoFMatrix;
+	typedef Eigen::Matrix<Scalar, TaskSize, 1> TaskVector;
+	typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1, 0, MaxDoF, 1> DoFVector;
+
+	// normal equations are formed in the smaller of task and dof space,
+	// always the task space for a fixed task size
+	typedef Eigen::Matrix<Scalar, TaskSize, TaskSize> NormalMatrix;
+	typedef Eigen::Matrix<Scalar, TaskSize, 1> NormalVector;
+
+	bool ComputeNullProjection();
+	void Restrict(const DoFVector& d_theta, const TaskDoFMatrix& a, const TaskDoFMatrix& b);
+
+	void ComputeSVD();
+	void UpdateSVD();
+	void LockNormal(int dof_id);
+
 	void InvertSDLS();
 	void InvertDLS();
+	void InvertDLSCholesky();
+	void UpdateDamping();
+	void InvertTranspose();
+
+	Scalar ComputeDLSDamping(Scalar w_min) const;
 
 	int m_dof, m_task_size;
-	bool m_transpose;
 
-	// the jacobian matrix and it's null space projector
-	MatrixXd m_jacobian, m_jacobian_tmp;
-	MatrixXd m_nullspace;
+	// the jacobian matrix and the basis of its row space, which defines
+	// the null space projection
+	TaskDoFMatrix m_jacobian;
+	TaskDoFMatrix m_null_basis;
 
 	/// the vector of intermediate betas
-	VectorXd m_beta;
+	TaskVector m_beta;
 
 	/// the vector of computed angle changes
-	VectorXd m_d_theta;
-	VectorXd m_d_norm_weight;
+	DoFVector m_d_theta;
+	DoFVector m_d_norm_weight;
 
-	/// space required for SVD computation
-	VectorXd m_svd_w;
-	MatrixXd m_svd_v;
-	MatrixXd m_svd_u;
+	/// space required for SVD computation, J = U*W*Vt with U task x k and
+	/// V dof x k, k = min(task, dof)
+	Eigen::JacobiSVD<TaskDoFMatrix> m_svd;
+	DoFVector m_svd_w;
+	DoFMatrix m_svd_v;
+	TaskDoFMatrix m_svd_u;
 
-	VectorXd m_svd_u_beta;
+	DoFVector m_svd_u_beta;
+
+	// temporaries for products that would otherwise allocate
+	TaskDoFMatrix m_jacobian_tmp;
+	TaskDoFMatrix m_restrict_tmp;
+	TaskDoFMatrix m_svd_u_tmp;
+	DoFMatrix m_svd_v_tmp;
+
+	InvertMode m_mode;
+	Scalar m_damping;
+
+	// true when the SVD or cholesky factorization matches the jacobian,
+	// locking a DoF then updates it rather than recomputing it
+	bool m_factorized;
+	bool m_svd_locked;
+	NormalMatrix m_update;
+	Eigen::JacobiSVD<NormalMatrix> m_update_svd;
+
+	// space required for cholesky DLS, the normal matrix, the factorization
+	// of it with damping and the estimated eigenvector of the smallest
+	// singular value
+	NormalMatrix m_normal;
+	Eigen::LDLT<NormalMatrix> m_ldlt;
+	NormalVector m_normal_x;
+	NormalVector m_normal_v;
+	NormalVector m_normal_g;
+	Scalar m_lambda;
 
 	// space required for SDLS
+	DoFVector m_norm;
+	DoFVector m_d_theta_tmp;
+	Scalar m_min_damp;
 
-	bool m_sdls;
-	VectorXd m_norm;
-	VectorXd m_d_theta_tmp;
-	double m_min_damp;
+	// space required for the transpose, the task change it predicts
+	TaskVector m_beta_change;
 
 	// null space task vector
-	VectorXd m_alpha;
+	DoFVector m_alpha;
 
 	// dof weighting
-	VectorXd m_weight;
-	VectorXd m_weight_sqrt;
+	DoFVector m_weight;
+	DoFVector m_weight_sqrt;
 };
 
+
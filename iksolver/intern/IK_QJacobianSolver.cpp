@@ -41,6 +41,76 @@ IK_QJacobianSolver::IK_QJacobianSolver()
 	m_poleconstraint = false;
 	m_getpoleangle = false;
 	m_rootmatrix.setIdentity();
+	m_skeleton = NULL;
+
+	m_twobone_upper = NULL;
+	m_twobone_lower = NULL;
+	m_twobone_task = NULL;
+
+	m_min_iterations = 0;
+	m_stall_iterations = 5;
+	m_stall_ratio = 1e-5;
+	m_iterations = 0;
+	m_deadline_hit = false;
+
+	m_solving = false;
+	m_iterating = false;
+	m_finished = false;
+	m_solved = false;
+	m_warmstart_hit = false;
+	m_stepped = false;
+	m_tolerance = 0.0;
+	m_scale = 1.0f;
+	m_best_residual = 0.0;
+	m_best_pose_residual = 0.0;
+	m_stalled = 0;
+
+	m_invert_mode = IK_QJacobian::INVERT_SDLS;
+	m_precision = IK_QJacobian::PRECISION_DOUBLE;
+	m_arena = NULL;
+
+	m_warmstart = false;
+	m_warmstart_valid = false;
+	m_warmstart_epsilon = 0.0;
+	m_warmstart_hits = 0;
+	m_warmstart_misses = 0;
+}
+
+IK_QJacobianSolver::~IK_QJacobianSolver()
+{
+	FreeBlocks();
+}
+
+void IK_QJacobianSolver::SetConvergence(int min_iterations, int stall_iterations, double stall_ratio)
+{
+	m_min_iterations = (min_iterations > 0) ? min_iterations : 0;
+	m_stall_iterations = (stall_iterations > 1) ? stall_iterations : 1;
+	m_stall_ratio = Clamp(stall_ratio, 0.0, 1.0);
+}
+
+void IK_QJacobianSolver::SetInvertMode(IK_QJacobian::InvertMode mode)
+{
+	m_invert_mode = mode;
+
+	std::vector<Block>::iterator block;
+
+	for (block = m_blocks.begin(); block != m_blocks.end(); block++) {
+		block->jacobian->SetInvertMode(mode);
+		if (block->jacobian_sub)
+			block->jacobian_sub->SetInvertMode(mode);
+	}
+}
+
+void IK_QJacobianSolver::SetPrecision(IK_QJacobian::Precision precision)
+{
+	m_precision = precision;
+}
+
+void IK_QJacobianSolver::SetArena(IK_QArena *arena)
+{
+	// jacobians are freed into the arena they came from
+	FreeBlocks();
+	m_arena = arena;
 }
 
 double IK_QJacobianSolver::ComputeScale()
@@ -57,76 +127,273 @@ double IK_QJacobianSolver::ComputeScale()
 		return 1.0 / length;
 }
 
-void IK_QJacobianSolver::Scale(double scale, std::list<IK_QTask *>& tasks)
+void IK_QJacobianSolver::Scale(IK_QPose& pose, double scale)
 {
-	std::list<IK_QTask *>::iterator task;
-	std::vector<IK_QSegment *>::iterator seg;
-
-	for (task = tasks.begin(); task != tasks.end(); task++)
-		(*task)->Scale(scale);
+	pose.Scale(scale);
 
-	for (seg = m_segments.begin(); seg != m_segments.end(); seg++)
-		(*seg)->Scale(scale);
-	
 	m_rootmatrix.translation() *= scale;
 	m_goal *= scale;
 	m_polegoal *= scale;
 }
 
-void IK_QJacobianSolver::AddSegmentList(IK_QSegment *seg)
+void IK_QJacobianSolver::UpdateTransforms(IK_QPose& pose, bool all)
 {
-	m_segments.push_back(seg);
+	// unless all are updated, only segments that changed since the last
+	// update and their children are
+	m_skeleton->UpdateTransforms(pose, m_rootmatrix, all);
+
+	// the tasks only use the axes of segments in a block
+	std::vector<Block>::iterator block;
+	int type;
 
-	IK_QSegment *child;
-	for (child = seg->Child(); child; child = child->Sibling())
-		AddSegmentList(child);
+	for (block = m_blocks.begin(); block != m_blocks.end(); block++)
+		for (type = 0; type < IK_QSegment::NUM_JOINT_TYPES; type++)
+			IK_QSegment::UpdateAxes((IK_QSegment::JointType)type, block->joints[type], pose);
 }
 
-bool IK_QJacobianSolver::Setup(IK_QSegment *root, std::list<IK_QTask *>& tasks)
+bool IK_QJacobianSolver::Setup(const IK_QSkeleton& skeleton)
 {
-	m_segments.clear();
-	AddSegmentList(root);
+	m_skeleton = &skeleton;
+	m_segments = skeleton.Segments();
+	m_tasks = skeleton.Tasks();
+
+	// poses saved while solving, sized here to not allocate then
+	m_saved_basis.resize(m_segments.size());
+	m_saved_translation.resize(m_segments.size());
+	m_saved_task_goal.resize(m_tasks.size());
+	m_saved_task_rotation.resize(m_tasks.size());
+	m_best_basis.resize(m_segments.size());
+	m_best_translation.resize(m_segments.size());
+
+	m_warmstart_valid = false;
+
+	// need at least one primary task
+	std::vector<IK_QTask *>::iterator task;
+	int primary = 0;
+
+	for (task = m_tasks.begin(); task != m_tasks.end(); task++)
+		if ((*task)->Primary())
+			primary++;
+
+	if (primary == 0 || !UpdateTaskWeights())
+		return false;
+
+	SetupTwoBone();
 
+	return SetupBlocks();
+}
+
+void IK_QJacobianSolver::SetupTwoBone()
+{
+	// a thigh and shin, or upper arm and forearm, with a single position
+	// goal at the end. the bones may be anywhere in the tree as long as the
+	// segments above them have no DoF, these stay fixed like in the
+	// iterative solve. the blocks are still set up as fallback
+	m_twobone_upper = NULL;
+	m_twobone_lower = NULL;
+	m_twobone_task = NULL;
+
+	if (m_tasks.size() != 1 || !m_tasks.front()->PositionTask() || !m_tasks.front()->Primary())
+		return;
+
+	IK_QSegment *lower = (IK_QSegment *)m_tasks.front()->Segment();
+	IK_QSegment *upper = lower->Parent();
+	IK_QSegment *seg;
+
+	if (!upper || upper->Composite() || lower->Composite())
+		return;
+
+	for (seg = upper->Parent(); seg; seg = seg->Parent())
+		if (seg->NumberOfDoF() != 0)
+			return;
+
+	if (!dynamic_cast<IK_QSphericalSegment *>(upper) && !dynamic_cast<IK_QSwingSegment *>(upper))
+		return;
+
+	if (!dynamic_cast<IK_QRevoluteSegment *>(lower) && !dynamic_cast<IK_QElbowSegment *>(lower))
+		return;
+
+	m_twobone_upper = upper;
+	m_twobone_lower = lower;
+	m_twobone_task = (IK_QPositionTask *)m_tasks.front();
+}
+
+static int FindBlock(std::vector<int>& parent, int i)
+{
+	// find with path halving
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+
+	return i;
+}
+
+bool IK_QJacobianSolver::SetupBlocks()
+{
+	FreeBlocks();
+
+	// join tasks that depend on the same DoFs into one block, with a
+	// single block and no extra cost when all tasks share the root
+	std::vector<IK_QTask *>& tasklist = m_tasks;
+	std::vector<int> parent(tasklist.size());
+	std::vector<int> segment_task(m_segments.size(), -1);
+	size_t i, j;
+
+	for (i = 0; i < tasklist.size(); i++)
+		parent[i] = i;
+
+	for (i = 0; i < m_segments.size(); i++) {
+		if (m_segments[i]->NumberOfDoF() == 0)
+			continue;
+
+		for (j = 0; j < tasklist.size(); j++) {
+			if (!tasklist[j]->DependsOn(m_segments[i]))
+				continue;
+
+			if (segment_task[i] == -1)
+				segment_task[i] = j;
+			else
+				parent[FindBlock(parent, j)] = FindBlock(parent, segment_task[i]);
+		}
+	}
+
+	// create the blocks, segments that no task depends on are left out
+	std::vector<int> block_index(tasklist.size(), -1);
+
+	for (i = 0; i < tasklist.size(); i++) {
+		int root = FindBlock(parent, i);
+
+		if (block_index[root] == -1) {
+			Block block;
+			block.jacobian = NULL;
+			block.jacobian_sub = NULL;
+			block.damping = 0.0;
+			block.best_error = 0.0;
+
+			block_index[root] = m_blocks.size();
+			m_blocks.push_back(block);
+		}
+
+		m_blocks[block_index[root]].tasks.push_back(tasklist[i]);
+	}
+
+	for (i = 0; i < m_segments.size(); i++) {
+		if (segment_task[i] != -1) {
+			int root = FindBlock(parent, segment_task[i]);
+			m_blocks[block_index[root]].segments.push_back(m_segments[i]);
+		}
+	}
+
+	// tasks that don't depend on any DoF have nothing to solve
+	std::vector<Block>::iterator block;
+
+	for (block = m_blocks.begin(); block != m_blocks.end(); ) {
+		if (block->segments.empty())
+			block = m_blocks.erase(block);
+		else {
+			SetupBlock(*block);
+			block++;
+		}
+	}
+
+	return !m_blocks.empty();
+}
+
+void IK_QJacobianSolver::SetupBlock(Block& block)
+{
 	// assign each segment a unique id for the jacobian
 	std::vector<IK_QSegment *>::iterator seg;
 	int num_dof = 0;
 
-	for (seg = m_segments.begin(); seg != m_segments.end(); seg++) {
+	for (seg = block.segments.begin(); seg != block.segments.end(); seg++) {
 		(*seg)->SetDoFId(num_dof);
 		num_dof += (*seg)->NumberOfDoF();
+		block.joints[(*seg)->Type()].push_back(*seg);
 	}
 
-	if (num_dof == 0)
-		return false;
-
-	// compute task id's and assing weights to task
+	// compute task id's
 	int primary_size = 0, primary = 0;
 	int secondary_size = 0, secondary = 0;
-	double primary_weight = 0.0, secondary_weight = 0.0;
-	std::list<IK_QTask *>::iterator task;
+	std::vector<IK_QTask *>::iterator task;
 
-	for (task = tasks.begin(); task != tasks.end(); task++) {
+	for (task = block.tasks.begin(); task != block.tasks.end(); task++) {
 		IK_QTask *qtask = *task;
 
 		if (qtask->Primary()) {
 			qtask->SetId(primary_size);
 			primary_size += qtask->Size();
-			primary_weight += qtask->Weight();
 			primary++;
 		}
 		else {
 			qtask->SetId(secondary_size);
 			secondary_size += qtask->Size();
-			secondary_weight += qtask->Weight();
 			secondary++;
 		}
 	}
 
-	if (primary_size == 0 || FuzzyZero(primary_weight))
+	// without primary tasks on these DoFs, nothing restricts the secondary
+	// ones, solve them as primary
+	if (primary == 0) {
+		primary_size = secondary_size;
+		secondary = 0;
+	}
+
+	// set matrix sizes, the secondary task is projected onto the null space
+	// of the primary one, for which both need the same matrix type
+	if (secondary > 0) {
+		block.jacobian = IK_QJacobian::CreateDynamic(m_precision, m_arena);
+		block.jacobian_sub = IK_QJacobian::CreateDynamic(m_precision, m_arena);
+		block.jacobian_sub->SetInvertMode(m_invert_mode);
+		block.jacobian_sub->ArmMatrices(num_dof, secondary_size);
+	}
+	else
+		block.jacobian = IK_QJacobian::Create(num_dof, primary_size, m_precision, m_arena);
+
+	block.jacobian->SetInvertMode(m_invert_mode);
+	block.jacobian->ArmMatrices(num_dof, primary_size);
+
+	// set dof weights
+	int i;
+
+	for (seg = block.segments.begin(); seg != block.segments.end(); seg++)
+		for (i = 0; i < (*seg)->NumberOfDoF(); i++)
+			block.jacobian->SetDoFWeight((*seg)->DoFId() + i, (*seg)->Weight(i));
+
+	block.best_basis.resize(block.segments.size());
+	block.best_translation.resize(block.segments.size());
+}
+
+void IK_QJacobianSolver::FreeBlocks()
+{
+	std::vector<Block>::iterator block;
+
+	for (block = m_blocks.begin(); block != m_blocks.end(); block++) {
+		IK_QArenaDelete(m_arena, block->jacobian);
+		IK_QArenaDelete(m_arena, block->jacobian_sub);
+	}
+
+	m_blocks.clear();
+}
+
+bool IK_QJacobianSolver::UpdateTaskWeights()
+{
+	double primary_weight = 0.0, secondary_weight = 0.0;
+	std::vector<IK_QTask *>::iterator task;
+
+	for (task = m_tasks.begin(); task != m_tasks.end(); task++) {
+		if ((*task)->Primary())
+			primary_weight += (*task)->UserWeight();
+		else
+			secondary_weight += (*task)->UserWeight();
+	}
+
+	if (FuzzyZero(primary_weight))
 		return false;
 
-	m_secondary_enabled = (secondary > 0);
-	
+	// the saved solution was found with different weights
+	m_warmstart_valid = false;
+
 	// rescale weights of tasks to sum up to 1
 	double primary_rescale = 1.0 / primary_weight;
 	double secondary_rescale;
@@ -135,26 +402,104 @@ bool IK_QJacobianSolver::Setup(IK_QSegment *root, std::list<IK_QTask *>& tasks)
 	else
 		secondary_rescale = 1.0 / secondary_weight;
 	
-	for (task = tasks.begin(); task != tasks.end(); task++) {
+	for (task = m_tasks.begin(); task != m_tasks.end(); task++) {
 		IK_QTask *qtask = *task;
 
 		if (qtask->Primary())
-			qtask->SetWeight(qtask->Weight() * primary_rescale);
+			qtask->SetWeight(qtask->UserWeight() * primary_rescale);
 		else
-			qtask->SetWeight(qtask->Weight() * secondary_rescale);
+			qtask->SetWeight(qtask->UserWeight() * secondary_rescale);
 	}
 
-	// set matrix sizes
-	m_jacobian.ArmMatrices(num_dof, primary_size);
-	if (secondary > 0)
-		m_jacobian_sub.ArmMatrices(num_dof, secondary_size);
+	return true;
+}
 
-	// set dof weights
+bool IK_QJacobianSolver::SolveTwoBone(IK_QPose& pose, double tolerance, bool& solved)
+{
+	// bend the hinge so that the end is as far from the start of the chain
+	// as the goal, then rotate the whole chain towards the goal and the
+	// pole with the same look-at construction as the iterative solve.
+	// returns false if the limits don't allow this, and the chain is then
+	// left as it was for the iterative solve
+	IK_QSegment *upper = m_twobone_upper, *lower = m_twobone_lower;
+
+	if (!m_poleconstraint || m_poletip != lower)
+		return false;
+
+	Matrix3d upper_basis = upper->Basis(pose);
+	Matrix3d lower_basis = lower->Basis(pose);
+
+	m_rootmatrix.setIdentity();
+	UpdateTransforms(pose, true);
+
+	const Vector3d start = upper->GlobalStart(pose);
+	const Vector3d w = lower->GlobalStart(pose) - start;
+	const Vector3d v = lower->GlobalEnd(pose) - lower->GlobalStart(pose);
+	const Vector3d axis = lower->Axis(pose, 0);
+
+	// rotating v by theta around the hinge axis, the law of cosines for
+	// the distance to the goal becomes a*cos(theta) + b*sin(theta) = c
+	Vector3d v_axis = axis * axis.dot(v);
+	Vector3d v_perp = v - v_axis;
+
+	double a = w.dot(v_perp);
+	double b = w.dot(axis.cross(v_perp));
+	double r = sqrt(a * a + b * b);
+
+	if (FuzzyZero(r))
+		return false;
+
+	double d = (m_twobone_task->Goal(pose) - start).norm();
+	double c = 0.5 * (d * d - w.squaredNorm() - v.squaredNorm()) - w.dot(v_axis);
+
+	// of the two bends, prefer the smallest change, out of reach goals
+	// end up with a straight chain
+	double phi = atan2(b, a);
+	double bend = safe_acos(Clamp(c / r, -1.0, 1.0));
+	double theta[2] = {phi + bend, phi - bend};
+	Vector3d dq(0, 0, 0), delta;
+	bool clamp[3];
 	int i;
 
-	for (seg = m_segments.begin(); seg != m_segments.end(); seg++)
-		for (i = 0; i < (*seg)->NumberOfDoF(); i++)
-			m_jacobian.SetDoFWeight((*seg)->DoFId() + i, (*seg)->Weight(i));
+	for (i = 0; i < 2; i++)
+		theta[i] = atan2(sin(theta[i]), cos(theta[i]));
+
+	if (fabs(theta[1]) < fabs(theta[0]))
+		std::swap(theta[0], theta[1]);
+
+	for (i = 0; i < 2; i++) {
+		dq[0] = theta[i];
+		if (!lower->UpdateAngle(pose, dq, delta, clamp))
+			break;
+	}
+
+	if (i == 2)
+		return false;
+
+	lower->UpdateAngleApply(pose);
+
+	// rotate towards goal and pole around the start of the upper bone, the
+	// rotation is global and the upper basis is in the parent frame
+	ConstrainPoleVector(pose, upper, m_getpoleangle);
+
+	if (upper->Parent()) {
+		const Matrix3d& parent_basis = upper->Parent()->GlobalTransform(pose).linear();
+		upper->PrependBasis(pose, parent_basis.transpose() * m_rootmatrix.linear() * parent_basis);
+	}
+	else
+		upper->PrependBasis(pose, m_rootmatrix.linear());
+
+	m_rootmatrix.setIdentity();
+
+	if (upper->UpdateAngle(pose, Vector3d(0, 0, 0), delta, clamp)) {
+		upper->SetBasis(pose, upper_basis);
+		lower->SetBasis(pose, lower_basis);
+		return false;
+	}
+
+	UpdateTransforms(pose, true);
+
+	solved = (m_twobone_task->Distance(pose) <= tolerance);
 
 	return true;
 }
@@ -169,7 +514,24 @@ void IK_QJacobianSolver::SetPoleVectorConstraint(IK_QSegment *tip, Vector3d& goa
 	m_getpoleangle = getangle;
 }
 
-void IK_QJacobianSolver::ConstrainPoleVector(IK_QSegment *root, std::list<IK_QTask *>& tasks)
+void IK_QJacobianSolver::CopySettings(const IK_QJacobianSolver& other)
+{
+	m_poleconstraint = other.m_poleconstraint;
+	m_getpoleangle = other.m_getpoleangle;
+	m_poletip = other.m_poletip;
+	m_goal = other.m_goal;
+	m_polegoal = other.m_polegoal;
+	m_poleangle = other.m_poleangle;
+
+	m_min_iterations = other.m_min_iterations;
+	m_stall_iterations = other.m_stall_iterations;
+	m_stall_ratio = other.m_stall_ratio;
+
+	m_invert_mode = other.m_invert_mode;
+	m_precision = other.m_precision;
+}
+
+void IK_QJacobianSolver::ConstrainPoleVector(IK_QPose& pose, IK_QSegment *root, bool getangle)
 {
 	// this function will be called before and after solving. calling it before
 	// solving gives predictable solutions by rotating towards the solution,
@@ -179,10 +541,10 @@ void IK_QJacobianSolver::ConstrainPoleVector(IK_QSegment *root, std::list<IK_QTa
 		return;
 	
 	// disable pole vector constraint in case of multiple position tasks
-	std::list<IK_QTask *>::iterator task;
+	std::vector<IK_QTask *>::iterator task;
 	int positiontasks = 0;
 
-	for (task = tasks.begin(); task != tasks.end(); task++)
+	for (task = m_tasks.begin(); task != m_tasks.end(); task++)
 		if ((*task)->PositionTask())
 			positiontasks++;
 	
@@ -192,11 +554,11 @@ void IK_QJacobianSolver::ConstrainPoleVector(IK_QSegment *root, std::list<IK_QTa
 	}
 
 	// get positions and rotations
-	root->UpdateTransform(m_rootmatrix);
+	UpdateTransforms(pose, true);
 
-	const Vector3d rootpos = root->GlobalStart();
-	const Vector3d endpos = m_poletip->GlobalEnd();
-	const Matrix3d& rootbasis = root->GlobalTransform().linear();
+	const Vector3d rootpos = root->GlobalStart(pose);
+	const Vector3d endpos = m_poletip->GlobalEnd(pose);
+	const Matrix3d& rootbasis = root->GlobalTransform(pose).linear();
 
 	// construct "lookat" matrices (like gluLookAt), based on a direction and
 	// an up vector, with the direction going from the root to the end effector
@@ -204,10 +566,11 @@ void IK_QJacobianSolver::ConstrainPoleVector(IK_QSegment *root, std::list<IK_QTa
 	Vector3d dir = normalize(endpos - rootpos);
 	Vector3d rootx = rootbasis.col(0);
 	Vector3d rootz = rootbasis.col(2);
-	Vector3d up = rootx * cos(m_poleangle) + rootz *sin(m_poleangle);
+	double poleangle = (getangle) ? 0.0 : m_poleangle;
+	Vector3d up = rootx * cos(poleangle) + rootz *sin(poleangle);
 
 	// in post, don't rotate towards the goal but only correct the pole up
-	Vector3d poledir = (m_getpoleangle) ? dir : normalize(m_goal - rootpos);
+	Vector3d poledir = (getangle) ? dir : normalize(m_goal - rootpos);
 	Vector3d poleup = normalize(m_polegoal - rootpos);
 
 	Matrix3d mat, polemat;
@@ -220,7 +583,7 @@ void IK_QJacobianSolver::ConstrainPoleVector(IK_QSegment *root, std::list<IK_QTa
 	polemat.row(1) = polemat.row(0).cross(poledir);
 	polemat.row(2) = -poledir;
 
-	if (m_getpoleangle) {
+	if (getangle) {
 		// we compute the pole angle that to rotate towards the target
 		m_poleangle = angle(mat.row(1), polemat.row(1));
 
@@ -229,8 +592,7 @@ void IK_QJacobianSolver::ConstrainPoleVector(IK_QSegment *root, std::list<IK_QTa
 			m_poleangle = -m_poleangle;
 
 		// solve again, with the pole angle we just computed
-		m_getpoleangle = false;
-		ConstrainPoleVector(root, tasks);
+		ConstrainPoleVector(pose, root, false);
 	}
 	else {
 		// now we set as root matrix the difference between the current and
@@ -244,28 +606,37 @@ void IK_QJacobianSolver::ConstrainPoleVector(IK_QSegment *root, std::list<IK_QTa
 	}
 }
 
-bool IK_QJacobianSolver::UpdateAngles(double& norm)
+bool IK_QJacobianSolver::UpdateAngles(IK_QPose& pose, Block& block, double& norm)
 {
-	// assing each segment a unique id for the jacobian
 	std::vector<IK_QSegment *>::iterator seg;
 	IK_QSegment *qseg, *minseg = NULL;
 	double minabsdelta = 1e10, absdelta;
-	Vector3d delta, mindelta;
-	bool locked = false, clamp[3];
-	int i, mindof = 0;
+	Vector3d mindelta;
+	bool locked = false;
+	int i, type, mindof = 0;
+
+	// update the angles of each type of segment in one loop, locking a DoF
+	// only changes its own angle update, so the limit violations can be
+	// handled afterwards
+	for (type = 0; type < IK_QSegment::NUM_JOINT_TYPES; type++)
+		IK_QSegment::UpdateAngles((IK_QSegment::JointType)type, block.joints[type], *block.jacobian, pose);
 
 	// here we check if any angle limits were violated. angles whose clamped
 	// position is the same as it was before, are locked immediate. of the
 	// other violation angles the most violating angle is rememberd
-	for (seg = m_segments.begin(); seg != m_segments.end(); seg++) {
+	for (seg = block.segments.begin(); seg != block.segments.end(); seg++) {
 		qseg = *seg;
-		if (qseg->UpdateAngle(m_jacobian, delta, clamp)) {
+		int index = qseg->Index();
+
+		if (pose.clamped[index]) {
+			const Vector3d& delta = pose.delta[index];
+
 			for (i = 0; i < qseg->NumberOfDoF(); i++) {
-				if (clamp[i] && !qseg->Locked(i)) {
+				if (pose.clamp[index * 3 + i] && !qseg->Locked(pose, i)) {
 					absdelta = fabs(delta[i]);
 
 					if (absdelta < IK_EPSILON) {
-						qseg->Lock(i, m_jacobian, delta);
+						qseg->Lock(pose, i, *block.jacobian, delta);
 						locked = true;
 					}
 					else if (absdelta < minabsdelta) {
@@ -281,97 +652,512 @@ bool IK_QJacobianSolver::UpdateAngles(double& norm)
 
 	// lock most violating angle
 	if (minseg) {
-		minseg->Lock(mindof, m_jacobian, mindelta);
+		minseg->Lock(pose, mindof, *block.jacobian, mindelta);
 		locked = true;
 
 		if (minabsdelta > norm)
 			norm = minabsdelta;
 	}
 
-	if (locked == false)
+	if (locked == false) {
 		// no locking done, last inner iteration, apply the angles
-		for (seg = m_segments.begin(); seg != m_segments.end(); seg++) {
-			(*seg)->UnLock();
-			(*seg)->UpdateAngleApply();
-		}
+		for (seg = block.segments.begin(); seg != block.segments.end(); seg++)
+			(*seg)->UnLock(pose);
+
+		for (type = 0; type < IK_QSegment::NUM_JOINT_TYPES; type++)
+			IK_QSegment::UpdateAngleApply((IK_QSegment::JointType)type, block.joints[type], pose);
+	}
 	
 	// signal if another inner iteration is needed
 	return locked;
 }
 
-bool IK_QJacobianSolver::Solve(
-    IK_QSegment *root,
-    std::list<IK_QTask *> tasks,
-    const double,
-    const int max_iterations
-    )
+void IK_QJacobianSolver::ComputeJacobian(IK_QPose& pose, Block& block)
 {
-	float scale = ComputeScale();
-	bool solved = false;
+	std::vector<IK_QTask *>::iterator task;
+
+	for (task = block.tasks.begin(); task != block.tasks.end(); task++) {
+		if ((*task)->Primary() || !block.jacobian_sub)
+			(*task)->ComputeJacobian(pose, *block.jacobian);
+		else
+			(*task)->ComputeJacobian(pose, *block.jacobian_sub);
+	}
+}
+
+bool IK_QJacobianSolver::AcceptStep(IK_QPose& pose, Block& block)
+{
+	// keep the last step if it reduced the weighted squared error of the
+	// primary tasks and trust the linearization more, otherwise go back to
+	// the best pose and take a smaller, more damped step from there. the
+	// distances must be up to date, so the jacobian was computed already
+	std::vector<IK_QTask *>::iterator task;
+	double error = 0.0;
+	size_t i;
+
+	for (task = block.tasks.begin(); task != block.tasks.end(); task++) {
+		if ((*task)->Primary() || !block.jacobian_sub) {
+			double distance = (*task)->Distance(pose);
+			error += (*task)->Weight() * distance * distance;
+		}
+	}
+
+	bool accept = (error < block.best_error);
+
+	if (accept) {
+		for (i = 0; i < block.segments.size(); i++) {
+			block.best_basis[i] = block.segments[i]->Basis(pose);
+			block.best_translation[i] = block.segments[i]->Translation(pose);
+		}
+
+		block.best_error = error;
+		block.damping = std::max(block.damping * 0.2, 1e-6);
+	}
+	else {
+		for (i = 0; i < block.segments.size(); i++) {
+			block.segments[i]->SetBasis(pose, block.best_basis[i]);
+			block.segments[i]->SetTranslation(pose, block.best_translation[i]);
+		}
+
+		block.damping = std::min(block.damping * 4.0, 1e6);
+	}
+
+	block.jacobian->SetDamping(block.damping);
+	if (block.jacobian_sub)
+		block.jacobian_sub->SetDamping(block.damping);
+
+	return accept;
+}
+
+void IK_QJacobianSolver::SetWarmStart(bool enable, double goal_epsilon)
+{
+	m_warmstart = enable;
+	m_warmstart_valid = false;
+	m_warmstart_epsilon = goal_epsilon;
+	m_warmstart_hits = 0;
+	m_warmstart_misses = 0;
+}
+
+void IK_QJacobianSolver::SaveState(const IK_QPose& pose)
+{
+	size_t i;
+
+	for (i = 0; i < m_segments.size(); i++) {
+		m_saved_basis[i] = pose.basis[i];
+		m_saved_translation[i] = pose.translation[i];
+	}
+
+	for (i = 0; i < m_tasks.size(); i++) {
+		m_saved_task_goal[i] = pose.goal[i];
+		m_saved_task_rotation[i] = pose.goal_rotation[i];
+	}
+
+	m_saved_goal = m_goal;
+	m_saved_polegoal = m_polegoal;
+	m_saved_poleangle = m_poleangle;
+
+	m_warmstart_valid = true;
+}
+
+void IK_QJacobianSolver::RestoreState(IK_QPose& pose)
+{
+	size_t i;
+
+	for (i = 0; i < m_segments.size(); i++) {
+		m_segments[i]->SetBasis(pose, m_saved_basis[i]);
+		m_segments[i]->SetTranslation(pose, m_saved_translation[i]);
+	}
+}
+
+void IK_QJacobianSolver::SaveBestPose(const IK_QPose& pose)
+{
+	size_t i;
+
+	for (i = 0; i < m_segments.size(); i++) {
+		m_best_basis[i] = pose.basis[i];
+		m_best_translation[i] = pose.translation[i];
+	}
+}
+
+void IK_QJacobianSolver::RestoreBestPose(IK_QPose& pose)
+{
+	size_t i;
+
+	for (i = 0; i < m_segments.size(); i++) {
+		m_segments[i]->SetBasis(pose, m_best_basis[i]);
+		m_segments[i]->SetTranslation(pose, m_best_translation[i]);
+	}
+}
+
+bool IK_QJacobianSolver::GoalsMoved(const IK_QPose& pose)
+{
+	size_t i;
+
+	for (i = 0; i < m_tasks.size(); i++)
+		if (m_tasks[i]->GoalDelta(pose, m_saved_task_goal[i], m_saved_task_rotation[i]) > m_warmstart_epsilon)
+			return true;
+
+	if (m_poleconstraint) {
+		if ((m_goal - m_saved_goal).norm() > m_warmstart_epsilon ||
+		    (m_polegoal - m_saved_polegoal).norm() > m_warmstart_epsilon)
+			return true;
+
+		// the pole angle is an output when it is computed by the solver
+		if (!m_getpoleangle && fabs(m_poleangle - m_saved_poleangle) > m_warmstart_epsilon)
+			return true;
+	}
+
+	return false;
+}
+
+double IK_QJacobianSolver::ComputeResidual(const IK_QPose& pose, double scale)
+{
+	// largest distance of a primary task to its goal, position tasks work
+	// in scaled coordinates and are converted back to world units
+	std::vector<IK_QTask *>::iterator task;
+	double residual = 0.0;
+
+	for (task = m_tasks.begin(); task != m_tasks.end(); task++) {
+		if (!(*task)->Primary())
+			continue;
+
+		double distance = (*task)->Distance(pose);
+		if ((*task)->PositionTask())
+			distance /= scale;
+
+		if (distance > residual)
+			residual = distance;
+	}
+
+	return residual;
+}
+
+void IK_QJacobianSolver::Begin(IK_QPose& pose, const double tolerance)
+{
+	m_solving = true;
+	m_finished = false;
+	m_solved = false;
+	m_iterating = false;
+	m_warmstart_hit = false;
+	m_deadline_hit = false;
+	m_tolerance = tolerance;
+	m_iterations = 0;
+
+	if (m_warmstart) {
+		if (m_warmstart_valid) {
+			// continue from the last converged solution, if the goals
+			// hardly moved since then that solution is still good
+			RestoreState(pose);
+
+			if (!GoalsMoved(pose)) {
+				if (m_getpoleangle)
+					m_poleangle = m_saved_poleangle;
+
+				m_warmstart_hits++;
+				m_warmstart_hit = true;
+				m_finished = m_solved = true;
+				return;
+			}
+		}
+
+		m_warmstart_misses++;
+	}
+
+	if (m_twobone_upper && SolveTwoBone(pose, tolerance, m_solved)) {
+		m_finished = true;
+		return;
+	}
+
+	m_scale = ComputeScale();
 	//double dt = analyze_time();
 
-	Scale(scale, tasks);
+	// the solver may be reused, don't accumulate the pole rotation of
+	// previous solves
+	m_rootmatrix.setIdentity();
+
+	Scale(pose, m_scale);
 
-	ConstrainPoleVector(root, tasks);
+	ConstrainPoleVector(pose, m_segments[0], m_getpoleangle);
 
-	root->UpdateTransform(m_rootmatrix);
+	UpdateTransforms(pose, true);
 
-	// iterate
-	for (int iterations = 0; iterations < max_iterations; iterations++) {
-		// update transform
-		root->UpdateTransform(m_rootmatrix);
+	m_iterating = true;
+	m_best_residual = std::numeric_limits<double>::max();
+	m_best_pose_residual = std::numeric_limits<double>::max();
+	m_stalled = 0;
+	m_stepped = false;
 
-		std::list<IK_QTask *>::iterator task;
+	std::vector<Block>::iterator block;
+
+	for (block = m_blocks.begin(); block != m_blocks.end(); block++) {
+		block->damping = 1e-3;
+		block->best_error = std::numeric_limits<double>::max();
+	}
+}
+
+bool IK_QJacobianSolver::Step(IK_QPose& pose, const int iterations, const double time_budget)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::time_point deadline;
+	bool levenberg_marquardt = (m_invert_mode == IK_QJacobian::INVERT_LM);
+	bool restored = false;
+	std::vector<Block>::iterator block;
+	int i;
+
+	if (m_finished)
+		return true;
+
+	// reading the clock is not free, batched solves step one iteration at
+	// a time without a budget
+	if (time_budget > 0.0)
+		deadline = Clock::now() + std::chrono::microseconds((long long)time_budget);
+
+	// iterate
+	for (i = 0; i < iterations; i++, m_iterations++) {
+		// update transform, only of the segments that changed in the last
+		// iteration. the root matrix doesn't change while iterating
+		UpdateTransforms(pose, false);
 
 		// compute jacobian
-		for (task = tasks.begin(); task != tasks.end(); task++) {
-			if ((*task)->Primary())
-				(*task)->ComputeJacobian(m_jacobian);
-			else
-				(*task)->ComputeJacobian(m_jacobian_sub);
+		for (block = m_blocks.begin(); block != m_blocks.end(); block++)
+			ComputeJacobian(pose, *block);
+
+		if (levenberg_marquardt) {
+			restored = false;
+
+			for (block = m_blocks.begin(); block != m_blocks.end(); block++)
+				if (!AcceptStep(pose, *block))
+					restored = true;
+
+			if (restored) {
+				UpdateTransforms(pose, false);
+
+				for (block = m_blocks.begin(); block != m_blocks.end(); block++)
+					ComputeJacobian(pose, *block);
+			}
+
+			m_stepped = false;
 		}
 
-		double norm = 0.0;
+		// check for convergence, before paying for the inversion. the
+		// orientation task distance is only known after computing the
+		// jacobian
+		double residual = ComputeResidual(pose, m_scale);
 
-		do {
-			// invert jacobian
-			try {
-				m_jacobian.Invert();
-				if (m_secondary_enabled)
-					m_jacobian.SubTask(m_jacobian_sub);
+		if (residual <= m_tolerance) {
+			m_solved = true;
+
+			if (m_iterations >= m_min_iterations) {
+				m_finished = true;
+				break;
 			}
-			catch (...) {
-				fprintf(stderr, "IK Exception\n");
-				return false;
+		}
+		else
+			m_solved = false;
+
+		bool progress = (residual < m_best_residual * (1.0 - m_stall_ratio));
+		if (progress)
+			m_best_residual = residual;
+
+		// iterations don't reduce the residual monotonically, so when the
+		// time runs out or the solver stalls fall back to the best pose seen
+		// instead of the last. without a budget the solve ends on the last
+		// pose as it always did, and saving poses is not worth its cost
+		if (time_budget > 0.0 && residual < m_best_pose_residual) {
+			m_best_pose_residual = residual;
+			SaveBestPose(pose);
+		}
+
+		if (time_budget > 0.0 && Clock::now() >= deadline) {
+			if (residual > m_best_pose_residual) {
+				RestoreBestPose(pose);
+				UpdateTransforms(pose, false);
 			}
 
-			// update angles and check limits
-		} while (UpdateAngles(norm));
+			m_solved = (m_best_pose_residual <= m_tolerance);
+			m_deadline_hit = true;
+			m_finished = true;
+			break;
+		}
 
-		// unlock segments again after locking in clamping loop
-		std::vector<IK_QSegment *>::iterator seg;
-		for (seg = m_segments.begin(); seg != m_segments.end(); seg++)
-			(*seg)->UnLock();
+		double norm = 0.0;
 
-		// compute angle update norm
-		double maxnorm = m_jacobian.AngleUpdateNorm();
-		if (maxnorm > norm)
-			norm = maxnorm;
+		for (block = m_blocks.begin(); block != m_blocks.end(); block++) {
+			do {
+				// invert jacobian
+				try {
+					block->jacobian->Invert();
+					if (block->jacobian_sub)
+						block->jacobian->SubTask(*block->jacobian_sub);
+				}
+				catch (...) {
+					fprintf(stderr, "IK Exception\n");
+					m_solved = false;
+					m_finished = true;
+					return true;
+				}
 
-		// check for convergence
-		if (norm < 1e-3 && iterations > 10) {
-			solved = true;
+				// update angles and check limits
+			} while (UpdateAngles(pose, *block, norm));
+
+			// unlock segments again after locking in clamping loop
+			std::vector<IK_QSegment *>::iterator seg;
+			for (seg = block->segments.begin(); seg != block->segments.end(); seg++)
+				(*seg)->UnLock(pose);
+
+			// compute angle update norm
+			double maxnorm = block->jacobian->AngleUpdateNorm();
+			if (maxnorm > norm)
+				norm = maxnorm;
+		}
+
+		m_stepped = true;
+
+		// the solver stalled when the residual does not decrease and the
+		// angles hardly change anymore, the goal is out of reach or blocked
+		// by joint limits. levenberg-marquardt only keeps looking while it
+		// is undoing steps, accepted steps that don't help count as stalled
+		if (progress || (norm >= 1e-3 && (!levenberg_marquardt || restored)))
+			m_stalled = 0;
+		else if (++m_stalled >= m_stall_iterations && m_iterations + 1 >= m_min_iterations) {
+			if (time_budget > 0.0) {
+				// the last step was not evaluated, and the ones before it
+				// did not improve on the best pose
+				RestoreBestPose(pose);
+				UpdateTransforms(pose, false);
+
+				m_solved = (m_best_pose_residual <= m_tolerance);
+				m_stepped = false;
+			}
+
+			m_iterations++;
+			m_finished = true;
 			break;
 		}
 	}
 
-	if (m_poleconstraint)
-		root->PrependBasis(m_rootmatrix.linear());
+	return m_finished;
+}
+
+bool IK_QJacobianSolver::End(IK_QPose& pose)
+{
+	if (m_iterating) {
+		bool levenberg_marquardt = (m_invert_mode == IK_QJacobian::INVERT_LM);
+
+		if (levenberg_marquardt && m_stepped) {
+			// the last step was not checked yet, keep it only if it is better
+			std::vector<Block>::iterator block;
+			bool restored = false;
+
+			UpdateTransforms(pose, false);
+
+			for (block = m_blocks.begin(); block != m_blocks.end(); block++) {
+				ComputeJacobian(pose, *block);
+				if (!AcceptStep(pose, *block))
+					restored = true;
+			}
+
+			if (!restored)
+				m_solved = (ComputeResidual(pose, m_scale) <= m_tolerance);
+		}
+
+		if (m_poleconstraint)
+			m_segments[0]->PrependBasis(pose, m_rootmatrix.linear());
 
-	Scale(1.0f / scale, tasks);
+		Scale(pose, 1.0f / m_scale);
+	}
+
+	if (m_warmstart && m_solved && !m_warmstart_hit)
+		SaveState(pose);
 
 	//analyze_add_run(max_iterations, analyze_time()-dt);
 
-	return solved;
+	m_solving = false;
+	m_iterating = false;
+
+	return m_solved;
+}
+
+bool IK_QJacobianSolver::Solve(
+    IK_QPose& pose,
+    const double tolerance,
+    const int max_iterations,
+    const double time_budget
+    )
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// the time budget includes Begin, which may restore the warm start
+	// pose, solve a two bone chain, scale the rig and rotate for the pole
+	Clock::time_point start = Clock::now();
+
+	Begin(pose, tolerance);
+
+	double budget = 0.0;
+
+	if (time_budget > 0.0) {
+		double elapsed = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+		// a budget of 0 would mean no budget, with the time used up Step
+		// still evaluates the pose once
+		budget = std::max(time_budget - elapsed, 1e-3);
+	}
+
+	Step(pose, max_iterations, budget);
+
+	return End(pose);
 }
 
+int IK_QJacobianSolver::SolveBatch(
+    const std::vector<IK_QJacobianSolver *>& solvers,
+    const std::vector<IK_QPose *>& poses,
+    const double tolerance,
+    const int max_iterations
+    )
+{
+	std::vector<IK_QJacobianSolver *> active;
+	std::vector<IK_QPose *> active_poses;
+	std::vector<const Affine3d *> roots;
+	int count = (int)solvers.size();
+	int i, n, solved = 0;
+
+	if (count == 0)
+		return 0;
+
+	active.reserve(count);
+	active_poses.reserve(count);
+	roots.reserve(count);
+
+	for (n = 0; n < count; n++)
+		solvers[n]->Begin(*poses[n], tolerance);
+
+	for (i = 0; i < max_iterations; i++) {
+		active.clear();
+		active_poses.clear();
+		roots.clear();
+
+		for (n = 0; n < count; n++) {
+			if (!solvers[n]->m_finished) {
+				active.push_back(solvers[n]);
+				active_poses.push_back(poses[n]);
+				roots.push_back(&solvers[n]->m_rootmatrix);
+			}
+		}
+
+		if (active.empty())
+			break;
+
+		// update the transforms of all poses together, the update at the
+		// start of each step then finds nothing changed
+		active[0]->m_skeleton->UpdateTransforms(active_poses, roots, false);
+
+		for (n = 0; n < (int)active.size(); n++)
+			active[n]->Step(*active_poses[n], 1, 0.0);
+	}
+
+	for (n = 0; n < count; n++)
+		if (solvers[n]->End(*poses[n]))
+			solved++;
+
+	return solved;
+}
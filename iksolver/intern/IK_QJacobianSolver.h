@@ -37,11 +37,12 @@
  * @date 28/6/2001
  */
 
+#include <chrono>
 #include <vector>
-#include <list>
 
 #include "IK_Math.h"
 #include "IK_QJacobian.h"
+#include "IK_QPose.h"
 #include "IK_QSegment.h"
 #include "IK_QTask.h"
 
@@ -49,40 +50,152 @@ class IK_QJacobianSolver
 {
 public:
 	IK_QJacobianSolver();
-	~IK_QJacobianSolver() {}
+	~IK_QJacobianSolver();
 
 	// setup pole vector constraint
 	void SetPoleVectorConstraint(IK_QSegment *tip, Vector3d& goal,
 		Vector3d& polegoal, float poleangle, bool getangle);
 	float GetPoleAngle() { return m_poleangle; }
 
-	// call setup once before solving, if it fails don't solve
-	bool Setup(IK_QSegment *root, std::list<IK_QTask*>& tasks);
+	// the segment the pole vector constraint is set on, if any
+	IK_QSegment *PoleTip() const
+	{ return (m_poleconstraint) ? m_poletip : NULL; }
 
-	// returns true if converged, false if max number of iterations was used
+	// copy the settings of another solver, to set up on the same skeleton.
+	// warm start isn't copied
+	void CopySettings(const IK_QJacobianSolver& other);
+
+	// call setup once before solving, if it fails don't solve. the solver
+	// can be reused for multiple solves without calling setup again, as
+	// long as the skeleton is not set up again. the skeleton must outlive
+	// the solver, and its segments and tasks are only read while solving,
+	// the state of a solve is kept in the pose
+	bool Setup(const IK_QSkeleton& skeleton);
+
+	// normalize the user weights of the tasks, Setup does this already,
+	// call again only after changing task weights of a set up solver
+	bool UpdateTaskWeights();
+
+	// minimum number of iterations, and the number of iterations that the
+	// residual may fail to decrease by stall_ratio before giving up
+	void SetConvergence(int min_iterations, int stall_iterations, double stall_ratio);
+
+	// method used to invert the jacobian, SDLS by default
+	void SetInvertMode(IK_QJacobian::InvertMode mode);
+
+	// precision of the jacobian, double by default. takes effect on the
+	// next Setup
+	void SetPrecision(IK_QJacobian::Precision precision);
+
+	// arena the jacobians are allocated in, NULL for the heap. takes effect
+	// on the next Setup, the arena must outlive the solver
+	void SetArena(IK_QArena *arena);
+
+	// number of iterations used by the last solve
+	int Iterations() const { return m_iterations; }
+
+	// the last solve ran out of its time budget
+	bool DeadlineHit() const { return m_deadline_hit; }
+
+	// start each solve from the last converged solution, and skip solving
+	// when no goal moved more than goal_epsilon since then
+	void SetWarmStart(bool enable, double goal_epsilon);
+	int WarmStartHits() const { return m_warmstart_hits; }
+	int WarmStartMisses() const { return m_warmstart_misses; }
+
+	// returns true if all primary tasks are within tolerance of their goal,
+	// false if the max number of iterations was used or the solver stalled.
+	// with a time budget in microseconds (0 for none), which starts before
+	// Begin, the clock is checked between iterations. when it runs out or
+	// the solver stalls the pose with the smallest residual so far is
+	// restored. without a budget a stalled solve ends on its last pose
 	bool Solve(
-		IK_QSegment *root,
-		std::list<IK_QTask*> tasks,
+		IK_QPose& pose,
+		const double tolerance,
+		const int max_iterations,
+		const double time_budget
+	);
+
+	// the same solve in parts, to spread it over several frames. Begin sets
+	// up the solve, Step runs up to the given number of iterations and
+	// returns true once no more are needed, End finishes the solve and
+	// returns true if it converged. the scale, pole rotation and
+	// convergence state are kept in between, so the goals must not change
+	// until End
+	void Begin(IK_QPose& pose, const double tolerance);
+	bool Step(IK_QPose& pose, const int iterations, const double time_budget);
+	bool End(IK_QPose& pose);
+
+	// Begin was called, and End not yet
+	bool Solving() const { return m_solving; }
+
+	// solve several solvers as Solve does without a time budget, in
+	// lockstep, one iteration of each in turn. the solvers must be set up
+	// on skeletons with the same topology, whose poses are then updated in
+	// one pass over the segments per iteration, interleaved per segment.
+	// returns the number of solvers that converged
+	static int SolveBatch(
+		const std::vector<IK_QJacobianSolver*>& solvers,
+		const std::vector<IK_QPose*>& poses,
 		const double tolerance,
 		const int max_iterations
 	);
 
 private:
-	void AddSegmentList(IK_QSegment *seg);
-	bool UpdateAngles(double& norm);
-	void ConstrainPoleVector(IK_QSegment *root, std::list<IK_QTask*>& tasks);
+	// tasks that share DoFs, solved with a jacobian over only the segments
+	// they depend on. tasks that share no DoFs end up in separate blocks,
+	// so e.g. the limbs of a character with a fixed root are decomposed and
+	// inverted separately. only truly disjoint blocks are split: a single
+	// shared DoF, like a free root, joins all tasks into one dense block.
+	// a block sparse structure with the root as border block could skip the
+	// zero products between limbs, but is not implemented, such rigs are
+	// solved as one dense jacobian as before
+	struct Block {
+		IK_QJacobian *jacobian;
+		IK_QJacobian *jacobian_sub;
+		std::vector<IK_QSegment*> segments;
+		std::vector<IK_QTask*> tasks;
+
+		// the segments again by type, for updates without virtual calls
+		std::vector<IK_QSegment*> joints[IK_QSegment::NUM_JOINT_TYPES];
+
+		// levenberg-marquardt damping, and the pose with the smallest error
+		// found so far, which steps that don't reduce the error return to
+		double damping;
+		double best_error;
+		std::vector<Matrix3d> best_basis;
+		std::vector<Vector3d> best_translation;
+	};
+
+	void UpdateTransforms(IK_QPose& pose, bool all);
+	bool SetupBlocks();
+	void SetupBlock(Block& block);
+	void FreeBlocks();
+	bool UpdateAngles(IK_QPose& pose, Block& block, double& norm);
+	void ComputeJacobian(IK_QPose& pose, Block& block);
+	bool AcceptStep(IK_QPose& pose, Block& block);
+	void ConstrainPoleVector(IK_QPose& pose, IK_QSegment *root, bool getangle);
+
+	void SetupTwoBone();
+	bool SolveTwoBone(IK_QPose& pose, double tolerance, bool& solved);
 
 	double ComputeScale();
-	void Scale(double scale, std::list<IK_QTask*>& tasks);
+	double ComputeResidual(const IK_QPose& pose, double scale);
 
-private:
+	void SaveState(const IK_QPose& pose);
+	void RestoreState(IK_QPose& pose);
+	void SaveBestPose(const IK_QPose& pose);
+	void RestoreBestPose(IK_QPose& pose);
+	bool GoalsMoved(const IK_QPose& pose);
+	void Scale(IK_QPose& pose, double scale);
 
-	IK_QJacobian m_jacobian;
-	IK_QJacobian m_jacobian_sub;
+private:
 
-	bool m_secondary_enabled;
+	std::vector<Block> m_blocks;
 
+	const IK_QSkeleton *m_skeleton;
 	std::vector<IK_QSegment*> m_segments;
+	std::vector<IK_QTask*> m_tasks;
 
 	Affine3d m_rootmatrix;
 
@@ -92,5 +205,52 @@ private:
 	Vector3d m_polegoal;
 	float m_poleangle;
 	IK_QSegment *m_poletip;
+
+	// a chain of a ball joint and a hinge with one position goal, which
+	// together with a pole vector constraint is solved in closed form
+	IK_QSegment *m_twobone_upper;
+	IK_QSegment *m_twobone_lower;
+	IK_QPositionTask *m_twobone_task;
+
+	int m_min_iterations;
+	int m_stall_iterations;
+	double m_stall_ratio;
+	int m_iterations;
+	bool m_deadline_hit;
+
+	// state of the solve between Begin and End. iterating is false when
+	// the solve was finished by the warm start or in closed form
+	bool m_solving;
+	bool m_iterating;
+	bool m_finished;
+	bool m_solved;
+	bool m_warmstart_hit;
+	bool m_stepped;
+	double m_tolerance;
+	float m_scale;
+	double m_best_residual;
+	double m_best_pose_residual;
+	int m_stalled;
+
+	// pose with the smallest residual, kept while solving with a deadline
+	std::vector<Matrix3d> m_best_basis;
+	std::vector<Vector3d> m_best_translation;
+
+	IK_QJacobian::InvertMode m_invert_mode;
+	IK_QJacobian::Precision m_precision;
+	IK_QArena *m_arena;
+
+	// last converged solution and the goals it was solved for
+	bool m_warmstart;
+	bool m_warmstart_valid;
+	double m_warmstart_epsilon;
+	int m_warmstart_hits, m_warmstart_misses;
+	std::vector<Matrix3d> m_saved_basis;
+	std::vector<Vector3d> m_saved_translation;
+	std::vector<Vector3d> m_saved_task_goal;
+	std::vector<Matrix3d> m_saved_task_rotation;
+	Vector3d m_saved_goal;
+	Vector3d m_saved_polegoal;
+	float m_saved_poleangle;
 };
 
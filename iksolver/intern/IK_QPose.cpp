@@ -0,0 +1,202 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/intern/IK_QPose.cpp
+ *  \ingroup iksolver
+ */
+
+
+#include "IK_QPose.h"
+#include "IK_QSegment.h"
+#include "IK_QTask.h"
+
+// IK_QSkeleton
+
+static void AddSegments(IK_QSegment *seg, int parent, std::vector<IK_QSegment *>& segments,
+                        std::vector<int>& parents)
+{
+	int index = (int)segments.size();
+
+	seg->SetIndex(index);
+	segments.push_back(seg);
+	parents.push_back(parent);
+
+	for (IK_QSegment *child = seg->Child(); child; child = child->Sibling())
+		AddSegments(child, index, segments, parents);
+}
+
+void IK_QSkeleton::Setup(IK_QSegment *root, std::list<IK_QTask *>& tasks)
+{
+	std::list<IK_QTask *>::iterator task;
+
+	m_segments.clear();
+	m_parent.clear();
+	m_tasks.clear();
+
+	AddSegments(root, -1, m_segments, m_parent);
+
+	for (task = tasks.begin(); task != tasks.end(); task++) {
+		(*task)->SetIndex((int)m_tasks.size());
+		m_tasks.push_back(*task);
+	}
+}
+
+void IK_QSkeleton::UpdateTransforms(IK_QPose& pose, const Affine3d& root, bool all) const
+{
+	// parents come before their children, so their transform is up to date
+	// when getting to the children. segments that no goal depends on, and
+	// locked or converged joints, keep their transform between iterations
+	int i, num = (int)m_parent.size();
+
+	for (i = 0; i < num; i++) {
+		int parent = m_parent[i];
+		bool changed;
+
+		if (parent == -1) {
+			changed = all || pose.dirty[i];
+
+			if (changed)
+				pose.UpdateSegmentTransform(i, root);
+		}
+		else {
+			changed = pose.changed[parent] || pose.dirty[i];
+
+			if (changed)
+				pose.UpdateSegmentTransform(i, pose.global_transform[parent]);
+		}
+
+		pose.changed[i] = changed;
+	}
+}
+
+void IK_QSkeleton::UpdateTransforms(const std::vector<IK_QPose *>& poses,
+                                    const std::vector<const Affine3d *>& roots, bool all) const
+{
+	int i, p, num = (int)m_parent.size(), count = (int)poses.size();
+
+	for (i = 0; i < num; i++) {
+		int parent = m_parent[i];
+
+		for (p = 0; p < count; p++) {
+			IK_QPose& pose = *poses[p];
+			bool changed;
+
+			if (parent == -1) {
+				changed = all || pose.dirty[i];
+
+				if (changed)
+					pose.UpdateSegmentTransform(i, *roots[p]);
+			}
+			else {
+				changed = pose.changed[parent] || pose.dirty[i];
+
+				if (changed)
+					pose.UpdateSegmentTransform(i, pose.global_transform[parent]);
+			}
+
+			pose.changed[i] = changed;
+		}
+	}
+}
+
+void IK_QSkeleton::ReadPose(IK_QPose& pose) const
+{
+	int i;
+
+	for (i = 0; i < (int)m_segments.size(); i++)
+		m_segments[i]->ReadPose(pose);
+
+	for (i = 0; i < (int)m_tasks.size(); i++)
+		m_tasks[i]->ReadGoal(pose);
+
+	pose.scale = 1.0;
+}
+
+void IK_QSkeleton::WritePose(const IK_QPose& pose) const
+{
+	int i;
+
+	for (i = 0; i < (int)m_segments.size(); i++)
+		m_segments[i]->WritePose(pose);
+}
+
+// IK_QPose
+
+void IK_QPose::Resize(const IK_QSkeleton& skeleton)
+{
+	int num = skeleton.NumSegments();
+	int num_tasks = skeleton.NumTasks();
+
+	start.resize(num);
+	rest_basis.resize(num);
+	basis.resize(num);
+	translation.resize(num);
+
+	global_start.resize(num);
+	global_transform.resize(num);
+	dirty.assign(num, true);
+	changed.assign(num, true);
+
+	axis.assign(num * 3, Vector3d(0, 0, 0));
+	axes_dirty.assign(num, true);
+
+	locked.assign(num * 3, false);
+	locked_angle.assign(num, Vector3d(0, 0, 0));
+
+	angle.assign(num * 2, 0.0);
+	new_angle.assign(num * 2, 0.0);
+	new_basis.assign(num, Matrix3d::Identity());
+	new_translation.assign(num, Vector3d(0, 0, 0));
+
+	clamped.assign(num, false);
+	clamp.assign(num * 3, false);
+	delta.assign(num, Vector3d(0, 0, 0));
+
+	goal.assign(num_tasks, Vector3d(0, 0, 0));
+	goal_rotation.assign(num_tasks, Matrix3d::Identity());
+	distance.assign(num_tasks, 0.0);
+}
+
+void IK_QPose::Scale(double s)
+{
+	size_t i;
+
+	for (i = 0; i < start.size(); i++) {
+		start[i] *= s;
+		translation[i] *= s;
+		global_start[i] *= s;
+		global_transform[i].translation() *= s;
+		new_translation[i] *= s;
+		dirty[i] = true;
+	}
+
+	for (i = 0; i < goal.size(); i++)
+		goal[i] *= s;
+
+	scale *= s;
+}
@@ -0,0 +1,183 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/intern/IK_QPose.h
+ *  \ingroup iksolver
+ */
+
+#pragma once
+
+#include "IK_Math.h"
+
+#include <list>
+#include <vector>
+
+class IK_QPose;
+class IK_QSegment;
+class IK_QTask;
+
+/**
+ * The segment tree and tasks of a solver compiled into flat arrays, with
+ * the segments sorted parents before children. Segments and tasks are
+ * numbered in this order, and their state while solving is kept at that
+ * index in an IK_QPose. The skeleton and its segments are only read while
+ * solving, so one skeleton can be solved for several poses.
+ */
+
+class IK_QSkeleton
+{
+public:
+	// number the segments of the tree and the tasks, call again when the
+	// tree or the list of tasks changes
+	void Setup(IK_QSegment *root, std::list<IK_QTask*>& tasks);
+
+	int NumSegments() const
+	{ return (int)m_segments.size(); }
+
+	int NumTasks() const
+	{ return (int)m_tasks.size(); }
+
+	// segments in tree order, the first is the root
+	const std::vector<IK_QSegment*>& Segments() const
+	{ return m_segments; }
+
+	// index of the parent of a segment, -1 for the root
+	int Parent(int seg) const
+	{ return m_parent[seg]; }
+
+	const std::vector<IK_QTask*>& Tasks() const
+	{ return m_tasks; }
+
+	// update the global transforms of the pose in a single pass over the
+	// arrays, with root as the transform of the parent of the root. unless
+	// all are updated, only segments that changed since the last update
+	// and their children are
+	void UpdateTransforms(IK_QPose& pose, const Affine3d& root, bool all) const;
+
+	// the same for several poses at once, of this skeleton or others with
+	// the same topology, with roots[i] the root transform of poses[i]. the
+	// poses are interleaved per segment, so the chains of different poses
+	// don't wait on each other
+	void UpdateTransforms(const std::vector<IK_QPose*>& poses,
+	                      const std::vector<const Affine3d*>& roots, bool all) const;
+
+	// the skeletons have the same parent of each segment, so their poses
+	// can be updated together
+	bool SameTopology(const IK_QSkeleton& other) const
+	{ return m_parent == other.m_parent; }
+
+	// copy the transforms of the segments and the goals of the tasks into
+	// the pose before solving, and the solved pose back to the segments
+	void ReadPose(IK_QPose& pose) const;
+	void WritePose(const IK_QPose& pose) const;
+
+private:
+	std::vector<IK_QSegment*> m_segments;
+	std::vector<int> m_parent;
+	std::vector<IK_QTask*> m_tasks;
+};
+
+/**
+ * The state of a skeleton while solving, as arrays indexed by segment and
+ * task. Segments with several DoFs use three entries per segment for the
+ * per DoF arrays, and two for the angles of hinges and elbows.
+ */
+
+class IK_QPose
+{
+public:
+	IK_QPose() : scale(1.0) {}
+
+	// size the arrays for the skeleton, solving doesn't allocate after this
+	void Resize(const IK_QSkeleton& skeleton);
+
+	// scale the translations and goals, the solver works with the rig
+	// scaled to unit size
+	void Scale(double s);
+
+	// compute the global transform at the end of a segment, given that of
+	// its parent
+	void UpdateSegmentTransform(int seg, const Affine3d& global)
+	{
+		global_start[seg] = global.translation() + global.linear() * start[seg];
+
+		Affine3d& transform = global_transform[seg];
+		transform.translation() = global_start[seg];
+		transform.linear() = global.linear() * rest_basis[seg] * basis[seg];
+		transform.translate(translation[seg]);
+
+		dirty[seg] = false;
+		axes_dirty[seg] = true;
+	}
+
+	double scale;
+
+	// full transform of a segment =
+	// start * rest_basis * basis * translation
+	std::vector<Vector3d> start;
+	std::vector<Matrix3d> rest_basis;
+	std::vector<Matrix3d> basis;
+	std::vector<Vector3d> translation;
+
+	// accumulated transformations starting from root. dirty is set when
+	// the transform of a segment changed since the last update, changed
+	// when the last update recomputed it
+	std::vector<Vector3d> global_start;
+	std::vector<Affine3d, Eigen::aligned_allocator<Affine3d> > global_transform;
+	std::vector<char> dirty;
+	std::vector<char> changed;
+
+	// global derivative axes of the DoFs, and whether the transform
+	// changed since they were computed
+	std::vector<Vector3d> axis;
+	std::vector<char> axes_dirty;
+
+	// DoFs locked in the clamping loop, and the clamped swing and twist
+	// parameters of locked ball joints
+	std::vector<char> locked;
+	std::vector<Vector3d> locked_angle;
+
+	// hinge and elbow angles, and the update computed by UpdateAngle that
+	// UpdateAngleApply applies
+	std::vector<double> angle;
+	std::vector<double> new_angle;
+	std::vector<Matrix3d> new_basis;
+	std::vector<Vector3d> new_translation;
+
+	// the limit violations found by the batched UpdateAngles, per segment
+	// whether any DoF was clamped, per DoF whether it was and by how much
+	std::vector<char> clamped;
+	std::vector<char> clamp;
+	std::vector<Vector3d> delta;
+
+	// goals of the tasks, and the distance to the goal for tasks that
+	// compute it with the jacobian
+	std::vector<Vector3d> goal;
+	std::vector<Matrix3d> goal_rotation;
+	std::vector<double> distance;
+};
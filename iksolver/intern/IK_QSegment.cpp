@@ -35,11 +35,10 @@
 
 // IK_QSegment
 
-IK_QSegment::IK_QSegment(int num_DoF, bool translational)
-	: m_parent(NULL), m_child(NULL), m_sibling(NULL), m_composite(NULL),
+IK_QSegment::IK_QSegment(JointType type, int num_DoF, bool translational)
+	: m_type(type), m_parent(NULL), m_child(NULL), m_sibling(NULL), m_composite(NULL),
 	m_num_DoF(num_DoF), m_translational(translational)
 {
-	m_locked[0] = m_locked[1] = m_locked[2] = false;
 	m_weight[0] = m_weight[1] = m_weight[2] = 1.0;
 
 	m_max_extension = 0.0;
@@ -48,15 +47,20 @@ IK_QSegment::IK_QSegment(int num_DoF, bool translational)
 	m_rest_basis.setIdentity();
 	m_basis.setIdentity();
 	m_translation = Vector3d(0, 0, 0);
+	m_angle[0] = m_angle[1] = 0.0;
 
 	m_orig_basis = m_basis;
 	m_orig_translation = m_translation;
+
+	m_global_start = Vector3d(0, 0, 0);
+	m_global_transform.setIdentity();
+
+	m_index = 0;
+	m_DoF_id = 0;
 }
 
 void IK_QSegment::Reset()
 {
-	m_locked[0] = m_locked[1] = m_locked[2] = false;
-
 	m_basis = m_orig_basis;
 	m_translation = m_orig_translation;
 	SetBasis(m_basis);
@@ -155,31 +159,161 @@ void IK_QSegment::UpdateTransform(const Affine3d& global)
 		seg->UpdateTransform(m_global_transform);
 }
 
-void IK_QSegment::PrependBasis(const Matrix3d& mat)
+void IK_QSegment::ReadPose(IK_QPose& pose) const
+{
+	int i = m_index;
+
+	pose.start[i] = m_start;
+	pose.rest_basis[i] = m_rest_basis;
+	pose.basis[i] = m_basis;
+	pose.translation[i] = m_translation;
+	pose.global_start[i] = m_global_start;
+	pose.global_transform[i] = m_global_transform;
+	pose.angle[i * 2] = m_angle[0];
+	pose.angle[i * 2 + 1] = m_angle[1];
+
+	pose.dirty[i] = true;
+	pose.axes_dirty[i] = true;
+	pose.locked[i * 3] = pose.locked[i * 3 + 1] = pose.locked[i * 3 + 2] = false;
+}
+
+void IK_QSegment::WritePose(const IK_QPose& pose)
+{
+	int i = m_index;
+
+	// the solver only changes the translation of translational segments,
+	// the others keep theirs exactly instead of scaled and unscaled
+	m_basis = pose.basis[i];
+	if (m_translational)
+		m_translation = pose.translation[i];
+	m_angle[0] = pose.angle[i * 2];
+	m_angle[1] = pose.angle[i * 2 + 1];
+
+	m_global_start = pose.global_start[i];
+	m_global_transform = pose.global_transform[i];
+}
+
+void IK_QSegment::ReadPose(IK_QPose& pose, const Matrix3d& basis) const
+{
+	ReadPose(pose);
+
+	pose.translation[m_index] = m_orig_translation;
+	SetBasis(pose, basis);
+}
+
+Vector3d IK_QSegment::TranslationChange(const IK_QPose& pose) const
+{
+	// the same as WritePose, only translational segments are solved
+	if (!m_translational)
+		return Vector3d(0, 0, 0);
+
+	return pose.translation[m_index] - m_orig_translation;
+}
+
+bool IK_QSegment::UpdateAngle(IK_QPose& pose, const IK_QJacobian& jacobian, Vector3d& delta, bool *clamp) const
+{
+	Vector3d dq(0.0, 0.0, 0.0);
+	int i;
+
+	for (i = 0; i < m_num_DoF; i++)
+		dq[i] = jacobian.AngleUpdate(m_DoF_id + i);
+
+	return UpdateAngle(pose, dq, delta, clamp);
+}
+
+Vector3d IK_QSegment::ReachUpdate(const IK_QPose& pose, const Vector3d& from, const Vector3d& to) const
+{
+	Vector3d dq(0.0, 0.0, 0.0);
+	int i;
+
+	if (m_translational) {
+		for (i = 0; i < m_num_DoF; i++)
+			dq[i] = Axis(pose, i).dot(to - from);
+	}
+	else if (m_num_DoF == 1) {
+		// rotate the projections of both points on the plane of the hinge
+		// onto each other
+		Vector3d axis = Axis(pose, 0);
+		Vector3d f = from - axis * axis.dot(from);
+		Vector3d t = to - axis * axis.dot(to);
+
+		dq[0] = atan2(axis.dot(f.cross(t)), f.dot(t));
+	}
+	else {
+		// shortest rotation between the two
+		Vector3d w = from.cross(to);
+		double sine = w.norm();
+
+		if (!FuzzyZero(sine))
+			dq = RotationUpdate(pose, w * (atan2(sine, from.dot(to)) / sine));
+	}
+
+	return dq;
+}
+
+Vector3d IK_QSegment::RotationUpdate(const IK_QPose& pose, const Vector3d& rotation) const
+{
+	Vector3d dq(0.0, 0.0, 0.0);
+	int i;
+
+	if (m_translational)
+		return dq;
+
+	for (i = 0; i < m_num_DoF; i++)
+		dq[i] = Axis(pose, i).dot(rotation);
+
+	return dq;
+}
+
+void IK_QSegment::SetBasis(const Matrix3d& basis)
+{
+	m_basis = basis;
+	ProjectBasis(m_basis, m_angle);
+}
+
+void IK_QSegment::SetBasis(IK_QPose& pose, const Matrix3d& basis) const
+{
+	pose.basis[m_index] = basis;
+	ProjectBasis(pose.basis[m_index], &pose.angle[m_index * 2]);
+	pose.dirty[m_index] = true;
+}
+
+void IK_QSegment::ApplyBasis(IK_QPose& pose, const Matrix3d& basis) const
 {
-	m_basis = m_rest_basis.inverse() * mat * m_rest_basis * m_basis;
+	// compared exactly, skipping small changes would let the global
+	// transforms drift away from the basis over the iterations
+	if (basis != pose.basis[m_index]) {
+		pose.basis[m_index] = basis;
+		pose.dirty[m_index] = true;
+	}
 }
 
-void IK_QSegment::Scale(double scale)
+void IK_QSegment::ApplyTranslation(IK_QPose& pose, const Vector3d& translation) const
 {
-	m_start *= scale;
-	m_translation *= scale;
-	m_orig_translation *= scale;
-	m_global_start *= scale;
-	m_global_transform.translation() *= scale;
-	m_max_extension *= scale;
+	if (translation != pose.translation[m_index]) {
+		pose.translation[m_index] = translation;
+		pose.dirty[m_index] = true;
+	}
+}
+
+void IK_QSegment::PrependBasis(IK_QPose& pose, const Matrix3d& mat) const
+{
+	Matrix3d& basis = pose.basis[m_index];
+
+	basis = m_rest_basis.inverse() * mat * m_rest_basis * basis;
+	pose.dirty[m_index] = true;
 }
 
 // IK_QSphericalSegment
 
 IK_QSphericalSegment::IK_QSphericalSegment()
-	: IK_QSegment(3, false), m_limit_x(false), m_limit_y(false), m_limit_z(false)
+	: IK_QSegment(JOINT_SPHERICAL, 3, false), m_limit_x(false), m_limit_y(false), m_limit_z(false)
 {
 }
 
-Vector3d IK_QSphericalSegment::Axis(int dof) const
+Vector3d IK_QSphericalSegment::Axis(const IK_QPose& pose, int dof) const
 {
-	return m_global_transform.linear().col(dof);
+	return pose.global_transform[m_index].linear().col(dof);
 }
 
 void IK_QSphericalSegment::SetLimit(int axis, double lmin, double lmax)
@@ -222,15 +356,15 @@ void IK_QSphericalSegment::SetWeight(int axis, double weight)
 	m_weight[axis] = weight;
 }
 
-bool IK_QSphericalSegment::UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta, bool *clamp)
+bool IK_QSphericalSegment::UpdateAngle(IK_QPose& pose, const Vector3d& dq, Vector3d& delta, bool *clamp) const
 {
-	if (m_locked[0] && m_locked[1] && m_locked[2])
-		return false;
+	const char *locked = &pose.locked[m_index * 3];
+	const Matrix3d& basis = pose.basis[m_index];
+	Matrix3d& new_basis = pose.new_basis[m_index];
+	Vector3d& locked_angle = pose.locked_angle[m_index];
 
-	Vector3d dq;
-	dq.x() = jacobian.AngleUpdate(m_DoF_id);
-	dq.y() = jacobian.AngleUpdate(m_DoF_id + 1);
-	dq.z() = jacobian.AngleUpdate(m_DoF_id + 2);
+	if (locked[0] && locked[1] && locked[2])
+		return false;
 
 	// Directly update the rotation matrix, with Rodrigues' rotation formula,
 	// to avoid singularities and allow smooth integration.
@@ -260,23 +394,23 @@ bool IK_QSphericalSegment::UpdateAngle(const IK_QJacobian &jacobian, Vector3d& d
 		    zsine + xycosine, cosine + yycosine, -xsine + yzcosine,
 		    -ysine + xzcosine, xsine + yzcosine, cosine + zzcosine);
 
-		m_new_basis = m_basis * M;
+		new_basis = basis * M;
 	}
 	else
-		m_new_basis = m_basis;
+		new_basis = basis;
 
 	
 	if (m_limit_y == false && m_limit_x == false && m_limit_z == false)
 		return false;
 
-	Vector3d a = SphericalRangeParameters(m_new_basis);
+	Vector3d a = SphericalRangeParameters(new_basis);
 
-	if (m_locked[0])
-		a.x() = m_locked_ax;
-	if (m_locked[1])
-		a.y() = m_locked_ay;
-	if (m_locked[2])
-		a.z() = m_locked_az;
+	if (locked[0])
+		a.x() = locked_angle.x();
+	if (locked[1])
+		a.y() = locked_angle.y();
+	if (locked[2])
+		a.z() = locked_angle.z();
 
 	double ax = a.x(), ay = a.y(), az = a.z();
 
@@ -319,110 +453,117 @@ bool IK_QSphericalSegment::UpdateAngle(const IK_QJacobian &jacobian, Vector3d& d
 	}
 
 	if (clamp[0] == false && clamp[1] == false && clamp[2] == false) {
-		if (m_locked[0] || m_locked[1] || m_locked[2])
-			m_new_basis = ComputeSwingMatrix(ax, az) * ComputeTwistMatrix(ay);
+		if (locked[0] || locked[1] || locked[2])
+			new_basis = ComputeSwingMatrix(ax, az) * ComputeTwistMatrix(ay);
 		return false;
 	}
 	
-	m_new_basis = ComputeSwingMatrix(ax, az) * ComputeTwistMatrix(ay);
+	new_basis = ComputeSwingMatrix(ax, az) * ComputeTwistMatrix(ay);
 
-	delta = MatrixToAxisAngle(m_basis.transpose() * m_new_basis);
+	delta = MatrixToAxisAngle(basis.transpose() * new_basis);
 
-	if (!(m_locked[0] || m_locked[2]) && (clamp[0] || clamp[2])) {
-		m_locked_ax = ax;
-		m_locked_az = az;
+	if (!(locked[0] || locked[2]) && (clamp[0] || clamp[2])) {
+		locked_angle.x() = ax;
+		locked_angle.z() = az;
 	}
 
-	if (!m_locked[1] && clamp[1])
-		m_locked_ay = ay;
+	if (!locked[1] && clamp[1])
+		locked_angle.y() = ay;
 	
 	return true;
 }
 
-void IK_QSphericalSegment::Lock(int dof, IK_QJacobian& jacobian, Vector3d& delta)
+void IK_QSphericalSegment::Lock(IK_QPose& pose, int dof, IK_QJacobian& jacobian, const Vector3d& delta) const
 {
+	char *locked = &pose.locked[m_index * 3];
+
 	if (dof == 1) {
-		m_locked[1] = true;
+		locked[1] = true;
 		jacobian.Lock(m_DoF_id + 1, delta[1]);
 	}
 	else {
-		m_locked[0] = m_locked[2] = true;
+		locked[0] = locked[2] = true;
 		jacobian.Lock(m_DoF_id, delta[0]);
 		jacobian.Lock(m_DoF_id + 2, delta[2]);
 	}
 }
 
-void IK_QSphericalSegment::UpdateAngleApply()
+void IK_QSphericalSegment::UpdateAngleApply(IK_QPose& pose) const
 {
-	m_basis = m_new_basis;
+	ApplyBasis(pose, pose.new_basis[m_index]);
 }
 
 // IK_QNullSegment
 
 IK_QNullSegment::IK_QNullSegment()
-	: IK_QSegment(0, false)
+	: IK_QSegment(JOINT_NULL, 0, false)
 {
 }
 
 // IK_QRevoluteSegment
 
 IK_QRevoluteSegment::IK_QRevoluteSegment(int axis)
-	: IK_QSegment(1, false), m_axis(axis), m_angle(0.0), m_limit(false)
+	: IK_QSegment(JOINT_REVOLUTE, 1, false), m_axis(axis), m_limit(false)
 {
 }
 
-void IK_QRevoluteSegment::SetBasis(const Matrix3d& basis)
+void IK_QRevoluteSegment::ProjectBasis(Matrix3d& basis, double *angle) const
 {
 	if (m_axis == 1) {
-		m_angle = ComputeTwist(basis);
-		m_basis = ComputeTwistMatrix(m_angle);
+		angle[0] = ComputeTwist(basis);
+		basis = ComputeTwistMatrix(angle[0]);
 	}
 	else {
-		m_angle = EulerAngleFromMatrix(basis, m_axis);
-		m_basis = RotationMatrix(m_angle, m_axis);
+		angle[0] = EulerAngleFromMatrix(basis, m_axis);
+		basis = RotationMatrix(angle[0], m_axis);
 	}
 }
 
-Vector3d IK_QRevoluteSegment::Axis(int) const
+Vector3d IK_QRevoluteSegment::Axis(const IK_QPose& pose, int) const
 {
-	return m_global_transform.linear().col(m_axis);
+	return pose.global_transform[m_index].linear().col(m_axis);
 }
 
-bool IK_QRevoluteSegment::UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta, bool *clamp)
+bool IK_QRevoluteSegment::UpdateAngle(IK_QPose& pose, const Vector3d& dq, Vector3d& delta, bool *clamp) const
 {
-	if (m_locked[0])
+	double angle = pose.angle[m_index * 2];
+	double& new_angle = pose.new_angle[m_index * 2];
+
+	if (pose.locked[m_index * 3])
 		return false;
 
-	m_new_angle = m_angle + jacobian.AngleUpdate(m_DoF_id);
+	new_angle = angle + dq[0];
 
 	clamp[0] = false;
 
 	if (m_limit == false)
 		return false;
 
-	if (m_new_angle > m_max)
-		delta[0] = m_max - m_angle;
-	else if (m_new_angle < m_min)
-		delta[0] = m_min - m_angle;
+	if (new_angle > m_max)
+		delta[0] = m_max - angle;
+	else if (new_angle < m_min)
+		delta[0] = m_min - angle;
 	else
 		return false;
 	
 	clamp[0] = true;
-	m_new_angle = m_angle + delta[0];
+	new_angle = angle + delta[0];
 
 	return true;
 }
 
-void IK_QRevoluteSegment::Lock(int, IK_QJacobian& jacobian, Vector3d& delta)
+void IK_QRevoluteSegment::Lock(IK_QPose& pose, int, IK_QJacobian& jacobian, const Vector3d& delta) const
 {
-	m_locked[0] = true;
+	pose.locked[m_index * 3] = true;
 	jacobian.Lock(m_DoF_id, delta[0]);
 }
 
-void IK_QRevoluteSegment::UpdateAngleApply()
+void IK_QRevoluteSegment::UpdateAngleApply(IK_QPose& pose) const
 {
-	m_angle = m_new_angle;
-	m_basis = RotationMatrix(m_angle, m_axis);
+	double& angle = pose.angle[m_index * 2];
+
+	angle = pose.new_angle[m_index * 2];
+	ApplyBasis(pose, RotationMatrix(angle, m_axis));
 }
 
 void IK_QRevoluteSegment::SetLimit(int axis, double lmin, double lmax)
@@ -449,38 +590,38 @@ void IK_QRevoluteSegment::SetWeight(int axis, double weight)
 // IK_QSwingSegment
 
 IK_QSwingSegment::IK_QSwingSegment()
-	: IK_QSegment(2, false), m_limit_x(false), m_limit_z(false)
+	: IK_QSegment(JOINT_SWING, 2, false), m_limit_x(false), m_limit_z(false)
 {
 }
 
-void IK_QSwingSegment::SetBasis(const Matrix3d& basis)
+void IK_QSwingSegment::ProjectBasis(Matrix3d& basis, double *) const
 {
-	m_basis = basis;
-	RemoveTwist(m_basis);
+	RemoveTwist(basis);
 }
 
-Vector3d IK_QSwingSegment::Axis(int dof) const
+Vector3d IK_QSwingSegment::Axis(const IK_QPose& pose, int dof) const
 {
-	return m_global_transform.linear().col((dof == 0) ? 0 : 2);
+	return pose.global_transform[m_index].linear().col((dof == 0) ? 0 : 2);
 }
 
-bool IK_QSwingSegment::UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta, bool *clamp)
+bool IK_QSwingSegment::UpdateAngle(IK_QPose& pose, const Vector3d& dq, Vector3d& delta, bool *clamp) const
 {
-	if (m_locked[0] && m_locked[1])
+	const char *locked = &pose.locked[m_index * 3];
+	const Matrix3d& basis = pose.basis[m_index];
+	Matrix3d& new_basis = pose.new_basis[m_index];
+
+	if (locked[0] && locked[1])
 		return false;
 
-	Vector3d dq;
-	dq.x() = jacobian.AngleUpdate(m_DoF_id);
-	dq.y() = 0.0;
-	dq.z() = jacobian.AngleUpdate(m_DoF_id + 1);
+	Vector3d dswing(dq[0], 0.0, dq[1]);
 
 	// Directly update the rotation matrix, with Rodrigues' rotation formula,
 	// to avoid singularities and allow smooth integration.
 
-	double theta = dq.norm();
+	double theta = dswing.norm();
 
 	if (!FuzzyZero(theta)) {
-		Vector3d w = dq * (1.0 / theta);
+		Vector3d w = dswing * (1.0 / theta);
 
 		double sine = sin(theta);
 		double cosine = cos(theta);
@@ -498,17 +639,17 @@ bool IK_QSwingSegment::UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta
 		    zsine, cosine, -xsine,
 		    xzcosine, xsine, cosine + zzcosine);
 
-		m_new_basis = m_basis * M;
+		new_basis = basis * M;
 
-		RemoveTwist(m_new_basis);
+		RemoveTwist(new_basis);
 	}
 	else
-		m_new_basis = m_basis;
+		new_basis = basis;
 
 	if (m_limit_x == false && m_limit_z == false)
 		return false;
 
-	Vector3d a = SphericalRangeParameters(m_new_basis);
+	Vector3d a = SphericalRangeParameters(new_basis);
 	double ax = 0, az = 0;
 
 	clamp[0] = clamp[1] = false;
@@ -544,24 +685,24 @@ bool IK_QSwingSegment::UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta
 	if (clamp[0] == false && clamp[1] == false)
 		return false;
 
-	m_new_basis = ComputeSwingMatrix(ax, az);
+	new_basis = ComputeSwingMatrix(ax, az);
 
-	delta = MatrixToAxisAngle(m_basis.transpose() * m_new_basis);
+	delta = MatrixToAxisAngle(basis.transpose() * new_basis);
 	delta[1] = delta[2]; delta[2] = 0.0;
 
 	return true;
 }
 
-void IK_QSwingSegment::Lock(int, IK_QJacobian& jacobian, Vector3d& delta)
+void IK_QSwingSegment::Lock(IK_QPose& pose, int, IK_QJacobian& jacobian, const Vector3d& delta) const
 {
-	m_locked[0] = m_locked[1] = true;
+	pose.locked[m_index * 3] = pose.locked[m_index * 3 + 1] = true;
 	jacobian.Lock(m_DoF_id, delta[0]);
 	jacobian.Lock(m_DoF_id + 1, delta[1]);
 }
 
-void IK_QSwingSegment::UpdateAngleApply()
+void IK_QSwingSegment::UpdateAngleApply(IK_QPose& pose) const
 {
-	m_basis = m_new_basis;
+	ApplyBasis(pose, pose.new_basis[m_index]);
 }
 
 void IK_QSwingSegment::SetLimit(int axis, double lmin, double lmax)
@@ -609,73 +750,81 @@ void IK_QSwingSegment::SetWeight(int axis, double weight)
 // IK_QElbowSegment
 
 IK_QElbowSegment::IK_QElbowSegment(int axis)
-	: IK_QSegment(2, false), m_axis(axis), m_twist(0.0), m_angle(0.0),
-	m_cos_twist(1.0), m_sin_twist(0.0), m_limit(false), m_limit_twist(false)
+	: IK_QSegment(JOINT_ELBOW, 2, false), m_axis(axis), m_limit(false), m_limit_twist(false)
 {
 }
 
-void IK_QElbowSegment::SetBasis(const Matrix3d& basis)
+void IK_QElbowSegment::ProjectBasis(Matrix3d& basis, double *angle) const
 {
-	m_basis = basis;
+	double twist = ComputeTwist(basis);
 
-	m_twist = ComputeTwist(m_basis);
-	RemoveTwist(m_basis);
-	m_angle = EulerAngleFromMatrix(basis, m_axis);
+	angle[0] = EulerAngleFromMatrix(basis, m_axis);
+	angle[1] = twist;
 
-	m_basis = RotationMatrix(m_angle, m_axis) * ComputeTwistMatrix(m_twist);
+	basis = RotationMatrix(angle[0], m_axis) * ComputeTwistMatrix(twist);
 }
 
-Vector3d IK_QElbowSegment::Axis(int dof) const
+Vector3d IK_QElbowSegment::Axis(const IK_QPose& pose, int dof) const
 {
+	const Matrix3d& linear = pose.global_transform[m_index].linear();
+
 	if (dof == 0) {
+		double twist = pose.angle[m_index * 2 + 1];
 		Vector3d v;
+
 		if (m_axis == 0)
-			v = Vector3d(m_cos_twist, 0, m_sin_twist);
+			v = Vector3d(cos(twist), 0, sin(twist));
 		else
-			v = Vector3d(-m_sin_twist, 0, m_cos_twist);
+			v = Vector3d(-sin(twist), 0, cos(twist));
 
-		return m_global_transform.linear() * v;
+		return linear * v;
 	}
 	else
-		return m_global_transform.linear().col(1);
+		return linear.col(1);
 }
 
-bool IK_QElbowSegment::UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta, bool *clamp)
+bool IK_QElbowSegment::UpdateAngle(IK_QPose& pose, const Vector3d& dq, Vector3d& delta, bool *clamp) const
 {
-	if (m_locked[0] && m_locked[1])
+	const char *locked = &pose.locked[m_index * 3];
+	double angle = pose.angle[m_index * 2];
+	double twist = pose.angle[m_index * 2 + 1];
+	double& new_angle = pose.new_angle[m_index * 2];
+	double& new_twist = pose.new_angle[m_index * 2 + 1];
+
+	if (locked[0] && locked[1])
 		return false;
 
 	clamp[0] = clamp[1] = false;
 
-	if (!m_locked[0]) {
-		m_new_angle = m_angle + jacobian.AngleUpdate(m_DoF_id);
+	if (!locked[0]) {
+		new_angle = angle + dq[0];
 
 		if (m_limit) {
-			if (m_new_angle > m_max) {
-				delta[0] = m_max - m_angle;
-				m_new_angle = m_max;
+			if (new_angle > m_max) {
+				delta[0] = m_max - angle;
+				new_angle = m_max;
 				clamp[0] = true;
 			}
-			else if (m_new_angle < m_min) {
-				delta[0] = m_min - m_angle;
-				m_new_angle = m_min;
+			else if (new_angle < m_min) {
+				delta[0] = m_min - angle;
+				new_angle = m_min;
 				clamp[0] = true;
 			}
 		}
 	}
 
-	if (!m_locked[1]) {
-		m_new_twist = m_twist + jacobian.AngleUpdate(m_DoF_id + 1);
+	if (!locked[1]) {
+		new_twist = twist + dq[1];
 
 		if (m_limit_twist) {
-			if (m_new_twist > m_max_twist) {
-				delta[1] = m_max_twist - m_twist;
-				m_new_twist = m_max_twist;
+			if (new_twist > m_max_twist) {
+				delta[1] = m_max_twist - twist;
+				new_twist = m_max_twist;
 				clamp[1] = true;
 			}
-			else if (m_new_twist < m_min_twist) {
-				delta[1] = m_min_twist - m_twist;
-				m_new_twist = m_min_twist;
+			else if (new_twist < m_min_twist) {
+				delta[1] = m_min_twist - twist;
+				new_twist = m_min_twist;
 				clamp[1] = true;
 			}
 		}
@@ -684,30 +833,29 @@ bool IK_QElbowSegment::UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta
 	return (clamp[0] || clamp[1]);
 }
 
-void IK_QElbowSegment::Lock(int dof, IK_QJacobian& jacobian, Vector3d& delta)
+void IK_QElbowSegment::Lock(IK_QPose& pose, int dof, IK_QJacobian& jacobian, const Vector3d& delta) const
 {
 	if (dof == 0) {
-		m_locked[0] = true;
+		pose.locked[m_index * 3] = true;
 		jacobian.Lock(m_DoF_id, delta[0]);
 	}
 	else {
-		m_locked[1] = true;
+		pose.locked[m_index * 3 + 1] = true;
 		jacobian.Lock(m_DoF_id + 1, delta[1]);
 	}
 }
 
-void IK_QElbowSegment::UpdateAngleApply()
+void IK_QElbowSegment::UpdateAngleApply(IK_QPose& pose) const
 {
-	m_angle = m_new_angle;
-	m_twist = m_new_twist;
+	double *angle = &pose.angle[m_index * 2];
 
-	m_sin_twist = sin(m_twist);
-	m_cos_twist = cos(m_twist);
+	angle[0] = pose.new_angle[m_index * 2];
+	angle[1] = pose.new_angle[m_index * 2 + 1];
 
-	Matrix3d A = RotationMatrix(m_angle, m_axis);
-	Matrix3d T = RotationMatrix(m_sin_twist, m_cos_twist, 1);
+	Matrix3d A = RotationMatrix(angle[0], m_axis);
+	Matrix3d T = RotationMatrix(sin(angle[1]), cos(angle[1]), 1);
 
-	m_basis = A * T;
+	ApplyBasis(pose, A * T);
 }
 
 void IK_QElbowSegment::SetLimit(int axis, double lmin, double lmax)
@@ -742,7 +890,7 @@ void IK_QElbowSegment::SetWeight(int axis, double weight)
 // IK_QTranslateSegment
 
 IK_QTranslateSegment::IK_QTranslateSegment(int axis1)
-	: IK_QSegment(1, true)
+	: IK_QSegment(JOINT_TRANSLATE, 1, true)
 {
 	m_axis_enabled[0] = m_axis_enabled[1] = m_axis_enabled[2] = false;
 	m_axis_enabled[axis1] = true;
@@ -753,7 +901,7 @@ IK_QTranslateSegment::IK_QTranslateSegment(int axis1)
 }
 
 IK_QTranslateSegment::IK_QTranslateSegment(int axis1, int axis2)
-	: IK_QSegment(2, true)
+	: IK_QSegment(JOINT_TRANSLATE, 2, true)
 {
 	m_axis_enabled[0] = m_axis_enabled[1] = m_axis_enabled[2] = false;
 	m_axis_enabled[axis1] = true;
@@ -766,7 +914,7 @@ IK_QTranslateSegment::IK_QTranslateSegment(int axis1, int axis2)
 }
 
 IK_QTranslateSegment::IK_QTranslateSegment()
-	: IK_QSegment(3, true)
+	: IK_QSegment(JOINT_TRANSLATE, 3, true)
 {
 	m_axis_enabled[0] = m_axis_enabled[1] = m_axis_enabled[2] = true;
 
@@ -777,57 +925,62 @@ IK_QTranslateSegment::IK_QTranslateSegment()
 	m_limit[0] = m_limit[1] = m_limit[2] = false;
 }
 
-Vector3d IK_QTranslateSegment::Axis(int dof) const
+Vector3d IK_QTranslateSegment::Axis(const IK_QPose& pose, int dof) const
 {
-	return m_global_transform.linear().col(m_axis[dof]);
+	return pose.global_transform[m_index].linear().col(m_axis[dof]);
 }
 
-bool IK_QTranslateSegment::UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta, bool *clamp)
+bool IK_QTranslateSegment::UpdateAngle(IK_QPose& pose, const Vector3d& dq, Vector3d& delta, bool *clamp) const
 {
-	int dof_id = m_DoF_id, dof = 0, i, clamped = false;
+	const char *locked = &pose.locked[m_index * 3];
+	const Vector3d& translation = pose.translation[m_index];
+	Vector3d& new_translation = pose.new_translation[m_index];
+	int dof = 0, i, clamped = false;
 
-	Vector3d dx(0.0, 0.0, 0.0);
+	// the limits are given in the units of the rig, the pose is scaled
+	double scale = pose.scale;
 
 	for (i = 0; i < 3; i++) {
 		if (!m_axis_enabled[i]) {
-			m_new_translation[i] = m_translation[i];
+			new_translation[i] = translation[i];
 			continue;
 		}
 
 		clamp[dof] = false;
 
-		if (!m_locked[dof]) {
-			m_new_translation[i] = m_translation[i] + jacobian.AngleUpdate(dof_id);
+		if (!locked[dof]) {
+			new_translation[i] = translation[i] + dq[dof];
 
 			if (m_limit[i]) {
-				if (m_new_translation[i] > m_max[i]) {
-					delta[dof] = m_max[i] - m_translation[i];
-					m_new_translation[i] = m_max[i];
+				double max = m_max[i] * scale, min = m_min[i] * scale;
+
+				if (new_translation[i] > max) {
+					delta[dof] = max - translation[i];
+					new_translation[i] = max;
 					clamped = clamp[dof] = true;
 				}
-				else if (m_new_translation[i] < m_min[i]) {
-					delta[dof] = m_min[i] - m_translation[i];
-					m_new_translation[i] = m_min[i];
+				else if (new_translation[i] < min) {
+					delta[dof] = min - translation[i];
+					new_translation[i] = min;
 					clamped = clamp[dof] = true;
 				}
 			}
 		}
 
-		dof_id++;
 		dof++;
 	}
 
 	return clamped;
 }
 
-void IK_QTranslateSegment::UpdateAngleApply()
+void IK_QTranslateSegment::UpdateAngleApply(IK_QPose& pose) const
 {
-	m_translation = m_new_translation;
+	ApplyTranslation(pose, pose.new_translation[m_index]);
 }
 
-void IK_QTranslateSegment::Lock(int dof, IK_QJacobian& jacobian, Vector3d& delta)
+void IK_QTranslateSegment::Lock(IK_QPose& pose, int dof, IK_QJacobian& jacobian, const Vector3d& delta) const
 {
-	m_locked[dof] = true;
+	pose.locked[m_index * 3 + dof] = true;
 	jacobian.Lock(m_DoF_id + dof, delta[dof]);
 }
 
@@ -850,17 +1003,94 @@ void IK_QTranslateSegment::SetLimit(int axis, double lmin, double lmax)
 	m_limit[axis] = true;
 }
 
-void IK_QTranslateSegment::Scale(double scale)
+// batched updates, the type of the segments is known so the calls to the
+// functions of that type are not virtual
+
+template <typename T>
+static void UpdateAxesOfType(const std::vector<IK_QSegment *>& segs, IK_QPose& pose)
 {
+	std::vector<IK_QSegment *>::const_iterator it;
 	int i;
 
-	IK_QSegment::Scale(scale);
+	for (it = segs.begin(); it != segs.end(); it++) {
+		const T *seg = static_cast<const T *>(*it);
+		int index = seg->Index();
 
-	for (i = 0; i < 3; i++) {
-		m_min[0] *= scale;
-		m_max[1] *= scale;
+		if (!pose.axes_dirty[index])
+			continue;
+
+		for (i = 0; i < seg->NumberOfDoF(); i++)
+			pose.axis[index * 3 + i] = seg->T::Axis(pose, i);
+
+		pose.axes_dirty[index] = false;
+	}
+}
+
+template <typename T>
+static void UpdateAnglesOfType(const std::vector<IK_QSegment *>& segs, const IK_QJacobian& jacobian,
+                               IK_QPose& pose)
+{
+	std::vector<IK_QSegment *>::const_iterator it;
+	int i;
+
+	for (it = segs.begin(); it != segs.end(); it++) {
+		const T *seg = static_cast<const T *>(*it);
+		int index = seg->Index();
+		Vector3d dq(0.0, 0.0, 0.0);
+		bool clamp[3] = {false, false, false};
+
+		for (i = 0; i < seg->NumberOfDoF(); i++)
+			dq[i] = jacobian.AngleUpdate(seg->DoFId() + i);
+
+		pose.clamped[index] = seg->T::UpdateAngle(pose, dq, pose.delta[index], clamp);
+
+		for (i = 0; i < 3; i++)
+			pose.clamp[index * 3 + i] = clamp[i];
+	}
+}
+
+template <typename T>
+static void UpdateAngleApplyOfType(const std::vector<IK_QSegment *>& segs, IK_QPose& pose)
+{
+	std::vector<IK_QSegment *>::const_iterator it;
+
+	for (it = segs.begin(); it != segs.end(); it++)
+		static_cast<const T *>(*it)->T::UpdateAngleApply(pose);
+}
+
+void IK_QSegment::UpdateAxes(JointType type, const std::vector<IK_QSegment *>& segs, IK_QPose& pose)
+{
+	switch (type) {
+		case JOINT_SPHERICAL: UpdateAxesOfType<IK_QSphericalSegment>(segs, pose); break;
+		case JOINT_REVOLUTE: UpdateAxesOfType<IK_QRevoluteSegment>(segs, pose); break;
+		case JOINT_SWING: UpdateAxesOfType<IK_QSwingSegment>(segs, pose); break;
+		case JOINT_ELBOW: UpdateAxesOfType<IK_QElbowSegment>(segs, pose); break;
+		case JOINT_TRANSLATE: UpdateAxesOfType<IK_QTranslateSegment>(segs, pose); break;
+		default: break;
 	}
+}
 
-	m_new_translation *= scale;
+void IK_QSegment::UpdateAngles(JointType type, const std::vector<IK_QSegment *>& segs,
+                               const IK_QJacobian& jacobian, IK_QPose& pose)
+{
+	switch (type) {
+		case JOINT_SPHERICAL: UpdateAnglesOfType<IK_QSphericalSegment>(segs, jacobian, pose); break;
+		case JOINT_REVOLUTE: UpdateAnglesOfType<IK_QRevoluteSegment>(segs, jacobian, pose); break;
+		case JOINT_SWING: UpdateAnglesOfType<IK_QSwingSegment>(segs, jacobian, pose); break;
+		case JOINT_ELBOW: UpdateAnglesOfType<IK_QElbowSegment>(segs, jacobian, pose); break;
+		case JOINT_TRANSLATE: UpdateAnglesOfType<IK_QTranslateSegment>(segs, jacobian, pose); break;
+		default: break;
+	}
 }
 
+void IK_QSegment::UpdateAngleApply(JointType type, const std::vector<IK_QSegment *>& segs, IK_QPose& pose)
+{
+	switch (type) {
+		case JOINT_SPHERICAL: UpdateAngleApplyOfType<IK_QSphericalSegment>(segs, pose); break;
+		case JOINT_REVOLUTE: UpdateAngleApplyOfType<IK_QRevoluteSegment>(segs, pose); break;
+		case JOINT_SWING: UpdateAngleApplyOfType<IK_QSwingSegment>(segs, pose); break;
+		case JOINT_ELBOW: UpdateAngleApplyOfType<IK_QElbowSegment>(segs, pose); break;
+		case JOINT_TRANSLATE: UpdateAngleApplyOfType<IK_QTranslateSegment>(segs, pose); break;
+		default: break;
+	}
+}
@@ -34,6 +34,7 @@
 
 #include "IK_Math.h"
 #include "IK_QJacobian.h"
+#include "IK_QPose.h"
 
 #include <vector>
 
@@ -55,11 +56,27 @@
  * - translate by the used defined translation (tr1)
  * The ordering of these transformations is vital, you must
  * use exactly the same transformations when displaying the segments
+ *
+ * The segment itself holds the definition of the joint and the pose the
+ * user sets and reads back. While solving the pose is kept in an
+ * IK_QPose at the index of the segment in its IK_QSkeleton, the functions
+ * taking a pose only read the segment and change the pose.
  */
 
 class IK_QSegment
 {
 public:
+	// the types of segments, for batched updates of segments of one type
+	enum JointType {
+		JOINT_SPHERICAL,
+		JOINT_NULL,
+		JOINT_REVOLUTE,
+		JOINT_SWING,
+		JOINT_ELBOW,
+		JOINT_TRANSLATE,
+		NUM_JOINT_TYPES
+	};
+
 	virtual ~IK_QSegment();
 
 	// start: a user defined translation
@@ -74,6 +91,9 @@ public:
 		const double length
 	);
 
+	JointType Type() const
+	{ return m_type; }
+
 	// tree structure access
 	void SetParent(IK_QSegment *parent);
 
@@ -92,6 +112,13 @@ public:
 	IK_QSegment *Composite() const
 	{ return m_composite; }
 
+	// index of the segment in its skeleton, and of its state in a pose
+	int Index() const
+	{ return m_index; }
+
+	void SetIndex(int index)
+	{ m_index = index; }
+
 	// number of degrees of freedom
 	int NumberOfDoF() const
 	{ return m_num_DoF; }
@@ -111,8 +138,11 @@ public:
 	Matrix3d BasisChange() const;
 	Vector3d TranslationChange() const;
 
+	// the change in translation of a pose read with the basis below
+	Vector3d TranslationChange(const IK_QPose& pose) const;
+
 	// the start and end of the segment
-	const Vector3d GlobalStart() const
+	const Vector3d& GlobalStart() const
 	{ return m_global_start; }
 
 	const Vector3d GlobalEnd() const
@@ -122,16 +152,26 @@ public:
 	const Affine3d &GlobalTransform() const
 	{ return m_global_transform; }
 
+	// the same in a pose
+	const Vector3d& GlobalStart(const IK_QPose& pose) const
+	{ return pose.global_start[m_index]; }
+
+	const Vector3d GlobalEnd(const IK_QPose& pose) const
+	{ return pose.global_transform[m_index].translation(); }
+
+	const Affine3d &GlobalTransform(const IK_QPose& pose) const
+	{ return pose.global_transform[m_index]; }
+
 	// is a translational segment?
 	bool Translational() const
 	{ return m_translational; }
 
 	// locking (during inner clamping loop)
-	bool Locked(int dof) const
-	{ return m_locked[dof]; }
+	bool Locked(const IK_QPose& pose, int dof) const
+	{ return pose.locked[m_index * 3 + dof] != 0; }
 
-	void UnLock()
-	{ m_locked[0] = m_locked[1] = m_locked[2] = false; }
+	void UnLock(IK_QPose& pose) const
+	{ pose.locked[m_index * 3] = pose.locked[m_index * 3 + 1] = pose.locked[m_index * 3 + 2] = false; }
 
 	// per dof joint weighting
 	double Weight(int dof) const
@@ -145,12 +185,41 @@ public:
 	void UpdateTransform(const Affine3d &global);
 
 	// get axis from rotation matrix for derivative computation
-	virtual Vector3d Axis(int dof) const=0;
+	virtual Vector3d Axis(const IK_QPose& pose, int dof) const=0;
+
+	// Axis of each DoF as of the last UpdateAxes, the jacobian solver
+	// updates them after the transforms for the segments it solves, so
+	// that tasks sharing segments don't compute them again
+	const Vector3d& CachedAxis(const IK_QPose& pose, int dof) const
+	{ return pose.axis[m_index * 3 + dof]; }
 
 	// update the angles using the dTheta's computed using the jacobian matrix
-	virtual bool UpdateAngle(const IK_QJacobian&, Vector3d&, bool*)=0;
-	virtual void Lock(int, IK_QJacobian&, Vector3d&) {}
-	virtual void UpdateAngleApply()=0;
+	bool UpdateAngle(IK_QPose& pose, const IK_QJacobian& jacobian, Vector3d& delta, bool *clamp) const;
+
+	// same, with the angle updates of the DoFs of this segment given
+	// directly, for solvers without a jacobian
+	virtual bool UpdateAngle(IK_QPose& pose, const Vector3d& dq, Vector3d& delta, bool *clamp) const=0;
+
+	// angle updates that move the point 'from' as close as possible to
+	// 'to', both relative to the start of the segment. rotations are
+	// computed in closed form for hinges, and by projecting the shortest
+	// rotation onto the DoF axes otherwise
+	Vector3d ReachUpdate(const IK_QPose& pose, const Vector3d& from, const Vector3d& to) const;
+
+	// angle updates for a global rotation, given as axis times angle,
+	// projected onto the DoF axes
+	Vector3d RotationUpdate(const IK_QPose& pose, const Vector3d& rotation) const;
+	virtual void Lock(IK_QPose&, int, IK_QJacobian&, const Vector3d&) const {}
+	virtual void UpdateAngleApply(IK_QPose& pose) const=0;
+
+	// the same for the segments of one type in a pose, which are updated
+	// without virtual calls. the axes are only recomputed if the transform
+	// changed since the last call. UpdateAngles leaves the clamped DoFs
+	// and deltas of each segment in the pose
+	static void UpdateAxes(JointType type, const std::vector<IK_QSegment*>& segs, IK_QPose& pose);
+	static void UpdateAngles(JointType type, const std::vector<IK_QSegment*>& segs,
+	                         const IK_QJacobian& jacobian, IK_QPose& pose);
+	static void UpdateAngleApply(JointType type, const std::vector<IK_QSegment*>& segs, IK_QPose& pose);
 
 	// set joint limits
 	virtual void SetLimit(int, double, double) {}
@@ -158,23 +227,64 @@ public:
 	// set joint weights (per axis)
 	virtual void SetWeight(int, double) {}
 
-	virtual void SetBasis(const Matrix3d& basis) { m_basis = basis; }
+	void SetBasis(const Matrix3d& basis);
+	void SetBasis(IK_QPose& pose, const Matrix3d& basis) const;
+
+	// current rotation and translation, for saving and restoring a solution
+	const Matrix3d& Basis() const
+	{ return m_basis; }
+
+	const Vector3d& Translation() const
+	{ return m_translation; }
+
+	const Matrix3d& Basis(const IK_QPose& pose) const
+	{ return pose.basis[m_index]; }
+
+	const Vector3d& Translation(const IK_QPose& pose) const
+	{ return pose.translation[m_index]; }
+
+	// offset of the start from the end of the parent segment
+	const Vector3d& Start() const
+	{ return m_start; }
+
+	void SetTranslation(const Vector3d& translation)
+	{ m_translation = translation; }
+
+	void SetTranslation(IK_QPose& pose, const Vector3d& translation) const
+	{ pose.translation[m_index] = translation; pose.dirty[m_index] = true; }
 
 	// functions needed for pole vector constraint
-	void PrependBasis(const Matrix3d& mat);
+	void PrependBasis(IK_QPose& pose, const Matrix3d& mat) const;
 	void Reset();
 
-	// scale
-	virtual void Scale(double scale);
+	// copy the transform of the segment into a pose, and back
+	void ReadPose(IK_QPose& pose) const;
+	void WritePose(const IK_QPose& pose);
+
+	// copy the transform into a pose with basis instead of the current
+	// basis and the translation of SetTransform, to solve other poses of
+	// the segment without changing it
+	void ReadPose(IK_QPose& pose, const Matrix3d& basis) const;
 
 protected:
 
 	// num_DoF: number of degrees of freedom
-	IK_QSegment(int num_DoF, bool translational);
+	IK_QSegment(JointType type, int num_DoF, bool translational);
 
 	// remove child as a child of this segment
 	void RemoveChild(IK_QSegment *child);
 
+	// restrict a basis to the DoFs of the segment, and compute the angles
+	// of hinges and elbows from it
+	virtual void ProjectBasis(Matrix3d&, double *) const {}
+
+	// set the basis or translation from UpdateAngleApply, marking the
+	// segment dirty only if it actually changed
+	void ApplyBasis(IK_QPose& pose, const Matrix3d& basis) const;
+	void ApplyTranslation(IK_QPose& pose, const Vector3d& translation) const;
+
+	JointType m_type;
+
 	// tree structure variables
 	IK_QSegment *m_parent;
 	IK_QSegment *m_child;
@@ -188,6 +298,9 @@ protected:
 	Matrix3d m_basis;
 	Vector3d m_translation;
 
+	// hinge and elbow angles of the basis
+	double m_angle[2];
+
 	// original basis
 	Matrix3d m_orig_basis;
 	Vector3d m_orig_translation;
@@ -199,10 +312,11 @@ protected:
 	Vector3d m_global_start;
 	Affine3d m_global_transform;
 
+	int m_index;
+
 	// number degrees of freedom, (first) id of this segments DOF's
 	int m_num_DoF, m_DoF_id;
 
-	bool m_locked[3];
 	bool m_translational;
 	double m_weight[3];
 };
@@ -212,23 +326,19 @@ class IK_QSphericalSegment : public IK_QSegment
 public:
 	IK_QSphericalSegment();
 
-	Vector3d Axis(int dof) const;
-
-	bool UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta, bool *clamp);
-	void Lock(int dof, IK_QJacobian& jacobian, Vector3d& delta);
-	void UpdateAngleApply();
+	Vector3d Axis(const IK_QPose& pose, int dof) const;
 
-	bool ComputeClampRotation(Vector3d& clamp);
+	bool UpdateAngle(IK_QPose& pose, const Vector3d& dq, Vector3d& delta, bool *clamp) const;
+	void Lock(IK_QPose& pose, int dof, IK_QJacobian& jacobian, const Vector3d& delta) const;
+	void UpdateAngleApply(IK_QPose& pose) const;
 
 	void SetLimit(int axis, double lmin, double lmax);
 	void SetWeight(int axis, double weight);
 
 private:
-	Matrix3d m_new_basis;
 	bool m_limit_x, m_limit_y, m_limit_z;
 	double m_min[2], m_max[2];
 	double m_min_y, m_max_y, m_max_x, m_max_z, m_offset_x, m_offset_z;
-	double m_locked_ax, m_locked_ay, m_locked_az;
 };
 
 class IK_QNullSegment : public IK_QSegment
@@ -236,11 +346,13 @@ class IK_QNullSegment : public IK_QSegment
 public:
 	IK_QNullSegment();
 
-	bool UpdateAngle(const IK_QJacobian&, Vector3d&, bool*) { return false; }
-	void UpdateAngleApply() {}
+	bool UpdateAngle(IK_QPose&, const Vector3d&, Vector3d&, bool*) const { return false; }
+	void UpdateAngleApply(IK_QPose&) const {}
 
-	Vector3d Axis(int) const { return Vector3d(0, 0, 0); }
-	void SetBasis(const Matrix3d&) { m_basis.setIdentity(); }
+	Vector3d Axis(const IK_QPose&, int) const { return Vector3d(0, 0, 0); }
+
+protected:
+	void ProjectBasis(Matrix3d& basis, double *) const { basis.setIdentity(); }
 };
 
 class IK_QRevoluteSegment : public IK_QSegment
@@ -249,19 +361,20 @@ public:
 	// axis: the axis of the DoF, in range 0..2
 	IK_QRevoluteSegment(int axis);
 
-	Vector3d Axis(int dof) const;
+	Vector3d Axis(const IK_QPose& pose, int dof) const;
 
-	bool UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta, bool *clamp);
-	void Lock(int dof, IK_QJacobian& jacobian, Vector3d& delta);
-	void UpdateAngleApply();
+	bool UpdateAngle(IK_QPose& pose, const Vector3d& dq, Vector3d& delta, bool *clamp) const;
+	void Lock(IK_QPose& pose, int dof, IK_QJacobian& jacobian, const Vector3d& delta) const;
+	void UpdateAngleApply(IK_QPose& pose) const;
 
 	void SetLimit(int axis, double lmin, double lmax);
 	void SetWeight(int axis, double weight);
-	void SetBasis(const Matrix3d& basis);
+
+protected:
+	void ProjectBasis(Matrix3d& basis, double *angle) const;
 
 private:
 	int m_axis;
-	double m_angle, m_new_angle;
 	bool m_limit;
 	double m_min, m_max;
 };
@@ -272,18 +385,19 @@ public:
 	// XZ DOF, uses one direct rotation
 	IK_QSwingSegment();
 
-	Vector3d Axis(int dof) const;
+	Vector3d Axis(const IK_QPose& pose, int dof) const;
 
-	bool UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta, bool *clamp);
-	void Lock(int dof, IK_QJacobian& jacobian, Vector3d& delta);
-	void UpdateAngleApply();
+	bool UpdateAngle(IK_QPose& pose, const Vector3d& dq, Vector3d& delta, bool *clamp) const;
+	void Lock(IK_QPose& pose, int dof, IK_QJacobian& jacobian, const Vector3d& delta) const;
+	void UpdateAngleApply(IK_QPose& pose) const;
 
 	void SetLimit(int axis, double lmin, double lmax);
 	void SetWeight(int axis, double weight);
-	void SetBasis(const Matrix3d& basis);
+
+protected:
+	void ProjectBasis(Matrix3d& basis, double *) const;
 
 private:
-	Matrix3d m_new_basis;
 	bool m_limit_x, m_limit_z;
 	double m_min[2], m_max[2];
 	double m_max_x, m_max_z, m_offset_x, m_offset_z;
@@ -296,22 +410,22 @@ public:
 	// X or Z, then rotate around Y (twist)
 	IK_QElbowSegment(int axis);
 
-	Vector3d Axis(int dof) const;
+	Vector3d Axis(const IK_QPose& pose, int dof) const;
 
-	bool UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta, bool *clamp);
-	void Lock(int dof, IK_QJacobian& jacobian, Vector3d& delta);
-	void UpdateAngleApply();
+	bool UpdateAngle(IK_QPose& pose, const Vector3d& dq, Vector3d& delta, bool *clamp) const;
+	void Lock(IK_QPose& pose, int dof, IK_QJacobian& jacobian, const Vector3d& delta) const;
+	void UpdateAngleApply(IK_QPose& pose) const;
 
 	void SetLimit(int axis, double lmin, double lmax);
 	void SetWeight(int axis, double weight);
-	void SetBasis(const Matrix3d& basis);
+
+protected:
+	// the angle is kept first, the twist second
+	void ProjectBasis(Matrix3d& basis, double *angle) const;
 
 private:
 	int m_axis;
 
-	double m_twist, m_angle, m_new_twist, m_new_angle;
-	double m_cos_twist, m_sin_twist;
-
 	bool m_limit, m_limit_twist;
 	double m_min, m_max, m_min_twist, m_max_twist;
 };
@@ -324,21 +438,17 @@ public:
 	IK_QTranslateSegment(int axis1, int axis2);
 	IK_QTranslateSegment();
 
-	Vector3d Axis(int dof) const;
+	Vector3d Axis(const IK_QPose& pose, int dof) const;
 
-	bool UpdateAngle(const IK_QJacobian &jacobian, Vector3d& delta, bool *clamp);
-	void Lock(int, IK_QJacobian&, Vector3d&);
-	void UpdateAngleApply();
+	bool UpdateAngle(IK_QPose& pose, const Vector3d& dq, Vector3d& delta, bool *clamp) const;
+	void Lock(IK_QPose& pose, int dof, IK_QJacobian& jacobian, const Vector3d& delta) const;
+	void UpdateAngleApply(IK_QPose& pose) const;
 
 	void SetWeight(int axis, double weight);
 	void SetLimit(int axis, double lmin, double lmax);
 
-	void Scale(double scale);
-
 private:
 	int m_axis[3];
 	bool m_axis_enabled[3], m_limit[3];
-	Vector3d m_new_translation;
 	double m_min[3], m_max[3];
 };
-
@@ -42,8 +42,21 @@ IK_QTask::IK_QTask(
     const IK_QSegment *segment
     ) :
 	m_size(size), m_primary(primary), m_active(active), m_segment(segment),
-	m_weight(1.0)
+	m_weight(1.0), m_user_weight(1.0)
 {
+	m_index = 0;
+}
+
+bool IK_QTask::DependsOn(const IK_QSegment *segment) const
+{
+	// the segment and all its parents
+	const IK_QSegment *seg;
+
+	for (seg = m_segment; seg; seg = seg->Parent())
+		if (seg == segment)
+			return true;
+	
+	return false;
 }
 
 // IK_QPositionTask
@@ -70,16 +83,17 @@ IK_QPositionTask::IK_QPositionTask(
 	m_clamp_length /= 2 * num;
 }
 
-void IK_QPositionTask::ComputeJacobian(IK_QJacobian& jacobian)
+void IK_QPositionTask::ComputeJacobian(IK_QPose& pose, IK_QJacobian& jacobian) const
 {
-	// compute beta
-	const Vector3d& pos = m_segment->GlobalEnd();
+	// compute beta, the clamp length is in the units of the rig
+	const Vector3d& pos = m_segment->GlobalEnd(pose);
+	double clamp_length = m_clamp_length * pose.scale;
 
-	Vector3d d_pos = m_goal - pos;
+	Vector3d d_pos = pose.goal[m_index] - pos;
 	double length = d_pos.norm();
 
-	if (length > m_clamp_length)
-		d_pos = (m_clamp_length / length) * d_pos;
+	if (length > clamp_length)
+		d_pos = (clamp_length / length) * d_pos;
 	
 	jacobian.SetBetas(m_id, m_size, m_weight * d_pos);
 
@@ -88,10 +102,10 @@ void IK_QPositionTask::ComputeJacobian(IK_QJacobian& jacobian)
 	const IK_QSegment *seg;
 
 	for (seg = m_segment; seg; seg = seg->Parent()) {
-		Vector3d p = seg->GlobalStart() - pos;
+		Vector3d p = seg->GlobalStart(pose) - pos;
 
 		for (i = 0; i < seg->NumberOfDoF(); i++) {
-			Vector3d axis = seg->Axis(i) * m_weight;
+			Vector3d axis = seg->CachedAxis(pose, i) * m_weight;
 
 			if (seg->Translational())
 				jacobian.SetDerivatives(m_id, seg->DoFId() + i, axis, 1e2);
@@ -103,10 +117,10 @@ void IK_QPositionTask::ComputeJacobian(IK_QJacobian& jacobian)
 	}
 }
 
-double IK_QPositionTask::Distance() const
+double IK_QPositionTask::Distance(const IK_QPose& pose) const
 {
-	const Vector3d& pos = m_segment->GlobalEnd();
-	Vector3d d_pos = m_goal - pos;
+	const Vector3d& pos = m_segment->GlobalEnd(pose);
+	Vector3d d_pos = pose.goal[m_index] - pos;
 	return d_pos.norm();
 }
 
@@ -117,23 +131,23 @@ IK_QOrientationTask::IK_QOrientationTask(
     const IK_QSegment *segment,
     const Matrix3d& goal
     ) :
-	IK_QTask(3, primary, true, segment), m_goal(goal), m_distance(0.0)
+	IK_QTask(3, primary, true, segment), m_goal(goal)
 {
 }
 
-void IK_QOrientationTask::ComputeJacobian(IK_QJacobian& jacobian)
+void IK_QOrientationTask::ComputeJacobian(IK_QPose& pose, IK_QJacobian& jacobian) const
 {
 	// compute betas
-	const Matrix3d& rot = m_segment->GlobalTransform().linear();
+	const Matrix3d& rot = m_segment->GlobalTransform(pose).linear();
 
-	Matrix3d d_rotm = (m_goal * rot.transpose()).transpose();
+	Matrix3d d_rotm = (pose.goal_rotation[m_index] * rot.transpose()).transpose();
 
 	Vector3d d_rot;
 	d_rot = -0.5 * Vector3d(d_rotm(2, 1) - d_rotm(1, 2),
 	                        d_rotm(0, 2) - d_rotm(2, 0),
 	                        d_rotm(1, 0) - d_rotm(0, 1));
 
-	m_distance = d_rot.norm();
+	pose.distance[m_index] = d_rot.norm();
 
 	jacobian.SetBetas(m_id, m_size, m_weight * d_rot);
 
@@ -147,12 +161,17 @@ void IK_QOrientationTask::ComputeJacobian(IK_QJacobian& jacobian)
 			if (seg->Translational())
 				jacobian.SetDerivatives(m_id, seg->DoFId() + i, Vector3d(0, 0, 0), 1e2);
 			else {
-				Vector3d axis = seg->Axis(i) * m_weight;
+				Vector3d axis = seg->CachedAxis(pose, i) * m_weight;
 				jacobian.SetDerivatives(m_id, seg->DoFId() + i, axis, 1e0);
 			}
 		}
 }
 
+double IK_QOrientationTask::GoalDelta(const IK_QPose& pose, const Vector3d&, const Matrix3d& rotation) const
+{
+	return MatrixToAxisAngle(pose.goal_rotation[m_index] * rotation.transpose()).norm();
+}
+
 // IK_QCenterOfMassTask
 // Note: implementation not finished!
 
@@ -179,24 +198,25 @@ double IK_QCenterOfMassTask::ComputeTotalMass(const IK_QSegment *segment)
 	return mass;
 }
 
-Vector3d IK_QCenterOfMassTask::ComputeCenter(const IK_QSegment *segment)
+Vector3d IK_QCenterOfMassTask::ComputeCenter(const IK_QPose& pose, const IK_QSegment *segment) const
 {
-	Vector3d center = /*seg->Mass()**/ segment->GlobalStart();
+	Vector3d center = /*seg->Mass()**/ segment->GlobalStart(pose);
 
 	const IK_QSegment *seg;
 	for (seg = segment->Child(); seg; seg = seg->Sibling())
-		center += ComputeCenter(seg);
+		center += ComputeCenter(pose, seg);
 	
 	return center;
 }
 
-void IK_QCenterOfMassTask::JacobianSegment(IK_QJacobian& jacobian, Vector3d& center, const IK_QSegment *segment)
+void IK_QCenterOfMassTask::JacobianSegment(const IK_QPose& pose, IK_QJacobian& jacobian, Vector3d& center,
+                                           const IK_QSegment *segment) const
 {
 	int i;
-	Vector3d p = center - segment->GlobalStart();
+	Vector3d p = center - segment->GlobalStart(pose);
 
 	for (i = 0; i < segment->NumberOfDoF(); i++) {
-		Vector3d axis = segment->Axis(i) * m_weight;
+		Vector3d axis = segment->CachedAxis(pose, i) * m_weight;
 		axis *= /*segment->Mass()**/ m_total_mass_inv;
 		
 		if (segment->Translational())
@@ -209,31 +229,43 @@ void IK_QCenterOfMassTask::JacobianSegment(IK_QJacobian& jacobian, Vector3d& cen
 	
 	const IK_QSegment *seg;
 	for (seg = segment->Child(); seg; seg = seg->Sibling())
-		JacobianSegment(jacobian, center, seg);
+		JacobianSegment(pose, jacobian, center, seg);
 }
 
-void IK_QCenterOfMassTask::ComputeJacobian(IK_QJacobian& jacobian)
+void IK_QCenterOfMassTask::ComputeJacobian(IK_QPose& pose, IK_QJacobian& jacobian) const
 {
-	Vector3d center = ComputeCenter(m_segment) * m_total_mass_inv;
+	Vector3d center = ComputeCenter(pose, m_segment) * m_total_mass_inv;
 
 	// compute beta
-	Vector3d d_pos = m_goal_center - center;
+	Vector3d d_pos = pose.goal[m_index] - center;
 
-	m_distance = d_pos.norm();
+	pose.distance[m_index] = d_pos.norm();
 
 #if 0
-	if (m_distance > m_clamp_length)
-		d_pos = (m_clamp_length / m_distance) * d_pos;
+	if (pose.distance[m_index] > m_clamp_length)
+		d_pos = (m_clamp_length / pose.distance[m_index]) * d_pos;
 #endif
 	
 	jacobian.SetBetas(m_id, m_size, m_weight * d_pos);
 
 	// compute derivatives
-	JacobianSegment(jacobian, center, m_segment);
+	JacobianSegment(pose, jacobian, center, m_segment);
 }
 
-double IK_QCenterOfMassTask::Distance() const
+double IK_QCenterOfMassTask::Distance(const IK_QPose& pose) const
 {
-	return m_distance;
+	return pose.distance[m_index];
+}
+
+bool IK_QCenterOfMassTask::DependsOn(const IK_QSegment *segment) const
+{
+	// the whole subtree of the segment
+	const IK_QSegment *seg;
+
+	for (seg = segment; seg; seg = seg->Parent())
+		if (seg == m_segment)
+			return true;
+	
+	return false;
 }
 
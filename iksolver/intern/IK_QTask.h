@@ -62,27 +62,55 @@ public:
 	bool Active() const
 	{ return m_active; }
 
+	const IK_QSegment *Segment() const
+	{ return m_segment; }
+
 	double Weight() const
 	{ return m_weight*m_weight; }
 
 	void SetWeight(double weight)
 	{ m_weight = sqrt(weight); }
 
-	virtual void ComputeJacobian(IK_QJacobian& jacobian)=0;
+	// weight as given by the user, Setup normalizes it into Weight()
+	double UserWeight() const
+	{ return m_user_weight; }
+
+	void SetUserWeight(double weight)
+	{ m_user_weight = weight; }
+
+	// index of the task in its skeleton, and of its goal in a pose
+	int Index() const
+	{ return m_index; }
+
+	void SetIndex(int index)
+	{ m_index = index; }
+
+	// copy the goal into a pose before solving
+	virtual void ReadGoal(IK_QPose&) const {}
+
+	virtual void ComputeJacobian(IK_QPose& pose, IK_QJacobian& jacobian) const=0;
+
+	virtual double Distance(const IK_QPose& pose) const=0;
 
-	virtual double Distance() const=0;
+	// true if the jacobian of the task depends on the DoFs of segment,
+	// tasks that share no segments can be solved independently
+	virtual bool DependsOn(const IK_QSegment *segment) const;
 
 	virtual bool PositionTask() const { return false; }
+	virtual bool OrientationTask() const { return false; }
 
-	virtual void Scale(double) {}
+	// how far the goal in the pose moved from a goal saved from a pose
+	virtual double GoalDelta(const IK_QPose& pose, const Vector3d& goal, const Matrix3d& rotation) const=0;
 
 protected:
 	int m_id;
+	int m_index;
 	int m_size;
 	bool m_primary;
 	bool m_active;
 	const IK_QSegment *m_segment;
 	double m_weight;
+	double m_user_weight;
 };
 
 class IK_QPositionTask : public IK_QTask
@@ -94,12 +122,19 @@ public:
 		const Vector3d& goal
 	);
 
-	void ComputeJacobian(IK_QJacobian& jacobian);
+	void ReadGoal(IK_QPose& pose) const { pose.goal[m_index] = m_goal; }
+	void ComputeJacobian(IK_QPose& pose, IK_QJacobian& jacobian) const;
 
-	double Distance() const;
+	double Distance(const IK_QPose& pose) const;
+
+	void SetGoal(const Vector3d& goal) { m_goal = goal; }
+	const Vector3d& Goal() const { return m_goal; }
+	const Vector3d& Goal(const IK_QPose& pose) const { return pose.goal[m_index]; }
 
 	bool PositionTask() const { return true; }
-	void Scale(double scale) { m_goal *= scale; m_clamp_length *= scale; }
+
+	double GoalDelta(const IK_QPose& pose, const Vector3d& goal, const Matrix3d&) const
+	{ return (pose.goal[m_index] - goal).norm(); }
 
 private:
 	Vector3d m_goal;
@@ -115,12 +150,21 @@ public:
 		const Matrix3d& goal
 	);
 
-	double Distance() const { return m_distance; }
-	void ComputeJacobian(IK_QJacobian& jacobian);
+	void ReadGoal(IK_QPose& pose) const { pose.goal_rotation[m_index] = m_goal; }
+
+	// the distance is computed with the jacobian
+	double Distance(const IK_QPose& pose) const { return pose.distance[m_index]; }
+	void ComputeJacobian(IK_QPose& pose, IK_QJacobian& jacobian) const;
+
+	void SetGoal(const Matrix3d& goal) { m_goal = goal; }
+	const Matrix3d& Goal() const { return m_goal; }
+
+	bool OrientationTask() const { return true; }
+
+	double GoalDelta(const IK_QPose& pose, const Vector3d&, const Matrix3d& rotation) const;
 
 private:
 	Matrix3d m_goal;
-	double m_distance;
 };
 
 
@@ -133,19 +177,23 @@ public:
 		const Vector3d& center
 	);
 
-	void ComputeJacobian(IK_QJacobian& jacobian);
+	void ReadGoal(IK_QPose& pose) const { pose.goal[m_index] = m_goal_center; }
+	void ComputeJacobian(IK_QPose& pose, IK_QJacobian& jacobian) const;
+
+	double Distance(const IK_QPose& pose) const;
 
-	double Distance() const;
+	bool DependsOn(const IK_QSegment *segment) const;
 
-	void Scale(double scale) { m_goal_center *= scale; m_distance *= scale; }
+	double GoalDelta(const IK_QPose& pose, const Vector3d& goal, const Matrix3d&) const
+	{ return (pose.goal[m_index] - goal).norm(); }
 
 private:
 	double ComputeTotalMass(const IK_QSegment *segment);
-	Vector3d ComputeCenter(const IK_QSegment *segment);
-	void JacobianSegment(IK_QJacobian& jacobian, Vector3d& center, const IK_QSegment *segment);
+	Vector3d ComputeCenter(const IK_QPose& pose, const IK_QSegment *segment) const;
+	void JacobianSegment(const IK_QPose& pose, IK_QJacobian& jacobian, Vector3d& center,
+	                     const IK_QSegment *segment) const;
 
 	Vector3d m_goal_center;
 	double m_total_mass_inv;
-	double m_distance;
 };
 
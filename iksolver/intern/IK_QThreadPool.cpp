@@ -0,0 +1,219 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/intern/IK_QThreadPool.cpp
+ *  \ingroup iksolver
+ */
+
+
+#include "IK_QThreadPool.h"
+
+#ifdef __linux__
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+
+IK_QThreadPool::IK_QThreadPool(int num_threads, bool pin)
+	: m_pin(pin), m_generation(0), m_quit(false), m_busy(0), m_func(NULL), m_data(NULL),
+	  m_remaining(0)
+{
+	if (num_threads <= 0)
+		num_threads = (int)std::thread::hardware_concurrency();
+	if (num_threads <= 0)
+		num_threads = 1;
+
+	int i;
+
+	for (i = 0; i < num_threads; i++)
+		m_queues.push_back(new Queue());
+
+	// the calling thread is only pinned while it works along in Run
+	for (i = 1; i < num_threads; i++)
+		m_threads.push_back(std::thread(&IK_QThreadPool::WorkerMain, this, i));
+}
+
+IK_QThreadPool::~IK_QThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_start.notify_all();
+
+	std::vector<std::thread>::iterator thread;
+	std::vector<Queue *>::iterator queue;
+
+	for (thread = m_threads.begin(); thread != m_threads.end(); thread++)
+		thread->join();
+
+	for (queue = m_queues.begin(); queue != m_queues.end(); queue++)
+		delete *queue;
+}
+
+void IK_QThreadPool::PinThread(int core)
+{
+#ifdef __linux__
+	int num_cores = (int)std::thread::hardware_concurrency();
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET((num_cores > 0) ? core % num_cores : core, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void)core;
+#endif
+}
+
+void IK_QThreadPool::Run(WorkFunc func, void *data, int count)
+{
+	if (count <= 0)
+		return;
+
+	int num_threads = NumThreads();
+	int i;
+
+	// fewer items than threads, or nobody to share with
+	if (num_threads == 1 || count == 1) {
+		for (i = 0; i < count; i++)
+			func(data, i, 0);
+		return;
+	}
+
+	// workers only look at the queues after the generation changed, and
+	// the previous run waited for all of them to finish
+	for (i = 0; i < count; i++)
+		m_queues[i % num_threads]->indices.push_back(i);
+
+	m_func = func;
+	m_data = data;
+	m_remaining = count;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_busy = num_threads - 1;
+		m_generation++;
+	}
+	m_start.notify_all();
+
+	// pin the calling thread as the first thread for this run, and give it
+	// back its own affinity afterwards
+#ifdef __linux__
+	cpu_set_t affinity;
+	bool pinned = m_pin && pthread_getaffinity_np(pthread_self(), sizeof(affinity), &affinity) == 0;
+
+	if (pinned)
+		PinThread(0);
+#endif
+
+	DoWork(0);
+
+#ifdef __linux__
+	if (pinned)
+		pthread_setaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+#endif
+
+	// wait for the workers to be done with the queues too, not only for
+	// the last item to finish, before they are filled again
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_busy > 0)
+		m_done.wait(lock);
+}
+
+void IK_QThreadPool::WorkerMain(int thread)
+{
+	unsigned int generation = 0;
+
+	if (m_pin)
+		PinThread(thread);
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (!m_quit && m_generation == generation)
+				m_start.wait(lock);
+
+			if (m_quit)
+				return;
+
+			generation = m_generation;
+		}
+
+		DoWork(thread);
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			last = (--m_busy == 0);
+		}
+		if (last)
+			m_done.notify_one();
+	}
+}
+
+void IK_QThreadPool::DoWork(int thread)
+{
+	int index;
+
+	while (m_remaining > 0 && NextIndex(thread, index)) {
+		m_func(m_data, index, thread);
+		m_remaining--;
+	}
+}
+
+bool IK_QThreadPool::NextIndex(int thread, int& index)
+{
+	int num_threads = NumThreads();
+	int i;
+
+	// own work first, newest first while it's still warm in the cache
+	{
+		Queue *queue = m_queues[thread];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+
+		if (!queue->indices.empty()) {
+			index = queue->indices.back();
+			queue->indices.pop_back();
+			return true;
+		}
+	}
+
+	// steal the oldest work of the others
+	for (i = 1; i < num_threads; i++) {
+		Queue *queue = m_queues[(thread + i) % num_threads];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+
+		if (!queue->indices.empty()) {
+			index = queue->indices.front();
+			queue->indices.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
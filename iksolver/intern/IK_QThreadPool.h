@@ -0,0 +1,100 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/intern/IK_QThreadPool.h
+ *  \ingroup iksolver
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Pool of worker threads to solve independent solvers in parallel. Run
+ * deals out the indices of the work round robin over a deque per thread,
+ * each thread takes work from the back of its own deque and when that is
+ * empty steals from the front of the others, so threads that got cheap
+ * solves help out with the expensive ones. The calling thread works along
+ * as the first thread, so a pool of one thread creates no threads at all.
+ * Work items are whole solves, which are coarse enough for a mutex per
+ * deque.
+ */
+
+class IK_QThreadPool
+{
+public:
+	// called with the index of the work item and of the thread running it
+	typedef void (*WorkFunc)(void *data, int index, int thread);
+
+	// num_threads of 0 or less uses one thread per core. with pin set each
+	// worker is bound to its own core, where the platform supports it, and
+	// the calling thread to the first core for the duration of Run
+	IK_QThreadPool(int num_threads, bool pin);
+	~IK_QThreadPool();
+
+	int NumThreads() const { return (int)m_queues.size(); }
+
+	// call func for every index below count, and return once all are done
+	void Run(WorkFunc func, void *data, int count);
+
+private:
+	IK_QThreadPool(const IK_QThreadPool&);
+	IK_QThreadPool& operator=(const IK_QThreadPool&);
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<int> indices;
+	};
+
+	void WorkerMain(int thread);
+	void DoWork(int thread);
+	bool NextIndex(int thread, int& index);
+	static void PinThread(int core);
+
+	std::vector<Queue *> m_queues;
+	std::vector<std::thread> m_threads;
+	bool m_pin;
+
+	// the current run, workers wait for a new generation
+	std::mutex m_mutex;
+	std::condition_variable m_start;
+	std::condition_variable m_done;
+	unsigned int m_generation;
+	bool m_quit;
+	int m_busy;
+
+	WorkFunc m_func;
+	void *m_data;
+	std::atomic<int> m_remaining;
+};
+
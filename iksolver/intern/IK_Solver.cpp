@@ -33,25 +33,123 @@
 
 #include "../extern/IK_solver.h"
 
+#include "IK_QArena.h"
+#include "IK_QCCDSolver.h"
+#include "IK_QFABRIKSolver.h"
 #include "IK_QJacobianSolver.h"
 #include "IK_QSegment.h"
 #include "IK_QTask.h"
+#include "IK_QThreadPool.h"
 
+#include <algorithm>
+#include <limits>
 #include <list>
+#include <vector>
 using namespace std;
 
+class IK_QSolver;
+
+class IK_QRig {
+public:
+	IK_QRig(size_t size) : arena(size) {}
+
+	// holds the segments, solvers, tasks and jacobians of a character.
+	// solvers are tracked so IK_FreeRig can destroy them, segments and
+	// tasks own no memory outside the arena and are dropped with it
+	IK_QArena arena;
+	std::vector<IK_QSolver *> solvers;
+};
+
+// solvers and pose instances are solved with, one per thread. the
+// solvers are set up on the skeleton of the definition and only read its
+// segments and tasks, the state of a solve is kept in the pose
+struct IK_QInstanceSolver {
+	IK_QJacobianSolver solver;
+	IK_QFABRIKSolver fabrik;
+	IK_QCCDSolver ccd;
+	IK_QPose pose;
+};
+
 class IK_QSolver {
 public:
-	IK_QSolver() : root(NULL) {
+	IK_QSolver() : root(NULL), rig(NULL), arena(NULL), type(IK_SOLVER_JACOBIAN),
+		used_type(IK_SOLVER_JACOBIAN), compiled(false), reweight(false), stepping(false),
+		step_finished(false), step_solved(false), step_tolerance(0.0f), generation(0),
+		instance_solvers_valid(false) {
 	}
 
 	IK_QJacobianSolver solver;
+	IK_QFABRIKSolver fabrik;
+	IK_QCCDSolver ccd;
 	IK_QSegment *root;
 	std::list<IK_QTask *> tasks;
+
+	// the tree and tasks compiled into arrays, and the state they are
+	// solved in, which is copied back to the segments after solving
+	IK_QSkeleton skeleton;
+	IK_QPose pose;
+
+	// rig the solver and its tasks are allocated in, if any
+	IK_QRig *rig;
+	IK_QArena *arena;
+
+	// requested algorithm, and the one that could actually be set up for
+	// the tasks when compiling
+	IK_SolverType type;
+	IK_SolverType used_type;
+
+	// solver was set up for the current tree and tasks, and task weights
+	// need to be normalized again before the next solve
+	bool compiled;
+	bool reweight;
+
+	// a solve split up with IK_SolveBegin/Step/End is in progress. the
+	// jacobian solver keeps its own state, FABRIK and CCD solve a few
+	// iterations at a time and only need the result
+	bool stepping;
+	bool step_finished;
+	bool step_solved;
+	float step_tolerance;
+
+	// the solver used as definition for instances. the generation changes
+	// when compiling gives another tree or other tasks, which makes older
+	// instances stale. the instance solvers are set up again after
+	// compiling or when the settings change
+	unsigned int generation;
+	std::vector<IK_QInstanceSolver *> instance_solvers;
+	bool instance_solvers_valid;
+};
+
+// per character state for a solver used as definition. per segment of the
+// skeleton the rotation to start from and the solved rotation as quaternions
+// and the solved translation change, then per goal 3 floats for positions
+// or a column major 3x3 matrix for orientations
+class IK_QInstance {
+public:
+	enum {
+		SEGMENT_SIZE = 11,
+		TASK_SIZE = 9
+	};
+
+	// the definition with the generation the instance was created for, and
+	// the skeleton index of the rotation and translation segment of each
+	// segment of the pose arrays, -1 for segments not in the skeleton
+	IK_QSolver *definition;
+	unsigned int generation;
+	int num_segments;
+	int num_tasks;
+	std::vector<int> pose_rotation;
+	std::vector<int> pose_translation;
+	std::vector<float> state;
+
+	float *StartRotation(int seg) { return &state[seg * SEGMENT_SIZE]; }
+	float *SolvedRotation(int seg) { return &state[seg * SEGMENT_SIZE + 4]; }
+	float *TranslationChange(int seg) { return &state[seg * SEGMENT_SIZE + 8]; }
+	float *Goal(int task) { return &state[num_segments * SEGMENT_SIZE + task * TASK_SIZE]; }
 };
 
 // FIXME: locks still result in small "residual" changes to the locked axes...
-static IK_QSegment *CreateSegment(int flag, bool translate)
+static IK_QSegment *CreateSegment(int flag, bool translate, IK_QArena *arena)
 {
 	int ndof = 0;
 	ndof += (flag & IK_XDOF) ? 1 : 0;
@@ -70,9 +168,9 @@ static IK_QSegment *CreateSegment(int flag, bool translate)
 		else axis = 2;
 
 		if (translate)
-			seg = new IK_QTranslateSegment(axis);
+			seg = IK_QArenaNew<IK_QTranslateSegment>(arena, axis);
 		else
-			seg = new IK_QRevoluteSegment(axis);
+			seg = IK_QArenaNew<IK_QRevoluteSegment>(arena, axis);
 	}
 	else if (ndof == 2) {
 		int axis1, axis2;
@@ -87,33 +185,33 @@ static IK_QSegment *CreateSegment(int flag, bool translate)
 		}
 
 		if (translate)
-			seg = new IK_QTranslateSegment(axis1, axis2);
+			seg = IK_QArenaNew<IK_QTranslateSegment>(arena, axis1, axis2);
 		else {
 			if (axis1 + axis2 == 2)
-				seg = new IK_QSwingSegment();
+				seg = IK_QArenaNew<IK_QSwingSegment>(arena);
 			else
-				seg = new IK_QElbowSegment((axis1 == 0) ? 0 : 2);
+				seg = IK_QArenaNew<IK_QElbowSegment>(arena, (axis1 == 0) ? 0 : 2);
 		}
 	}
 	else {
 		if (translate)
-			seg = new IK_QTranslateSegment();
+			seg = IK_QArenaNew<IK_QTranslateSegment>(arena);
 		else
-			seg = new IK_QSphericalSegment();
+			seg = IK_QArenaNew<IK_QSphericalSegment>(arena);
 	}
 
 	return seg;
 }
 
-IK_Segment *IK_CreateSegment(int flag)
+static IK_QSegment *CreateCompositeSegment(int flag, IK_QArena *arena)
 {
-	IK_QSegment *rot = CreateSegment(flag, false);
-	IK_QSegment *trans = CreateSegment(flag >> 3, true);
+	IK_QSegment *rot = CreateSegment(flag, false, arena);
+	IK_QSegment *trans = CreateSegment(flag >> 3, true, arena);
 
 	IK_QSegment *seg;
 
 	if (rot == NULL && trans == NULL)
-		seg = new IK_QNullSegment();
+		seg = IK_QArenaNew<IK_QNullSegment>(arena);
 	else if (rot == NULL)
 		seg = trans;
 	else {
@@ -130,6 +228,11 @@ IK_Segment *IK_CreateSegment(int flag)
 	return seg;
 }
 
+IK_Segment *IK_CreateSegment(int flag)
+{
+	return CreateCompositeSegment(flag, NULL);
+}
+
 void IK_FreeSegment(IK_Segment *seg)
 {
 	IK_QSegment *qseg = (IK_QSegment *)seg;
@@ -150,6 +253,21 @@ void IK_SetParent(IK_Segment *seg, IK_Segment *parent)
 		qseg->SetParent(qparent);
 }
 
+static void SetTransform(IK_QSegment *qseg, const Vector3d& mstart, const Matrix3d& mrest,
+                         const Matrix3d& mbasis, double mlength)
+{
+	if (qseg->Composite()) {
+		Vector3d cstart(0, 0, 0);
+		Matrix3d cbasis;
+		cbasis.setIdentity();
+		
+		qseg->SetTransform(mstart, mrest, mbasis, 0.0);
+		qseg->Composite()->SetTransform(cstart, cbasis, cbasis, mlength);
+	}
+	else
+		qseg->SetTransform(mstart, mrest, mbasis, mlength);
+}
+
 void IK_SetTransform(IK_Segment *seg, float start[3], float rest[][3], float basis[][3], float length)
 {
 	IK_QSegment *qseg = (IK_QSegment *)seg;
@@ -162,18 +280,103 @@ void IK_SetTransform(IK_Segment *seg, float start[3], float rest[][3], float bas
 	Matrix3d mrest = CreateMatrix(rest[0][0], rest[1][0], rest[2][0],
 	                              rest[0][1], rest[1][1], rest[2][1],
 	                              rest[0][2], rest[1][2], rest[2][2]);
-	double mlength(length);
 
-	if (qseg->Composite()) {
-		Vector3d cstart(0, 0, 0);
-		Matrix3d cbasis;
-		cbasis.setIdentity();
-		
-		qseg->SetTransform(mstart, mrest, mbasis, 0.0);
-		qseg->Composite()->SetTransform(cstart, cbasis, cbasis, mlength);
+	SetTransform(qseg, mstart, mrest, mbasis, length);
+}
+
+// packed transforms as used by game engines, see IK_TransformLayout
+
+template <IK_TransformLayout layout>
+static inline void ReadTransform(const float *data, Matrix3d& rot, Vector3d& trans)
+{
+	if (layout == IK_LAYOUT_MATRIX3X4) {
+		Eigen::Map<const Eigen::Matrix<float, 3, 4, Eigen::RowMajor> > m(data);
+		rot = m.leftCols<3>().cast<double>();
+		trans = m.col(3).cast<double>();
+	}
+	else {
+		Eigen::Quaterniond q(data[0], data[1], data[2], data[3]);
+		rot = q.normalized().toRotationMatrix();
+		trans = Eigen::Map<const Eigen::Vector3f>(data + 4).cast<double>();
+	}
+}
+
+template <IK_TransformLayout layout>
+static inline void WriteTransform(float *data, const Matrix3d& rot, const Vector3d& trans)
+{
+	if (layout == IK_LAYOUT_MATRIX3X4) {
+		Eigen::Map<Eigen::Matrix<float, 3, 4, Eigen::RowMajor> > m(data);
+		m.leftCols<3>() = rot.cast<float>();
+		m.col(3) = trans.cast<float>();
 	}
+	else {
+		Eigen::Quaterniond q(rot);
+		data[0] = (float)q.w();
+		data[1] = (float)q.x();
+		data[2] = (float)q.y();
+		data[3] = (float)q.z();
+		Eigen::Map<Eigen::Vector3f>(data + 4) = trans.cast<float>();
+	}
+}
+
+template <IK_TransformLayout layout, int stride>
+static void SetTransforms(IK_Segment **segs, int count, const float *rest, const float *basis,
+                          const float *lengths)
+{
+	Matrix3d mrest, mbasis;
+	Vector3d mstart, unused;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		ReadTransform<layout>(rest + i * stride, mrest, mstart);
+		ReadTransform<layout>(basis + i * stride, mbasis, unused);
+
+		SetTransform((IK_QSegment *)segs[i], mstart, mrest, mbasis, lengths[i]);
+	}
+}
+
+template <IK_TransformLayout layout, int stride>
+static void GetPoseChanges(IK_Segment **segs, int count, float *changes)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		IK_QSegment *qseg = (IK_QSegment *)segs[i];
+		IK_QSegment *rot = qseg, *trans = qseg;
+
+		// same as IK_GetBasisChange and IK_GetTranslationChange
+		if (qseg->Composite()) {
+			if (qseg->Translational())
+				rot = qseg->Composite();
+			else
+				trans = qseg->Composite();
+		}
+
+		WriteTransform<layout>(changes + i * stride, rot->BasisChange(), trans->TranslationChange());
+	}
+}
+
+void IK_SetTransforms(IK_Segment **segs, int count, IK_TransformLayout layout,
+                      const float *rest, const float *basis, const float *lengths)
+{
+	if (segs == NULL || count <= 0)
+		return;
+
+	if (layout == IK_LAYOUT_MATRIX3X4)
+		SetTransforms<IK_LAYOUT_MATRIX3X4, 12>(segs, count, rest, basis, lengths);
 	else
-		qseg->SetTransform(mstart, mrest, mbasis, mlength);
+		SetTransforms<IK_LAYOUT_QUATERNION, 7>(segs, count, rest, basis, lengths);
+}
+
+void IK_GetPoseChanges(IK_Segment **segs, int count, IK_TransformLayout layout, float *changes)
+{
+	if (segs == NULL || count <= 0)
+		return;
+
+	if (layout == IK_LAYOUT_MATRIX3X4)
+		GetPoseChanges<IK_LAYOUT_MATRIX3X4, 12>(segs, count, changes);
+	else
+		GetPoseChanges<IK_LAYOUT_QUATERNION, 7>(segs, count, changes);
 }
 
 void IK_SetLimit(IK_Segment *seg, IK_SegmentAxis axis, float lmin, float lmax)
@@ -258,6 +461,85 @@ void IK_GetTranslationChange(IK_Segment *seg, float *translation_change)
 	translation_change[2] = (float)change[2];
 }
 
+static size_t MaxSegmentSize()
+{
+	size_t size = 0;
+
+	size = std::max(size, sizeof(IK_QSphericalSegment));
+	size = std::max(size, sizeof(IK_QNullSegment));
+	size = std::max(size, sizeof(IK_QRevoluteSegment));
+	size = std::max(size, sizeof(IK_QSwingSegment));
+	size = std::max(size, sizeof(IK_QElbowSegment));
+	size = std::max(size, sizeof(IK_QTranslateSegment));
+
+	return IK_QArena::AlignedSize(size);
+}
+
+static size_t MaxTaskSize()
+{
+	size_t size = std::max(sizeof(IK_QPositionTask), sizeof(IK_QOrientationTask));
+	return IK_QArena::AlignedSize(size);
+}
+
+IK_Rig *IK_CreateRig(int max_segments, int max_goals)
+{
+	max_segments = std::max(max_segments, 0);
+	max_goals = std::max(max_goals, 0);
+
+	// room for one solver, composite segments and a jacobian per goal,
+	// which is the most blocks the jacobian solver can split the goals in
+	size_t size = IK_QArena::AlignedSize(sizeof(IK_QSolver));
+	size += 2 * max_segments * MaxSegmentSize();
+	size += max_goals * (MaxTaskSize() + IK_QArena::AlignedSize(IK_QJacobian::MaxSize()));
+
+	IK_QRig *rig = new IK_QRig(size);
+	rig->solvers.reserve(1);
+
+	return (IK_Rig *)rig;
+}
+
+void IK_FreeRig(IK_Rig *rig)
+{
+	if (rig == NULL)
+		return;
+
+	IK_QRig *qrig = (IK_QRig *)rig;
+
+	while (!qrig->solvers.empty())
+		IK_FreeSolver((IK_Solver *)qrig->solvers.back());
+
+	delete qrig;
+}
+
+IK_Segment *IK_RigCreateSegment(IK_Rig *rig, int flag)
+{
+	if (rig == NULL)
+		return IK_CreateSegment(flag);
+
+	IK_QRig *qrig = (IK_QRig *)rig;
+
+	return CreateCompositeSegment(flag, &qrig->arena);
+}
+
+IK_Solver *IK_RigCreateSolver(IK_Rig *rig, IK_Segment *root)
+{
+	if (rig == NULL)
+		return IK_CreateSolver(root);
+	if (root == NULL)
+		return NULL;
+
+	IK_QRig *qrig = (IK_QRig *)rig;
+	IK_QSolver *solver = IK_QArenaNew<IK_QSolver>(&qrig->arena);
+
+	solver->root = (IK_QSegment *)root;
+	solver->rig = qrig;
+	solver->arena = &qrig->arena;
+	solver->solver.SetArena(&qrig->arena);
+	qrig->solvers.push_back(solver);
+
+	return (IK_Solver *)solver;
+}
+
 IK_Solver *IK_CreateSolver(IK_Segment *root)
 {
 	if (root == NULL)
@@ -269,6 +551,16 @@ IK_Solver *IK_CreateSolver(IK_Segment *root)
 	return (IK_Solver *)solver;
 }
 
+static void FreeInstanceSolvers(IK_QSolver *qsolver)
+{
+	std::vector<IK_QInstanceSolver *>::iterator isolver;
+
+	for (isolver = qsolver->instance_solvers.begin(); isolver != qsolver->instance_solvers.end(); isolver++)
+		delete *isolver;
+
+	qsolver->instance_solvers.clear();
+}
+
 void IK_FreeSolver(IK_Solver *solver)
 {
 	if (solver == NULL)
@@ -278,17 +570,37 @@ void IK_FreeSolver(IK_Solver *solver)
 	std::list<IK_QTask *>& tasks = qsolver->tasks;
 	std::list<IK_QTask *>::iterator task;
 
+	IK_SolveEnd(solver);
+	FreeInstanceSolvers(qsolver);
+
 	for (task = tasks.begin(); task != tasks.end(); task++)
-		delete (*task);
+		IK_QArenaDelete(qsolver->arena, *task);
+
+	if (qsolver->rig) {
+		std::vector<IK_QSolver *>& solvers = qsolver->rig->solvers;
+		solvers.erase(std::find(solvers.begin(), solvers.end(), qsolver));
+	}
 	
-	delete qsolver;
+	IK_QArenaDelete(qsolver->arena, qsolver);
 }
 
-void IK_SolverAddGoal(IK_Solver *solver, IK_Segment *tip, float goal[3], float weight)
+void IK_SolverInvalidate(IK_Solver *solver)
 {
-	if (solver == NULL || tip == NULL)
+	if (solver == NULL)
 		return;
 
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+
+	IK_SolveEnd(solver);
+	qsolver->compiled = false;
+	qsolver->instance_solvers_valid = false;
+}
+
+IK_Task *IK_SolverAddGoal(IK_Solver *solver, IK_Segment *tip, float goal[3], float weight)
+{
+	if (solver == NULL || tip == NULL)
+		return NULL;
+
 	IK_QSolver *qsolver = (IK_QSolver *)solver;
 	IK_QSegment *qtip = (IK_QSegment *)tip;
 
@@ -298,15 +610,19 @@ void IK_SolverAddGoal(IK_Solver *solver, IK_Segment *tip, float goal[3], float w
 
 	Vector3d pos(goal[0], goal[1], goal[2]);
 
-	IK_QTask *ee = new IK_QPositionTask(true, qtip, pos);
-	ee->SetWeight(weight);
+	IK_QTask *ee = IK_QArenaNew<IK_QPositionTask>(qsolver->arena, true, qtip, pos);
+	ee->SetUserWeight(weight);
 	qsolver->tasks.push_back(ee);
+	qsolver->compiled = false;
+	qsolver->instance_solvers_valid = false;
+
+	return (IK_Task *)ee;
 }
 
-void IK_SolverAddGoalOrientation(IK_Solver *solver, IK_Segment *tip, float goal[][3], float weight)
+IK_Task *IK_SolverAddGoalOrientation(IK_Solver *solver, IK_Segment *tip, float goal[][3], float weight)
 {
 	if (solver == NULL || tip == NULL)
-		return;
+		return NULL;
 
 	IK_QSolver *qsolver = (IK_QSolver *)solver;
 	IK_QSegment *qtip = (IK_QSegment *)tip;
@@ -320,9 +636,59 @@ void IK_SolverAddGoalOrientation(IK_Solver *solver, IK_Segment *tip, float goal[
 	                            goal[0][1], goal[1][1], goal[2][1],
 	                            goal[0][2], goal[1][2], goal[2][2]);
 
-	IK_QTask *orient = new IK_QOrientationTask(true, qtip, rot);
-	orient->SetWeight(weight);
+	IK_QTask *orient = IK_QArenaNew<IK_QOrientationTask>(qsolver->arena, true, qtip, rot);
+	orient->SetUserWeight(weight);
 	qsolver->tasks.push_back(orient);
+	qsolver->compiled = false;
+	qsolver->instance_solvers_valid = false;
+
+	return (IK_Task *)orient;
+}
+
+void IK_SolverSetGoal(IK_Solver *solver, IK_Task *task, float goal[3])
+{
+	if (solver == NULL || task == NULL)
+		return;
+
+	IK_QTask *qtask = (IK_QTask *)task;
+
+	if (!qtask->PositionTask())
+		return;
+
+	Vector3d pos(goal[0], goal[1], goal[2]);
+
+	((IK_QPositionTask *)qtask)->SetGoal(pos);
+}
+
+void IK_SolverSetGoalOrientation(IK_Solver *solver, IK_Task *task, float goal[][3])
+{
+	if (solver == NULL || task == NULL)
+		return;
+
+	IK_QTask *qtask = (IK_QTask *)task;
+
+	if (!qtask->OrientationTask())
+		return;
+
+	// convert from blender column major
+	Matrix3d rot = CreateMatrix(goal[0][0], goal[1][0], goal[2][0],
+	                            goal[0][1], goal[1][1], goal[2][1],
+	                            goal[0][2], goal[1][2], goal[2][2]);
+
+	((IK_QOrientationTask *)qtask)->SetGoal(rot);
+}
+
+void IK_SolverSetGoalWeight(IK_Solver *solver, IK_Task *task, float weight)
+{
+	if (solver == NULL || task == NULL)
+		return;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+	IK_QTask *qtask = (IK_QTask *)task;
+
+	qtask->SetUserWeight(weight);
+	qsolver->reweight = true;
+	qsolver->instance_solvers_valid = false;
 }
 
 void IK_SolverSetPoleVectorConstraint(IK_Solver *solver, IK_Segment *tip, float goal[3], float polegoal[3], float poleangle, int getangle)
@@ -342,6 +708,7 @@ void IK_SolverSetPoleVectorConstraint(IK_Solver *solver, IK_Segment *tip, float
 
 	qsolver->solver.SetPoleVectorConstraint(
 	    qtip, qgoal, qpolegoal, poleangle, getangle);
+	qsolver->instance_solvers_valid = false;
 }
 
 float IK_SolverGetPoleAngle(IK_Solver *solver)
@@ -354,6 +721,75 @@ float IK_SolverGetPoleAngle(IK_Solver *solver)
 	return qsolver->solver.GetPoleAngle();
 }
 
+void IK_SolverSetConvergence(IK_Solver *solver, int min_iterations, int stall_iterations, float stall_ratio)
+{
+	if (solver == NULL)
+		return;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+
+	qsolver->solver.SetConvergence(min_iterations, stall_iterations, stall_ratio);
+	qsolver->fabrik.SetConvergence(min_iterations, stall_iterations, stall_ratio);
+	qsolver->ccd.SetConvergence(min_iterations, stall_iterations, stall_ratio);
+	qsolver->instance_solvers_valid = false;
+}
+
+int IK_SolverGetIterations(IK_Solver *solver)
+{
+	if (solver == NULL)
+		return 0;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+
+	if (qsolver->used_type == IK_SOLVER_FABRIK)
+		return qsolver->fabrik.Iterations();
+	else if (qsolver->used_type == IK_SOLVER_CCD)
+		return qsolver->ccd.Iterations();
+
+	return qsolver->solver.Iterations();
+}
+
+int IK_SolverGetDeadlineHit(IK_Solver *solver)
+{
+	if (solver == NULL)
+		return 0;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+	bool hit;
+
+	if (qsolver->used_type == IK_SOLVER_FABRIK)
+		hit = qsolver->fabrik.DeadlineHit();
+	else if (qsolver->used_type == IK_SOLVER_CCD)
+		hit = qsolver->ccd.DeadlineHit();
+	else
+		hit = qsolver->solver.DeadlineHit();
+
+	return (hit) ? 1 : 0;
+}
+
+void IK_SolverSetWarmStart(IK_Solver *solver, int enable, float goal_epsilon)
+{
+	if (solver == NULL)
+		return;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+
+	qsolver->solver.SetWarmStart(enable != 0, goal_epsilon);
+}
+
+void IK_SolverGetWarmStartStats(IK_Solver *solver, int *hits, int *misses)
+{
+	if (solver == NULL)
+		return;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+
+	if (hits)
+		*hits = qsolver->solver.WarmStartHits();
+	if (misses)
+		*misses = qsolver->solver.WarmStartMisses();
+}
+
 #if 0
 static void IK_SolverAddCenterOfMass(IK_Solver *solver, IK_Segment *root, float goal[3], float weight)
 {
@@ -367,28 +803,723 @@ static void IK_SolverAddCenterOfMass(IK_Solver *solver, IK_Segment *root, float
 	Vector3d center(goal);
 
 	IK_QTask *com = new IK_QCenterOfMassTask(true, qroot, center);
-	com->SetWeight(weight);
+	com->SetUserWeight(weight);
 	qsolver->tasks.push_back(com);
+	qsolver->compiled = false;
 }
 #endif
 
-int IK_Solve(IK_Solver *solver, float tolerance, int max_iterations)
+void IK_SolverSetInvertMode(IK_Solver *solver, IK_InvertMode mode)
 {
 	if (solver == NULL)
-		return 0;
+		return;
 
 	IK_QSolver *qsolver = (IK_QSolver *)solver;
+	IK_QJacobian::InvertMode invert_mode;
+
+	switch (mode) {
+		case IK_INVERT_DLS:
+			invert_mode = IK_QJacobian::INVERT_DLS;
+			break;
+		case IK_INVERT_DLS_CHOLESKY:
+			invert_mode = IK_QJacobian::INVERT_DLS_CHOLESKY;
+			break;
+		case IK_INVERT_LM:
+			invert_mode = IK_QJacobian::INVERT_LM;
+			break;
+		case IK_INVERT_TRANSPOSE:
+			invert_mode = IK_QJacobian::INVERT_TRANSPOSE;
+			break;
+		default:
+			invert_mode = IK_QJacobian::INVERT_SDLS;
+			break;
+	}
+
+	qsolver->solver.SetInvertMode(invert_mode);
+	qsolver->instance_solvers_valid = false;
+}
 
+void IK_SolverSetPrecision(IK_Solver *solver, IK_Precision precision)
+{
+	if (solver == NULL)
+		return;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+
+	if (precision == IK_PRECISION_FLOAT)
+		qsolver->solver.SetPrecision(IK_QJacobian::PRECISION_FLOAT);
+	else
+		qsolver->solver.SetPrecision(IK_QJacobian::PRECISION_DOUBLE);
+
+	// the jacobians are created on compilation
+	qsolver->compiled = false;
+	qsolver->instance_solvers_valid = false;
+}
+
+void IK_SetSolverType(IK_Solver *solver, IK_SolverType type)
+{
+	if (solver == NULL)
+		return;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+
+	qsolver->type = type;
+	qsolver->compiled = false;
+	qsolver->instance_solvers_valid = false;
+}
+
+static bool Compile(IK_QSolver *qsolver)
+{
 	IK_QSegment *root = qsolver->root;
 	IK_QJacobianSolver& jacobian = qsolver->solver;
 	std::list<IK_QTask *>& tasks = qsolver->tasks;
+
+	// compile the tree and tasks only once, as long as they don't change
+	// only the goals and weights need to be updated between solves
+	if (!qsolver->compiled) {
+		IK_QSkeleton& skeleton = qsolver->skeleton;
+		IK_QSkeleton previous = skeleton;
+
+		skeleton.Setup(root, tasks);
+		qsolver->pose.Resize(skeleton);
+
+		// instances keep indices into the skeleton, a tree of the same size
+		// can still have its segments in other places
+		if (skeleton.Segments() != previous.Segments() || skeleton.Tasks() != previous.Tasks() ||
+		    !skeleton.SameTopology(previous))
+		{
+			qsolver->generation++;
+		}
+
+		// fall back to the jacobian solver for goals FABRIK and CCD can't
+		// handle
+		if (qsolver->type == IK_SOLVER_FABRIK && qsolver->fabrik.Setup(skeleton))
+			qsolver->used_type = IK_SOLVER_FABRIK;
+		else if (qsolver->type == IK_SOLVER_CCD && qsolver->ccd.Setup(skeleton))
+			qsolver->used_type = IK_SOLVER_CCD;
+		else if (jacobian.Setup(skeleton))
+			qsolver->used_type = IK_SOLVER_JACOBIAN;
+		else
+			return false;
+
+		qsolver->compiled = true;
+		qsolver->reweight = false;
+	}
+	else if (qsolver->reweight) {
+		// FABRIK and CCD don't weight goals
+		if (qsolver->used_type == IK_SOLVER_JACOBIAN && !jacobian.UpdateTaskWeights())
+			return false;
+
+		qsolver->reweight = false;
+	}
+
+	return true;
+}
+
+static int Solve(IK_QSolver *qsolver, float tolerance, int max_iterations, double time_budget)
+{
+	IK_QJacobianSolver& jacobian = qsolver->solver;
+	IK_QPose& pose = qsolver->pose;
 	double tol = tolerance;
 
-	if (!jacobian.Setup(root, tasks))
+	IK_SolveEnd((IK_Solver *)qsolver);
+
+	if (!Compile(qsolver))
 		return 0;
 
-	bool result = jacobian.Solve(root, tasks, tol, max_iterations);
+	bool result;
+
+	qsolver->skeleton.ReadPose(pose);
+
+	if (qsolver->used_type == IK_SOLVER_FABRIK)
+		result = qsolver->fabrik.Solve(pose, tol, max_iterations, time_budget);
+	else if (qsolver->used_type == IK_SOLVER_CCD)
+		result = qsolver->ccd.Solve(pose, tol, max_iterations, time_budget);
+	else
+		result = jacobian.Solve(pose, tol, max_iterations, time_budget);
+
+	qsolver->skeleton.WritePose(pose);
+
+	return ((result) ? 1 : 0);
+}
+
+int IK_Solve(IK_Solver *solver, float tolerance, int max_iterations)
+{
+	if (solver == NULL)
+		return 0;
+
+	return Solve((IK_QSolver *)solver, tolerance, max_iterations, 0.0);
+}
+
+int IK_SolveWithDeadline(IK_Solver *solver, float tolerance, int budget_us)
+{
+	if (solver == NULL)
+		return 0;
+
+	// the budget bounds the solve instead of the number of iterations
+	return Solve((IK_QSolver *)solver, tolerance, std::numeric_limits<int>::max(),
+	             (budget_us > 0) ? budget_us : 1);
+}
+
+// number of solvers IK_SolveBatch solves in lockstep. the data of all
+// of them is used every iteration, with many the jacobians and poses no
+// longer stay in cache between iterations
+static const int IK_BATCH_LANES = 4;
+
+int IK_SolveBatch(IK_Solver **solvers, int count, float tolerance, int max_iterations)
+{
+	if (solvers == NULL || count <= 0)
+		return 0;
+
+	std::vector<IK_QSolver *> batch, group;
+	std::vector<IK_QJacobianSolver *> group_solvers;
+	std::vector<IK_QPose *> group_poses;
+	int i, j, solved = 0;
+
+	// jacobian solvers are solved in lockstep, in groups of up to
+	// IK_BATCH_LANES with the same shape of tree, FABRIK and CCD one after
+	// the other
+	for (i = 0; i < count; i++) {
+		if (solvers[i] == NULL)
+			continue;
+
+		IK_QSolver *qsolver = (IK_QSolver *)solvers[i];
+
+		IK_SolveEnd(solvers[i]);
+
+		if (!Compile(qsolver))
+			continue;
+
+		if (qsolver->used_type == IK_SOLVER_JACOBIAN)
+			batch.push_back(qsolver);
+		else
+			solved += Solve(qsolver, tolerance, max_iterations, 0.0);
+	}
+
+	while (!batch.empty()) {
+		IK_QSolver *first = batch[0];
+
+		group.clear();
+		group_solvers.clear();
+		group_poses.clear();
+
+		for (i = 0, j = 0; i < (int)batch.size(); i++) {
+			IK_QSolver *qsolver = batch[i];
+
+			if ((int)group.size() < IK_BATCH_LANES && qsolver->skeleton.SameTopology(first->skeleton)) {
+				qsolver->skeleton.ReadPose(qsolver->pose);
+				group.push_back(qsolver);
+				group_solvers.push_back(&qsolver->solver);
+				group_poses.push_back(&qsolver->pose);
+			}
+			else
+				batch[j++] = qsolver;
+		}
+
+		batch.resize(j);
+
+		solved += IK_QJacobianSolver::SolveBatch(group_solvers, group_poses, tolerance, max_iterations);
+
+		for (i = 0; i < (int)group.size(); i++)
+			group[i]->skeleton.WritePose(group[i]->pose);
+	}
+
+	return solved;
+}
+
+IK_ThreadPool *IK_CreateThreadPool(int num_threads, int pin_threads)
+{
+	IK_QThreadPool *pool = new IK_QThreadPool(num_threads, pin_threads != 0);
+	return (IK_ThreadPool *)pool;
+}
+
+void IK_FreeThreadPool(IK_ThreadPool *pool)
+{
+	delete (IK_QThreadPool *)pool;
+}
+
+int IK_ThreadPoolGetNumThreads(IK_ThreadPool *pool)
+{
+	if (pool == NULL)
+		return 1;
+
+	return ((IK_QThreadPool *)pool)->NumThreads();
+}
+
+struct ParallelSolve {
+	IK_Solver **solvers;
+	float tolerance;
+	int max_iterations;
+	std::vector<char> solved;
+};
+
+static void ParallelSolveFunc(void *data, int index, int)
+{
+	ParallelSolve *ps = (ParallelSolve *)data;
+	IK_QSolver *qsolver = (IK_QSolver *)ps->solvers[index];
+
+	if (qsolver)
+		ps->solved[index] = (char)Solve(qsolver, ps->tolerance, ps->max_iterations, 0.0);
+}
+
+int IK_SolveParallel(IK_ThreadPool *pool, IK_Solver **solvers, int count, float tolerance, int max_iterations)
+{
+	if (pool == NULL)
+		return IK_SolveBatch(solvers, count, tolerance, max_iterations);
+	if (solvers == NULL || count <= 0)
+		return 0;
+
+	int i, solved = 0;
+
+	// compiling allocates the jacobians, from a rig arena that solvers may
+	// share, so do that up front. solving itself only touches the solver
+	// and its segments
+	for (i = 0; i < count; i++)
+		if (solvers[i]) {
+			IK_QSolver *qsolver = (IK_QSolver *)solvers[i];
+
+			IK_SolveEnd(solvers[i]);
+			Compile(qsolver);
+		}
+
+	ParallelSolve ps;
+	ps.solvers = solvers;
+	ps.tolerance = tolerance;
+	ps.max_iterations = max_iterations;
+	ps.solved.resize(count, 0);
+
+	((IK_QThreadPool *)pool)->Run(ParallelSolveFunc, &ps, count);
+
+	for (i = 0; i < count; i++)
+		solved += ps.solved[i];
+
+	return solved;
+}
+
+// instances
+
+// compile the definition and set up a solver per thread on its skeleton,
+// must not be called while solving. returns false if the definition can't
+// be solved
+static bool PrepareInstanceSolvers(IK_QSolver *qsolver, int num_threads)
+{
+	IK_SolveEnd((IK_Solver *)qsolver);
+
+	// compiling again or normalizing the weights changes what the solvers
+	// set up from the skeleton
+	if (!qsolver->compiled || qsolver->reweight)
+		qsolver->instance_solvers_valid = false;
+
+	if (!Compile(qsolver)) {
+		FreeInstanceSolvers(qsolver);
+		return false;
+	}
+
+	if (!qsolver->instance_solvers_valid) {
+		FreeInstanceSolvers(qsolver);
+		qsolver->instance_solvers_valid = true;
+	}
+
+	IK_QSkeleton& skeleton = qsolver->skeleton;
+
+	while ((int)qsolver->instance_solvers.size() < num_threads) {
+		IK_QInstanceSolver *isolver = new IK_QInstanceSolver();
+
+		isolver->pose.Resize(skeleton);
+
+		// Compile already checked the setup for the type used
+		if (qsolver->used_type == IK_SOLVER_FABRIK) {
+			isolver->fabrik.CopySettings(qsolver->fabrik);
+			isolver->fabrik.Setup(skeleton);
+		}
+		else if (qsolver->used_type == IK_SOLVER_CCD) {
+			isolver->ccd.CopySettings(qsolver->ccd);
+			isolver->ccd.Setup(skeleton);
+		}
+		else {
+			isolver->solver.CopySettings(qsolver->solver);
+			isolver->solver.Setup(skeleton);
+		}
+
+		qsolver->instance_solvers.push_back(isolver);
+	}
+
+	return true;
+}
+
+// index of a segment in the skeleton of the definition, or -1
+static int SegmentIndex(IK_QSolver *qsolver, const IK_QSegment *seg)
+{
+	const std::vector<IK_QSegment *>& segments = qsolver->skeleton.Segments();
+	int index = (seg) ? seg->Index() : -1;
+
+	// the index may be left from the skeleton of another solver
+	if (index < 0 || index >= (int)segments.size() || segments[index] != seg)
+		return -1;
+
+	return index;
+}
+
+IK_Instance *IK_CreateInstance(IK_Solver *solver, IK_Segment **segs, int count)
+{
+	if (solver == NULL)
+		return NULL;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+
+	if (!PrepareInstanceSolvers(qsolver, 0))
+		return NULL;
+
+	const std::vector<IK_QSegment *>& segments = qsolver->skeleton.Segments();
+	const std::vector<IK_QTask *>& tasks = qsolver->skeleton.Tasks();
+	IK_QInstance *instance = new IK_QInstance();
+	int i;
+
+	instance->definition = qsolver;
+	instance->generation = qsolver->generation;
+	instance->num_segments = (int)segments.size();
+	instance->num_tasks = (int)tasks.size();
+
+	// look up the pose segments once, the pose is set and read back every
+	// frame
+	for (i = 0; segs && i < count; i++) {
+		IK_QSegment *qseg = (IK_QSegment *)segs[i];
+		IK_QSegment *rot = qseg, *trans = qseg;
+
+		// same as IK_GetPoseChanges
+		if (qseg && qseg->Composite()) {
+			if (qseg->Translational())
+				rot = qseg->Composite();
+			else
+				trans = qseg->Composite();
+		}
+
+		instance->pose_rotation.push_back(SegmentIndex(qsolver, rot));
+		instance->pose_translation.push_back(SegmentIndex(qsolver, trans));
+	}
+	instance->state.resize(instance->num_segments * IK_QInstance::SEGMENT_SIZE +
+	                       instance->num_tasks * IK_QInstance::TASK_SIZE, 0.0f);
+
+	// start out with the pose and goals of the definition
+	for (i = 0; i < instance->num_segments; i++) {
+		Eigen::Quaternionf rot(Eigen::Quaterniond(segments[i]->Basis()).cast<float>());
+
+		Eigen::Map<Eigen::Quaternionf>(instance->StartRotation(i)) = rot;
+		Eigen::Map<Eigen::Quaternionf>(instance->SolvedRotation(i)) = rot;
+	}
+
+	for (i = 0; i < instance->num_tasks; i++) {
+		if (tasks[i]->PositionTask())
+			Eigen::Map<Eigen::Vector3f>(instance->Goal(i)) =
+				((IK_QPositionTask *)tasks[i])->Goal().cast<float>();
+		else
+			Eigen::Map<Eigen::Matrix3f>(instance->Goal(i)) =
+				((IK_QOrientationTask *)tasks[i])->Goal().cast<float>();
+	}
+
+	return (IK_Instance *)instance;
+}
+
+void IK_FreeInstance(IK_Instance *instance)
+{
+	delete (IK_QInstance *)instance;
+}
+
+// goal of the instance of the given type, or -1
+static int TaskIndex(IK_QInstance *instance, int goal, bool position)
+{
+	IK_QSolver *definition = instance->definition;
+
+	if (instance->generation != definition->generation || goal < 0 || goal >= instance->num_tasks)
+		return -1;
+	if (definition->skeleton.Tasks()[goal]->PositionTask() != position)
+		return -1;
+
+	return goal;
+}
+
+void IK_InstanceSetGoal(IK_Instance *instance, int goal, float position[3])
+{
+	if (instance == NULL)
+		return;
+
+	IK_QInstance *qinstance = (IK_QInstance *)instance;
+	int index = TaskIndex(qinstance, goal, true);
+
+	if (index >= 0)
+		Eigen::Map<Eigen::Vector3f>(qinstance->Goal(index)) = Eigen::Map<Eigen::Vector3f>(position);
+}
+
+void IK_InstanceSetGoalOrientation(IK_Instance *instance, int goal, float orientation[][3])
+{
+	if (instance == NULL)
+		return;
+
+	IK_QInstance *qinstance = (IK_QInstance *)instance;
+	int index = TaskIndex(qinstance, goal, false);
+
+	// blender column major is the same as eigen's
+	if (index >= 0)
+		Eigen::Map<Eigen::Matrix3f>(qinstance->Goal(index)) = Eigen::Map<Eigen::Matrix3f>(&orientation[0][0]);
+}
+
+template <IK_TransformLayout layout, int stride>
+static void InstanceSetPose(IK_QInstance *instance, const float *basis)
+{
+	int i, count = (int)instance->pose_rotation.size();
+	Matrix3d rot;
+	Vector3d unused;
+
+	for (i = 0; i < count; i++) {
+		int index = instance->pose_rotation[i];
+
+		if (index < 0)
+			continue;
+
+		ReadTransform<layout>(basis + i * stride, rot, unused);
+		Eigen::Map<Eigen::Quaternionf>(instance->StartRotation(index)) =
+			Eigen::Quaterniond(rot).cast<float>();
+	}
+}
+
+template <IK_TransformLayout layout, int stride>
+static void InstanceGetPoseChanges(IK_QInstance *instance, float *changes)
+{
+	int i, count = (int)instance->pose_rotation.size();
+
+	for (i = 0; i < count; i++) {
+		int rot_index = instance->pose_rotation[i];
+		int trans_index = instance->pose_translation[i];
+
+		if (rot_index < 0 || trans_index < 0)
+			continue;
+
+		Eigen::Map<Eigen::Quaternionf> start(instance->StartRotation(rot_index));
+		Eigen::Map<Eigen::Quaternionf> solved(instance->SolvedRotation(rot_index));
+		Eigen::Map<Eigen::Vector3f> translation(instance->TranslationChange(trans_index));
+
+		Matrix3d change = (start.conjugate() * solved).cast<double>().toRotationMatrix();
+
+		WriteTransform<layout>(changes + i * stride, change, translation.cast<double>());
+	}
+}
+
+void IK_InstanceSetPose(IK_Instance *instance, IK_TransformLayout layout, const float *basis)
+{
+	if (instance == NULL || basis == NULL)
+		return;
+
+	IK_QInstance *qinstance = (IK_QInstance *)instance;
+
+	if (layout == IK_LAYOUT_MATRIX3X4)
+		InstanceSetPose<IK_LAYOUT_MATRIX3X4, 12>(qinstance, basis);
+	else
+		InstanceSetPose<IK_LAYOUT_QUATERNION, 7>(qinstance, basis);
+}
+
+void IK_InstanceGetPoseChanges(IK_Instance *instance, IK_TransformLayout layout, float *changes)
+{
+	if (instance == NULL || changes == NULL)
+		return;
+
+	IK_QInstance *qinstance = (IK_QInstance *)instance;
+
+	if (layout == IK_LAYOUT_MATRIX3X4)
+		InstanceGetPoseChanges<IK_LAYOUT_MATRIX3X4, 12>(qinstance, changes);
+	else
+		InstanceGetPoseChanges<IK_LAYOUT_QUATERNION, 7>(qinstance, changes);
+}
+
+static int SolveInstance(IK_QInstance *instance, int thread, float tolerance, int max_iterations)
+{
+	IK_QSolver *definition = instance->definition;
+
+	// the tree or goals of the definition changed since the instance was
+	// created, or it can't be solved
+	if (instance->generation != definition->generation || definition->instance_solvers.empty())
+		return 0;
+
+	IK_QInstanceSolver *isolver = definition->instance_solvers[thread];
+	const IK_QSkeleton& skeleton = definition->skeleton;
+	const std::vector<IK_QSegment *>& segments = skeleton.Segments();
+	const std::vector<IK_QTask *>& tasks = skeleton.Tasks();
+	IK_QPose& pose = isolver->pose;
+	double tol = tolerance;
+	int i;
+	bool result;
+
+	// the definition is only read, the instance goes into the pose of the
+	// thread
+	for (i = 0; i < instance->num_segments; i++) {
+		Eigen::Map<Eigen::Quaternionf> start(instance->StartRotation(i));
+		segments[i]->ReadPose(pose, start.cast<double>().toRotationMatrix());
+	}
+
+	for (i = 0; i < instance->num_tasks; i++) {
+		if (tasks[i]->PositionTask())
+			pose.goal[i] = Eigen::Map<Eigen::Vector3f>(instance->Goal(i)).cast<double>();
+		else
+			pose.goal_rotation[i] = Eigen::Map<Eigen::Matrix3f>(instance->Goal(i)).cast<double>();
+	}
+
+	pose.scale = 1.0;
+
+	if (definition->used_type == IK_SOLVER_FABRIK)
+		result = isolver->fabrik.Solve(pose, tol, max_iterations, 0.0);
+	else if (definition->used_type == IK_SOLVER_CCD)
+		result = isolver->ccd.Solve(pose, tol, max_iterations, 0.0);
+	else
+		result = isolver->solver.Solve(pose, tol, max_iterations, 0.0);
+
+	for (i = 0; i < instance->num_segments; i++) {
+		Eigen::Map<Eigen::Quaternionf>(instance->SolvedRotation(i)) =
+			Eigen::Quaterniond(segments[i]->Basis(pose)).cast<float>();
+		Eigen::Map<Eigen::Vector3f>(instance->TranslationChange(i)) =
+			segments[i]->TranslationChange(pose).cast<float>();
+	}
 
 	return ((result) ? 1 : 0);
 }
 
+struct InstanceSolve {
+	IK_Instance **instances;
+	float tolerance;
+	int max_iterations;
+	std::vector<char> solved;
+};
+
+static void InstanceSolveFunc(void *data, int index, int thread)
+{
+	InstanceSolve *is = (InstanceSolve *)data;
+	IK_QInstance *instance = (IK_QInstance *)is->instances[index];
+
+	if (instance)
+		is->solved[index] = (char)SolveInstance(instance, thread, is->tolerance, is->max_iterations);
+}
+
+int IK_SolveInstances(IK_ThreadPool *pool, IK_Instance **instances, int count, float tolerance, int max_iterations)
+{
+	if (instances == NULL || count <= 0)
+		return 0;
+
+	int num_threads = IK_ThreadPoolGetNumThreads(pool);
+	int i, solved = 0;
+	IK_QSolver *prepared = NULL;
+
+	// the solvers per thread are set up front, solving only reads the
+	// definition and writes the solver and pose of the thread and the
+	// instance. instances of one definition usually come together, check
+	// it once for them
+	for (i = 0; i < count; i++) {
+		IK_QInstance *instance = (IK_QInstance *)instances[i];
+
+		if (instance && instance->definition != prepared) {
+			PrepareInstanceSolvers(instance->definition, num_threads);
+			prepared = instance->definition;
+		}
+	}
+
+	InstanceSolve is;
+	is.instances = instances;
+	is.tolerance = tolerance;
+	is.max_iterations = max_iterations;
+	is.solved.resize(count, 0);
+
+	if (pool)
+		((IK_QThreadPool *)pool)->Run(InstanceSolveFunc, &is, count);
+	else
+		for (i = 0; i < count; i++)
+			InstanceSolveFunc(&is, i, 0);
+
+	for (i = 0; i < count; i++)
+		solved += is.solved[i];
+
+	return solved;
+}
+
+void IK_SolveBegin(IK_Solver *solver, float tolerance)
+{
+	if (solver == NULL)
+		return;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+
+	IK_SolveEnd(solver);
+
+	qsolver->stepping = true;
+	qsolver->step_tolerance = tolerance;
+	qsolver->step_solved = false;
+
+	if (!Compile(qsolver)) {
+		qsolver->step_finished = true;
+		return;
+	}
+
+	qsolver->step_finished = false;
+	qsolver->skeleton.ReadPose(qsolver->pose);
+
+	if (qsolver->used_type == IK_SOLVER_JACOBIAN)
+		qsolver->solver.Begin(qsolver->pose, tolerance);
+}
+
+int IK_SolveStep(IK_Solver *solver, int iterations)
+{
+	if (solver == NULL)
+		return 1;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+	IK_QPose& pose = qsolver->pose;
+	double tol = qsolver->step_tolerance;
+
+	if (!qsolver->stepping || qsolver->step_finished)
+		return 1;
+
+	// the jacobian solver works on a scaled pose, which is only copied
+	// back to the segments at the end
+	if (qsolver->used_type == IK_SOLVER_JACOBIAN) {
+		qsolver->step_finished = qsolver->solver.Step(pose, iterations, 0.0);
+		return (qsolver->step_finished) ? 1 : 0;
+	}
+
+	// FABRIK and CCD start from the current pose anyway, solving again
+	// continues where the last step stopped. using fewer iterations than
+	// allowed means they converged or stalled
+	IK_QFABRIKSolver& fabrik = qsolver->fabrik;
+	IK_QCCDSolver& ccd = qsolver->ccd;
+	int used;
+
+	if (qsolver->used_type == IK_SOLVER_FABRIK) {
+		qsolver->step_solved = fabrik.Solve(pose, tol, iterations, 0.0);
+		used = fabrik.Iterations();
+	}
+	else {
+		qsolver->step_solved = ccd.Solve(pose, tol, iterations, 0.0);
+		used = ccd.Iterations();
+	}
+
+	qsolver->skeleton.WritePose(pose);
+	qsolver->step_finished = (qsolver->step_solved || used < iterations);
+
+	return (qsolver->step_finished) ? 1 : 0;
+}
+
+int IK_SolveEnd(IK_Solver *solver)
+{
+	if (solver == NULL)
+		return 0;
+
+	IK_QSolver *qsolver = (IK_QSolver *)solver;
+
+	if (!qsolver->stepping)
+		return 0;
+
+	qsolver->stepping = false;
+
+	if (qsolver->solver.Solving()) {
+		qsolver->step_solved = qsolver->solver.End(qsolver->pose);
+		qsolver->skeleton.WritePose(qsolver->pose);
+	}
+
+	return (qsolver->step_solved) ? 1 : 0;
+}
+
@@ -0,0 +1,378 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/test/IK_AllocTest.cpp
+ *  \ingroup iksolver
+ */
+
+/**
+ * Checks that solving again doesn't allocate memory, once a solver has
+ * been solved for the first time. operator new is replaced by a version
+ * that counts allocations, and on glibc malloc too, which eigen uses for
+ * dynamically sized matrices.
+ */
+
+#include "IK_solver.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+static bool counting = false;
+static long allocations = 0;
+
+static void *CountedAllocate(size_t size)
+{
+	if (counting)
+		allocations++;
+
+	void *ptr = malloc(size ? size : 1);
+
+	if (ptr == NULL)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void *operator new(size_t size)
+{
+	return CountedAllocate(size);
+}
+
+void *operator new[](size_t size)
+{
+	return CountedAllocate(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	if (counting)
+		allocations++;
+
+	return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	if (counting)
+		allocations++;
+
+	return malloc(size ? size : 1);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	free(ptr);
+}
+
+#ifdef __GLIBC__
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t num, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	if (counting)
+		allocations++;
+
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size)
+{
+	if (counting)
+		allocations++;
+
+	return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (counting)
+		allocations++;
+
+	return __libc_realloc(ptr, size);
+}
+
+}
+#endif
+
+struct Rig {
+	std::vector<IK_Segment *> segments;
+	std::vector<IK_Segment *> tips;
+	// rest position of the tips, the goals move around them
+	std::vector<float> rest;
+	IK_Segment *root;
+};
+
+// chain of unit length segments along y, starting at offset from the end
+// of parent, which ends at end
+static IK_Segment *AddChain(Rig& rig, IK_Segment *parent, int num, int flag, float limit,
+                            const float offset[3], float end[3])
+{
+	float identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+	float zero[3] = {0, 0, 0};
+	int i;
+
+	for (i = 0; i < num; i++) {
+		IK_Segment *seg = IK_CreateSegment(flag);
+
+		IK_SetTransform(seg, (i == 0) ? (float *)offset : zero, identity, identity, 1.0f);
+
+		if (limit > 0.0f) {
+			IK_SetLimit(seg, IK_X, -limit, limit);
+			IK_SetLimit(seg, IK_Z, -limit, limit);
+		}
+
+		if (parent)
+			IK_SetParent(seg, parent);
+		else
+			rig.root = seg;
+
+		rig.segments.push_back(seg);
+		parent = seg;
+	}
+
+	end[0] += offset[0];
+	end[1] += offset[1] + num;
+	end[2] += offset[2];
+
+	return parent;
+}
+
+static void AddTip(Rig& rig, IK_Segment *tip, const float end[3])
+{
+	rig.tips.push_back(tip);
+	rig.rest.insert(rig.rest.end(), end, end + 3);
+}
+
+static void CreateChain(Rig& rig, int num)
+{
+	float offset[3] = {0, 0, 0}, end[3] = {0, 0, 0};
+
+	AddTip(rig, AddChain(rig, NULL, num, IK_XDOF | IK_ZDOF, 0.0f, offset, end), end);
+}
+
+// a hip with a spine and neck, two legs of two segments, of which one
+// with a pole vector, and two of three segments with limits
+static void CreateHound(Rig& rig)
+{
+	const int rotation = IK_XDOF | IK_YDOF | IK_ZDOF;
+	float zero[3] = {0, 0, 0}, hip[3] = {0, 0, 0};
+	int i;
+
+	IK_Segment *root = AddChain(rig, NULL, 1, rotation | IK_TRANS_XDOF | IK_TRANS_YDOF | IK_TRANS_ZDOF,
+	                            0.0f, zero, hip);
+
+	float shoulder[3] = {hip[0], hip[1], hip[2]};
+	IK_Segment *spine = AddChain(rig, root, 3, IK_XDOF | IK_ZDOF, 0.3f, zero, shoulder);
+
+	float head[3] = {shoulder[0], shoulder[1], shoulder[2]};
+	AddTip(rig, AddChain(rig, spine, 2, rotation, 0.0f, zero, head), head);
+
+	for (i = 0; i < 4; i++) {
+		float offset[3] = {(i % 2) ? 0.5f : -0.5f, 0, 0};
+		float end[3];
+		IK_Segment *parent = (i < 2) ? spine : root;
+		const float *base = (i < 2) ? shoulder : hip;
+
+		end[0] = base[0];
+		end[1] = base[1];
+		end[2] = base[2];
+
+		if (i < 2)
+			AddTip(rig, AddChain(rig, parent, 2, IK_XDOF | IK_ZDOF, 0.0f, offset, end), end);
+		else
+			AddTip(rig, AddChain(rig, parent, 3, IK_XDOF | IK_ZDOF, 0.8f, offset, end), end);
+	}
+}
+
+static void FreeRig(Rig& rig)
+{
+	std::vector<IK_Segment *>::iterator seg;
+
+	for (seg = rig.segments.begin(); seg != rig.segments.end(); seg++)
+		IK_FreeSegment(*seg);
+}
+
+struct Config {
+	const char *name;
+	// number of segments of a chain, or 0 for the hound
+	int num_segments;
+	IK_SolverType type;
+	IK_InvertMode mode;
+	bool orientation;
+	bool warm_start;
+	int budget_us;
+	int solves;
+};
+
+// solve for goals moving smoothly around the rest pose, and return the
+// number of allocations made after the first solve
+static long Run(const Config& config)
+{
+	Rig rig;
+	std::vector<IK_Task *> tasks;
+	IK_Task *orientation = NULL;
+	float goal[3], basis[3][3];
+	size_t i;
+	int solve;
+
+	if (config.num_segments)
+		CreateChain(rig, config.num_segments);
+	else
+		CreateHound(rig);
+
+	IK_Solver *solver = IK_CreateSolver(rig.root);
+
+	for (i = 0; i < rig.tips.size(); i++)
+		tasks.push_back(IK_SolverAddGoal(solver, rig.tips[i], &rig.rest[i * 3], 1.0f));
+
+	if (config.orientation) {
+		float identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+		orientation = IK_SolverAddGoalOrientation(solver, rig.tips[0], identity, 0.5f);
+	}
+
+	if (config.num_segments == 0) {
+		float pole[3] = {rig.rest[3], rig.rest[4], rig.rest[5] + 1.0f};
+		IK_SolverSetPoleVectorConstraint(solver, rig.tips[1], &rig.rest[3], pole, 0.0f, 0);
+	}
+
+	IK_SetSolverType(solver, config.type);
+	IK_SolverSetInvertMode(solver, config.mode);
+
+	if (config.warm_start)
+		IK_SolverSetWarmStart(solver, 1, 1e-4f);
+
+	for (solve = 0; solve <= config.solves; solve++) {
+		float time = solve * 0.05f;
+
+		for (i = 0; i < tasks.size(); i++) {
+			float reach = (config.num_segments ? config.num_segments : 2) * 0.3f;
+			float phase = time + i;
+
+			goal[0] = rig.rest[i * 3 + 0] + reach * sinf(phase);
+			goal[1] = rig.rest[i * 3 + 1] - reach * (1.0f - cosf(phase * 0.7f));
+			goal[2] = rig.rest[i * 3 + 2] + reach * sinf(phase * 1.3f);
+
+			// hold the goals now and then, for warm start hits
+			if ((solve / 10) % 3 != 2)
+				IK_SolverSetGoal(solver, tasks[i], goal);
+		}
+
+		if (orientation) {
+			float c = cosf(0.5f * sinf(time)), s = sinf(0.5f * sinf(time));
+
+			basis[0][0] = c; basis[0][1] = -s; basis[0][2] = 0;
+			basis[1][0] = s; basis[1][1] = c; basis[1][2] = 0;
+			basis[2][0] = 0; basis[2][1] = 0; basis[2][2] = 1;
+			IK_SolverSetGoalOrientation(solver, orientation, basis);
+		}
+
+		if (config.budget_us)
+			IK_SolveWithDeadline(solver, 1e-6f, config.budget_us);
+		else
+			IK_Solve(solver, 1e-4f, 100);
+
+		// the first solve compiles the solver
+		if (solve == 0) {
+			allocations = 0;
+			counting = true;
+		}
+	}
+
+	counting = false;
+
+	IK_FreeSolver(solver);
+	FreeRig(rig);
+
+	return allocations;
+}
+
+int main()
+{
+	std::vector<Config> configs;
+	const int lengths[] = {4, 8, 20};
+	static char names[64][64];
+	int num_names = 0, failed = 0;
+	size_t i;
+	int l, m, o;
+
+	Config hound = {"hound", 0, IK_SOLVER_JACOBIAN, IK_INVERT_SDLS, false, false, 0, 10000};
+	configs.push_back(hound);
+
+	for (l = 0; l < 3; l++) {
+		for (m = IK_INVERT_SDLS; m <= IK_INVERT_TRANSPOSE; m++) {
+			for (o = 0; o < 2; o++) {
+				Config config = {names[num_names], lengths[l], IK_SOLVER_JACOBIAN, (IK_InvertMode)m, o == 1, false, 0, 200};
+				snprintf(names[num_names++], sizeof(names[0]), "chain %d, mode %d%s", lengths[l], m,
+				         o ? ", orientation" : "");
+				configs.push_back(config);
+			}
+		}
+
+		Config fabrik = {names[num_names], lengths[l], IK_SOLVER_FABRIK, IK_INVERT_SDLS, false, false, 0, 200};
+		snprintf(names[num_names++], sizeof(names[0]), "chain %d, fabrik", lengths[l]);
+		configs.push_back(fabrik);
+
+		Config ccd = {names[num_names], lengths[l], IK_SOLVER_CCD, IK_INVERT_SDLS, false, false, 0, 200};
+		snprintf(names[num_names++], sizeof(names[0]), "chain %d, ccd", lengths[l]);
+		configs.push_back(ccd);
+	}
+
+	Config warm_start = {"hound, warm start", 0, IK_SOLVER_JACOBIAN, IK_INVERT_SDLS, false, true, 0, 1000};
+	configs.push_back(warm_start);
+
+	Config deadline = {"chain 20, lm with deadline", 20, IK_SOLVER_JACOBIAN, IK_INVERT_LM, true, false, 20, 1000};
+	configs.push_back(deadline);
+
+	for (i = 0; i < configs.size(); i++) {
+		long count = Run(configs[i]);
+
+		printf("%-32s %6d solves %6ld allocations\n", configs[i].name, configs[i].solves, count);
+
+		if (count != 0)
+			failed++;
+	}
+
+	if (failed) {
+		printf("%d of %d configurations allocated memory\n", failed, (int)configs.size());
+		return 1;
+	}
+
+	return 0;
+}
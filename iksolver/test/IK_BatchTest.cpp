@@ -0,0 +1,230 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/test/IK_BatchTest.cpp
+ *  \ingroup iksolver
+ */
+
+/**
+ * Checks that IK_SolveBatch gives the same results as IK_Solve. Two sets of
+ * the same characters are solved over a number of frames with moving goals,
+ * one with IK_Solve per solver and one with IK_SolveBatch. The batch mixes
+ * legs and arms, which are solved in lockstep as two groups, with FABRIK
+ * legs that are solved on their own, and a NULL entry. Every solver must
+ * converge the same, take the same number of iterations and end up in the
+ * same pose as its copy.
+ */
+
+#include "IK_solver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+struct Character {
+	std::vector<IK_Segment *> segments;
+	std::vector<IK_Task *> tasks;
+	IK_Solver *solver;
+};
+
+static IK_Segment *AddSegment(Character& character, int flag, IK_Segment *parent,
+                              float x, float length)
+{
+	const float basis[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+	float start[3] = {x, 0, 0};
+	float rest[3][3], mbasis[3][3];
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			rest[i][j] = basis[i][j];
+			mbasis[i][j] = basis[i][j];
+		}
+	}
+
+	IK_Segment *seg = IK_CreateSegment(flag);
+	IK_SetTransform(seg, start, rest, mbasis, length);
+
+	if (parent)
+		IK_SetParent(seg, parent);
+
+	character.segments.push_back(seg);
+
+	return seg;
+}
+
+// a leg with limits, or a torso with two arms, with a goal per end
+static void CreateCharacter(Character& character, bool arms, IK_SolverType type)
+{
+	float goal[3] = {0, 0, 0};
+	int i;
+
+	if (arms) {
+		IK_Segment *torso = AddSegment(character, IK_XDOF | IK_ZDOF, NULL, 0, 0.6f);
+		IK_Segment *hands[2];
+
+		for (i = 0; i < 2; i++) {
+			IK_Segment *upper = AddSegment(character, IK_XDOF | IK_YDOF | IK_ZDOF, torso,
+			                               (i) ? 0.3f : -0.3f, 0.5f);
+			hands[i] = AddSegment(character, IK_XDOF, upper, 0, 0.5f);
+		}
+
+		character.solver = IK_CreateSolver(torso);
+
+		for (i = 0; i < 2; i++)
+			character.tasks.push_back(IK_SolverAddGoal(character.solver, hands[i], goal, 1.0f));
+	}
+	else {
+		IK_Segment *thigh = AddSegment(character, IK_XDOF | IK_YDOF | IK_ZDOF, NULL, 0, 1.0f);
+		IK_Segment *shin = AddSegment(character, IK_XDOF, thigh, 0, 0.9f);
+		IK_Segment *foot = AddSegment(character, IK_XDOF | IK_ZDOF, shin, 0, 0.3f);
+
+		IK_SetLimit(thigh, IK_X, -1.5f, 1.5f);
+		IK_SetLimit(shin, IK_X, 0.0f, 2.5f);
+		IK_SetLimit(foot, IK_Z, -0.5f, 0.5f);
+
+		character.solver = IK_CreateSolver(thigh);
+		character.tasks.push_back(IK_SolverAddGoal(character.solver, foot, goal, 1.0f));
+	}
+
+	IK_SetSolverType(character.solver, type);
+}
+
+static void FreeCharacter(Character& character)
+{
+	int i;
+
+	IK_FreeSolver(character.solver);
+
+	for (i = (int)character.segments.size() - 1; i >= 0; i--)
+		IK_FreeSegment(character.segments[i]);
+}
+
+static void SetGoals(Character& character, int index, int frame)
+{
+	int i;
+
+	for (i = 0; i < (int)character.tasks.size(); i++) {
+		double t = frame * 0.2 + index * 0.7 + i * 1.3;
+		float goal[3];
+
+		goal[0] = 0.8f * (float)cos(t) + ((i) ? 0.3f : -0.3f) * (character.tasks.size() > 1);
+		goal[1] = 1.2f + 0.4f * (float)sin(0.7 * t);
+		goal[2] = 0.8f * (float)sin(t);
+
+		IK_SolverSetGoal(character.solver, character.tasks[i], goal);
+	}
+}
+
+// largest difference between the poses of the segments of two characters
+static double PoseDifference(Character& a, Character& b)
+{
+	double difference = 0.0;
+	int i, j, k;
+
+	for (i = 0; i < (int)a.segments.size(); i++) {
+		float basis_a[3][3], basis_b[3][3];
+
+		IK_GetBasisChange(a.segments[i], basis_a);
+		IK_GetBasisChange(b.segments[i], basis_b);
+
+		for (j = 0; j < 3; j++)
+			for (k = 0; k < 3; k++)
+				difference = std::max(difference, (double)fabsf(basis_a[j][k] - basis_b[j][k]));
+	}
+
+	return difference;
+}
+
+int main()
+{
+	const int num_characters = 14, frames = 50;
+	const float tolerance = 1e-3f;
+	std::vector<Character> single(num_characters), batch(num_characters);
+	std::vector<IK_Solver *> solvers;
+	double max_difference = 0.0;
+	int converged = 0, batch_converged = 0, converged_differs = 0, iterations_differ = 0;
+	int i, frame;
+
+	// eight legs and four pairs of arms with the jacobian solver, and two
+	// FABRIK legs
+	for (i = 0; i < num_characters; i++) {
+		bool arms = (i % 3 == 1 && i < 12);
+		IK_SolverType type = (i >= 12) ? IK_SOLVER_FABRIK : IK_SOLVER_JACOBIAN;
+
+		CreateCharacter(single[i], arms, type);
+		CreateCharacter(batch[i], arms, type);
+
+		solvers.push_back(batch[i].solver);
+		if (i == 6)
+			solvers.push_back(NULL);
+	}
+
+	for (frame = 0; frame < frames; frame++) {
+		int solved = 0;
+
+		for (i = 0; i < num_characters; i++) {
+			SetGoals(single[i], i, frame);
+			SetGoals(batch[i], i, frame);
+
+			solved += IK_Solve(single[i].solver, tolerance, 40);
+		}
+
+		int batch_solved = IK_SolveBatch(&solvers[0], (int)solvers.size(), tolerance, 40);
+
+		converged += solved;
+		batch_converged += batch_solved;
+		if (solved != batch_solved)
+			converged_differs++;
+
+		for (i = 0; i < num_characters; i++) {
+			if (IK_SolverGetIterations(single[i].solver) != IK_SolverGetIterations(batch[i].solver))
+				iterations_differ++;
+
+			max_difference = std::max(max_difference, PoseDifference(single[i], batch[i]));
+		}
+	}
+
+	printf("converged %d/%d with IK_Solve, %d/%d with IK_SolveBatch, iterations differ in %d "
+	       "solves, poses differ by at most %.1e\n",
+	       converged, num_characters * frames, batch_converged, num_characters * frames,
+	       iterations_differ, max_difference);
+
+	bool ok = (converged_differs == 0 && iterations_differ == 0 && max_difference <= 1e-6);
+
+	if (!ok)
+		printf("FAILED\n");
+
+	for (i = 0; i < num_characters; i++) {
+		FreeCharacter(single[i]);
+		FreeCharacter(batch[i]);
+	}
+
+	return (ok) ? 0 : 1;
+}
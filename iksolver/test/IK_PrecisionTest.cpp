@@ -0,0 +1,154 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/test/IK_PrecisionTest.cpp
+ *  \ingroup iksolver
+ */
+
+/**
+ * Compares the single precision jacobian with the double precision one on
+ * chains following a circling goal, as set with IK_SolverSetPrecision.
+ * This checks that float converges as often and in about as many
+ * iterations, and prints the time taken by both.
+ */
+
+#include "IK_QJacobianSolver.h"
+#include "IK_QSegment.h"
+#include "IK_QTask.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+struct Result {
+	double time;
+	long iterations;
+	int converged;
+};
+
+static double Time()
+{
+	std::chrono::steady_clock::duration time = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration<double, std::micro>(time).count();
+}
+
+// chain of num segments of unit length with two rotation DoFs each,
+// solved for a goal moving on a circle around the chain. each solve starts
+// from the rest pose, continuing from the last pose the two precisions
+// end up in different poses after a while and solve different problems
+static Result Run(int num, IK_QJacobian::InvertMode mode, IK_QJacobian::Precision precision, int solves)
+{
+	std::vector<IK_QSegment *> segments;
+	IK_QSegment *parent = NULL;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		IK_QSegment *seg = new IK_QSwingSegment();
+		seg->SetTransform(Vector3d(0, 0, 0), Matrix3d::Identity(), Matrix3d::Identity(), 1.0);
+
+		if (parent)
+			seg->SetParent(parent);
+
+		segments.push_back(seg);
+		parent = seg;
+	}
+
+	IK_QPositionTask *task = new IK_QPositionTask(true, parent, Vector3d(0, num, 0));
+	std::list<IK_QTask *> tasks(1, task);
+
+	IK_QSkeleton skeleton;
+	IK_QPose pose;
+
+	skeleton.Setup(segments[0], tasks);
+	pose.Resize(skeleton);
+
+	IK_QJacobianSolver solver;
+	solver.SetInvertMode(mode);
+	solver.SetPrecision(precision);
+
+	Result result = {0.0, 0, 0};
+
+	if (solver.Setup(skeleton)) {
+		for (i = 0; i < solves; i++) {
+			double t = i * 0.5;
+			task->SetGoal(Vector3d(0.4 * num * cos(t), 0.6 * num + 0.2 * num * sin(2.0 * t), 0.4 * num * sin(t)));
+
+			segments[0]->Reset();
+			skeleton.ReadPose(pose);
+
+			double start = Time();
+			result.converged += solver.Solve(pose, 1e-3, 500, 0.0);
+			result.time += Time() - start;
+			result.iterations += solver.Iterations();
+		}
+	}
+
+	delete task;
+
+	for (i = num - 1; i >= 0; i--)
+		delete segments[i];
+
+	return result;
+}
+
+int main()
+{
+	const IK_QJacobian::InvertMode modes[] = {
+		IK_QJacobian::INVERT_SDLS, IK_QJacobian::INVERT_DLS, IK_QJacobian::INVERT_DLS_CHOLESKY};
+	const char *mode_names[] = {"sdls", "dls", "dls_cholesky"};
+	const int chains[] = {4, 8, 20, 40};
+	const int solves = 2000;
+	int failed = 0;
+	int c, m;
+
+	printf("%-8s %-13s %16s %16s %14s\n", "segments", "mode", "us/solve d/f", "iters d/f", "conv d/f");
+
+	for (c = 0; c < 4; c++) {
+		for (m = 0; m < 3; m++) {
+			Result d = Run(chains[c], modes[m], IK_QJacobian::PRECISION_DOUBLE, solves);
+			Result f = Run(chains[c], modes[m], IK_QJacobian::PRECISION_FLOAT, solves);
+
+			double d_iterations = (double)d.iterations / solves;
+			double f_iterations = (double)f.iterations / solves;
+
+			// float may need somewhat more iterations near singular poses
+			bool ok = (f.converged >= d.converged - solves / 50) &&
+			          (f_iterations <= 1.5 * d_iterations + 1.0);
+
+			printf("%-8d %-13s %7.1f %7.1f  %7.1f %7.1f  %6d %6d%s\n", chains[c], mode_names[m],
+			       d.time / solves, f.time / solves, d_iterations, f_iterations,
+			       d.converged, f.converged, ok ? "" : "  FAILED");
+
+			if (!ok)
+				failed++;
+		}
+	}
+
+	return (failed) ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/test/IK_TransposeTest.cpp
+ *  \ingroup iksolver
+ */
+
+/**
+ * Checks that the jacobian transpose step weights the DoFs as DLS does.
+ * With a large damping term the DLS step tends to the direction of the
+ * weighted gradient, so on a bent chain with stiff and loose DoFs both
+ * steps must point the same way, for any goal.
+ */
+
+#include "IK_QJacobian.h"
+#include "IK_QPose.h"
+#include "IK_QSegment.h"
+#include "IK_QTask.h"
+
+#include <cmath>
+#include <cstdio>
+#include <list>
+#include <vector>
+
+static double Cosine(const IK_QJacobian& a, const IK_QJacobian& b, int dof)
+{
+	double dot = 0.0, norm_a = 0.0, norm_b = 0.0;
+	int i;
+
+	for (i = 0; i < dof; i++) {
+		dot += a.AngleUpdate(i) * b.AngleUpdate(i);
+		norm_a += a.AngleUpdate(i) * a.AngleUpdate(i);
+		norm_b += b.AngleUpdate(i) * b.AngleUpdate(i);
+	}
+
+	return dot / sqrt(norm_a * norm_b);
+}
+
+// step of the given mode for a chain with the given DoF weights, for the
+// goal the task has
+static void Step(IK_QJacobian& jacobian, IK_QJacobian::InvertMode mode, IK_QPose& pose,
+                 std::vector<IK_QSegment *>& segments, IK_QTask& task, bool weighted)
+{
+	int dof = (int)segments.size() * 2;
+	int i, j;
+
+	jacobian.ArmMatrices(dof, 3);
+	jacobian.SetInvertMode(mode);
+	jacobian.SetDamping(1e4);
+
+	for (i = 0; i < (int)segments.size(); i++)
+		for (j = 0; j < 2; j++)
+			jacobian.SetDoFWeight(segments[i]->DoFId() + j, (weighted) ? segments[i]->Weight(j) : 1.0);
+
+	task.ComputeJacobian(pose, jacobian);
+	jacobian.Invert();
+}
+
+int main()
+{
+	const int num = 6;
+	const int goals = 20;
+	std::vector<IK_QSegment *> segments;
+	IK_QSegment *parent = NULL;
+	int failed = 0;
+	int i;
+
+	// a bent chain of swing segments, alternately stiff around X and Z
+	for (i = 0; i < num; i++) {
+		IK_QSegment *seg = new IK_QSwingSegment();
+		Matrix3d basis = (Eigen::AngleAxisd(0.3 + 0.1 * i, Vector3d(1, 0, 0)) *
+		                  Eigen::AngleAxisd(0.2, Vector3d(0, 0, 1))).toRotationMatrix();
+
+		seg->SetTransform(Vector3d(0, (parent) ? 1.0 : 0.0, 0), Matrix3d::Identity(), Matrix3d::Identity(), 1.0);
+		seg->SetBasis(basis);
+		seg->SetWeight((i % 2) ? 0 : 2, 0.05);
+		seg->SetDoFId(i * 2);
+
+		if (parent)
+			seg->SetParent(parent);
+
+		segments.push_back(seg);
+		parent = seg;
+	}
+
+	IK_QPositionTask task(true, parent, Vector3d(0, 0, 0));
+	std::list<IK_QTask *> tasks(1, &task);
+	task.SetId(0);
+
+	IK_QSkeleton skeleton;
+	IK_QPose pose;
+
+	skeleton.Setup(segments[0], tasks);
+	pose.Resize(skeleton);
+	skeleton.ReadPose(pose);
+	skeleton.UpdateTransforms(pose, Affine3d::Identity(), true);
+	IK_QSegment::UpdateAxes(IK_QSegment::JOINT_SWING, segments, pose);
+
+	IK_QJacobian *transpose = IK_QJacobian::CreateDynamic(IK_QJacobian::PRECISION_DOUBLE, NULL);
+	IK_QJacobian *dls = IK_QJacobian::CreateDynamic(IK_QJacobian::PRECISION_DOUBLE, NULL);
+	IK_QJacobian *unweighted = IK_QJacobian::CreateDynamic(IK_QJacobian::PRECISION_DOUBLE, NULL);
+
+	double min_cosine = 1.0, max_unweighted_cosine = -1.0;
+
+	for (i = 0; i < goals; i++) {
+		double t = i * 0.7;
+		task.SetGoal(parent->GlobalEnd(pose) + Vector3d(cos(t), 0.5 * sin(2.0 * t), sin(t)) * 0.5);
+		task.ReadGoal(pose);
+
+		// levenberg-marquardt is DLS with the given damping
+		Step(*transpose, IK_QJacobian::INVERT_TRANSPOSE, pose, segments, task, true);
+		Step(*dls, IK_QJacobian::INVERT_LM, pose, segments, task, true);
+		Step(*unweighted, IK_QJacobian::INVERT_TRANSPOSE, pose, segments, task, false);
+
+		double cosine = Cosine(*transpose, *dls, num * 2);
+		double unweighted_cosine = Cosine(*transpose, *unweighted, num * 2);
+
+		if (cosine < min_cosine)
+			min_cosine = cosine;
+		if (unweighted_cosine > max_unweighted_cosine)
+			max_unweighted_cosine = unweighted_cosine;
+	}
+
+	printf("cosine between transpose and damped DLS steps, at least  %.6f\n", min_cosine);
+	printf("cosine between weighted and unweighted transpose, at most %.6f\n", max_unweighted_cosine);
+
+	// the weights must matter, or the comparison checks nothing
+	if (min_cosine < 0.9999 || max_unweighted_cosine > 0.99) {
+		printf("FAILED\n");
+		failed++;
+	}
+
+	IK_QArenaDelete<IK_QJacobian>(NULL, transpose);
+	IK_QArenaDelete<IK_QJacobian>(NULL, dls);
+	IK_QArenaDelete<IK_QJacobian>(NULL, unweighted);
+
+	for (i = num - 1; i >= 0; i--)
+		delete segments[i];
+
+	return (failed) ? 1 : 0;
+}
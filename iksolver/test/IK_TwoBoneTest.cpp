@@ -0,0 +1,160 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * The Original Code is Copyright (C) 2001-2002 by NaN Holding BV.
+ * All rights reserved.
+ *
+ * The Original Code is: all of this file.
+ *
+ * Original Author: Laurence
+ * Contributor(s): Brecht
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/** \file iksolver/test/IK_TwoBoneTest.cpp
+ *  \ingroup iksolver
+ */
+
+/**
+ * Checks that a leg whose thigh is not the root of the tree is solved in
+ * closed form. The hips above it have no DoF and a rotated rest basis, and
+ * a spine with DoF but no goal branches off them. Every solve must take no
+ * iterations, reach the goal and give the same knee as the same leg solved
+ * on its own, with the thigh as root.
+ */
+
+#include "IK_solver.h"
+#include "IK_QSegment.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+static IK_Segment *CreateSegment(int flag, IK_Segment *parent, const float start[3],
+                                 const float rest[][3], float length)
+{
+	const float basis[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+	float mstart[3] = {start[0], start[1], start[2]};
+	float mrest[3][3], mbasis[3][3];
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			mrest[i][j] = rest[i][j];
+			mbasis[i][j] = basis[i][j];
+		}
+	}
+
+	IK_Segment *seg = IK_CreateSegment(flag);
+	IK_SetTransform(seg, mstart, mrest, mbasis, length);
+
+	if (parent)
+		IK_SetParent(seg, parent);
+
+	return seg;
+}
+
+// the leg, and the tip of it
+static IK_Segment *CreateLeg(IK_Segment *parent, const float start[3], const float rest[][3],
+                             IK_Segment **shin)
+{
+	const float zero[3] = {0, 0, 0};
+	const float identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+	IK_Segment *thigh = CreateSegment(IK_XDOF | IK_YDOF | IK_ZDOF, parent, start, rest, 1.0f);
+	*shin = CreateSegment(IK_XDOF, thigh, zero, identity, 0.9f);
+
+	return thigh;
+}
+
+int main()
+{
+	const float zero[3] = {0, 0, 0};
+	const float hip[3] = {0.2f, 0, 0};
+	const float identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+	const float c = cosf(0.4f), s = sinf(0.4f);
+	const float tilted[3][3] = {{c, -s, 0}, {s, c, 0}, {0, 0, 1}};
+	const float tolerance = 1e-4f;
+	const int solves = 200;
+	double max_distance = 0.0, max_knee = 0.0;
+	int iterations = 0, converged = 0;
+	int i;
+
+	IK_Segment *hips = CreateSegment(0, NULL, zero, tilted, 0.3f);
+	IK_Segment *spine = CreateSegment(IK_XDOF | IK_ZDOF, hips, zero, identity, 0.5f);
+	IK_Segment *shin, *ref_shin;
+	IK_Segment *thigh = CreateLeg(hips, hip, identity, &shin);
+
+	// the same leg as root, starting where the hips put the thigh
+	((IK_QSegment *)hips)->UpdateTransform(Affine3d::Identity());
+	Vector3d thigh_start = ((IK_QSegment *)thigh)->GlobalStart();
+	const float ref_start[3] = {(float)thigh_start[0], (float)thigh_start[1], (float)thigh_start[2]};
+	IK_Segment *ref_thigh = CreateLeg(NULL, ref_start, tilted, &ref_shin);
+
+	IK_Solver *solver = IK_CreateSolver(hips);
+	IK_Solver *ref_solver = IK_CreateSolver(ref_thigh);
+	float goal[3] = {0, 0, 0};
+	float pole[3] = {0.5f, 0.5f, 2.0f};
+	IK_Task *task = IK_SolverAddGoal(solver, shin, goal, 1.0f);
+	IK_Task *ref_task = IK_SolverAddGoal(ref_solver, ref_shin, goal, 1.0f);
+
+	for (i = 0; i < solves; i++) {
+		double t = i * 0.1;
+
+		goal[0] = 0.6f * (float)cos(t) + 0.4f;
+		goal[1] = 1.2f + 0.3f * (float)sin(0.7 * t);
+		goal[2] = 0.6f * (float)sin(t);
+
+		IK_SolverSetGoal(solver, task, goal);
+		IK_SolverSetPoleVectorConstraint(solver, shin, goal, pole, 0.0f, 0);
+		IK_SolverSetGoal(ref_solver, ref_task, goal);
+		IK_SolverSetPoleVectorConstraint(ref_solver, ref_shin, goal, pole, 0.0f, 0);
+
+		converged += IK_Solve(solver, tolerance, 200);
+		iterations += IK_SolverGetIterations(solver);
+		IK_Solve(ref_solver, tolerance, 200);
+
+		Vector3d knee = ((IK_QSegment *)shin)->GlobalStart();
+		Vector3d ref_knee = ((IK_QSegment *)ref_shin)->GlobalStart();
+		Vector3d g(goal[0], goal[1], goal[2]);
+
+		max_distance = std::max(max_distance, (((IK_QSegment *)shin)->GlobalEnd() - g).norm());
+		max_knee = std::max(max_knee, (knee - ref_knee).norm());
+	}
+
+	printf("converged %d/%d in %d iterations, distance to goal at most %.1e, "
+	       "knee away from the root leg at most %.1e\n",
+	       converged, solves, iterations, max_distance, max_knee);
+
+	bool ok = (converged == solves && iterations == 0 &&
+	           max_distance <= tolerance && max_knee <= 1e-4);
+
+	if (!ok)
+		printf("FAILED\n");
+
+	IK_FreeSolver(solver);
+	IK_FreeSolver(ref_solver);
+	IK_FreeSegment(ref_shin);
+	IK_FreeSegment(ref_thigh);
+	IK_FreeSegment(shin);
+	IK_FreeSegment(thigh);
+	IK_FreeSegment(spine);
+	IK_FreeSegment(hips);
+
+	return (ok) ? 0 : 1;
+}